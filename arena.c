@@ -0,0 +1,72 @@
+// Per-command bump allocator
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdalign.h>
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+struct arenaBlock {
+    struct arenaBlock* next;
+    size_t size;        // usable bytes in data
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+static struct arenaBlock* newBlock(size_t size)
+{
+    struct arenaBlock* block = malloc(sizeof(struct arenaBlock) + size);
+    if (block == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+void* arenaAlloc(struct arena* arena, size_t size)
+{
+    size = (size + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1);
+
+    if (arena->current == NULL) {
+        arena->first = arena->current = newBlock(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+    }
+
+    struct arenaBlock* block = arena->current;
+    if (block->size - block->used < size) {
+        // Oversized requests get a block of their own
+        block = newBlock(size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE);
+        arena->current->next = block;
+        arena->current = block;
+    }
+
+    void* memory = block->data + block->used;
+    block->used += size;
+    return memory;
+}
+
+void arenaReset(struct arena* arena)
+{
+    if (arena->first == NULL) {
+        return;
+    }
+    struct arenaBlock* block = arena->first->next;
+    while (block != NULL) {
+        struct arenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->first->next = NULL;
+    arena->first->used = 0;
+    arena->current = arena->first;
+}
+
+void arenaFree(struct arena* arena)
+{
+    arenaReset(arena);
+    free(arena->first);
+    arena->first = arena->current = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* arena
+* A bump allocator for memory that lives exactly as long as one command.
+* Everything allocated from it is released together by arenaReset, which
+* keeps the first block for reuse, so a command that fits costs no calls
+* to the system allocator at all once the shell has warmed up.
+*/
+struct arenaBlock;
+
+struct arena {
+    struct arenaBlock* first;    // kept across resets
+    struct arenaBlock* current;  // the block allocations are carved from
+};
+
+/*arenaAlloc
+* arena     the arena to allocate from; a zeroed struct arena is a valid empty arena
+* size      the number of bytes needed
+* returns memory aligned for any type; exits the shell if memory runs out
+*/
+void* arenaAlloc(struct arena* arena, size_t size);
+
+/*arenaReset
+* arena     the arena whose allocations are all released at once
+*/
+void arenaReset(struct arena* arena);
+
+/*arenaFree
+* arena     the arena whose memory is returned to the system
+*/
+void arenaFree(struct arena* arena);
+
+#endif
@@ -1,103 +1,333 @@
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <ctype.h>
-#include "argparse.h"
 #include <string.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <sys/wait.h>
-#include <errno.h>
+#include "argparse.h"
+#include "wildcard.h"
+#include "vars.h"
 
 #define FALSE (0)
 #define TRUE  (1)
 
+char argPipe[] = "|";
+char argInput[] = "<";
+char argOutput[] = ">";
+char argAppend[] = ">>";
+char argError[] = "2>";
+char argBackground[] = "&";
+
 /*
-* argCount is a helper function that takes in a String and returns the number of "words" in the string assuming that whitespace is the only possible delimiter.
+* isBlank is a helper function that tells whether c separates arguments.
 */
-static int argCount(char* line)
+static int isBlank(char c)
 {
-    int count = 0;
-    int inWord = FALSE; // flag to track whether currently in a word
-
-    // Iterate through each character in the string
-    while (*line != '\0') {
-        if (isspace(*line)) {
-            // If the current character is whitespace and we were in a word, increment the count
-            if (inWord) {
-                count++;
-                inWord = FALSE; // reset the flag
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/*
+* operatorAt is a helper function that returns the redirection or pipe operator
+* starting at line, or NULL if line does not start with one, and stores its length
+* in *length. atWordStart tells whether line is at the beginning of a word, which "2>" requires.
+*/
+static char* operatorAt(const char* line, const char* end, int atWordStart, int* length)
+{
+    switch (*line) {
+    case '|':
+        *length = 1;
+        return argPipe;
+    case '&':
+        *length = 1;
+        return argBackground;
+    case '<':
+        *length = 1;
+        return argInput;
+    case '>':
+        if (line + 1 < end && line[1] == '>') {
+            *length = 2;
+            return argAppend;
+        }
+        *length = 1;
+        return argOutput;
+    case '2':
+        if (atWordStart && line + 1 < end && line[1] == '>') {
+            *length = 2;
+            return argError;
+        }
+        return NULL;
+    default:
+        return NULL;
+    }
+}
+
+/*
+* isWildcard is a helper function that tells whether c is special in a pattern.
+*/
+static int isWildcard(char c)
+{
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+/* What each character means to copyWord; this has to agree with isBlank
+* and with the operators operatorAt finds inside a word.
+*/
+enum { CHAR_PLAIN, CHAR_END, CHAR_QUOTE, CHAR_WILD, CHAR_DOLLAR };
+
+static const unsigned char wordChars[256] = {
+    [' '] = CHAR_END, ['\t'] = CHAR_END, ['\n'] = CHAR_END, ['\r'] = CHAR_END, ['\v'] = CHAR_END,
+    ['\f'] = CHAR_END, ['|'] = CHAR_END, ['&'] = CHAR_END, ['<'] = CHAR_END, ['>'] = CHAR_END,
+    ['\''] = CHAR_QUOTE, ['"'] = CHAR_QUOTE, ['\\'] = CHAR_QUOTE,
+    ['*'] = CHAR_WILD, ['?'] = CHAR_WILD, ['['] = CHAR_WILD,
+    ['$'] = CHAR_DOLLAR,
+};
+
+// What copyWord found in a word
+#define WORD_WILD     (1)   // an unquoted *, ? or [
+#define WORD_QUOTED   (2)   // a quote or an escape
+#define WORD_EXPANDED (4)   // a variable expansion
+
+/*
+* expansionAt is a helper function that reads the $?, $$, $NAME or ${NAME}
+* starting at the $ at p, and stores how many characters it takes in *used.
+* returns the value, "" for a variable that is not set, or NULL if the $ is
+* not followed by a name and stands for itself
+*/
+static const char* expansionAt(const char* p, const char* end, size_t* used)
+{
+    const char* name = p + 1;
+    size_t len;
+    if (name < end && (*name == '?' || *name == '$')) {
+        len = 1;
+        *used = 2;
+    } else if (name < end && *name == '{') {
+        name++;
+        const char* close = memchr(name, '}', end - name);
+        if (close == NULL) {
+            return NULL;
+        }
+        len = close - name;
+        if (!(len == 1 && (*name == '?' || *name == '$')) &&
+            (len == 0 || varsNameLength(name, len) != len)) {
+            return NULL;
+        }
+        *used = close + 1 - p;
+    } else {
+        len = varsNameLength(name, end - name);
+        if (len == 0) {
+            return NULL;
+        }
+        *used = len + 1;
+    }
+    const char* value = varsGet(name, len);
+    return value ? value : "";
+}
+
+/*
+* copyExpansion is a helper function that copies the value of the expansion
+* starting at the $ at *pp to out, or the $ itself if no name follows it, and
+* advances *pp past it. Its characters never act as wildcards, so in a pattern
+* they are escaped.
+* returns the end of the copy
+*/
+static char* copyExpansion(const char** pp, const char* end, char* out, int pattern, int* flags)
+{
+    size_t used;
+    const char* value = expansionAt(*pp, end, &used);
+    if (value == NULL) {
+        *out++ = *(*pp)++;
+        return out;
+    }
+    *pp += used;
+    *flags |= WORD_EXPANDED;
+    if (!pattern) {
+        size_t len = strlen(value);
+        memcpy(out, value, len);
+        return out + len;
+    }
+    for (; *value != '\0'; value++) {
+        if (isWildcard(*value)) {
+            *out++ = '\\';
+        }
+        *out++ = *value;
+    }
+    return out;
+}
+
+/*
+* copyWord is a helper function that copies the word starting at *pp to out,
+* removing its quotes and escapes, expanding its variables outside single
+* quotes, and advances *pp past it. The WORD_ flags of what the word holds are
+* added to *flags. With pattern set, a quoted or escaped *, ?, [ or \ is written
+* with a \ in front, as is every one that came from a variable, so the copy can
+* be used as a glob pattern in which only the unquoted wildcards are special.
+* returns the end of the copy, or NULL on an unterminated quote
+*/
+static char* copyWord(const char** pp, const char* end, char* out, int pattern, int* flags)
+{
+    const char* p = *pp;
+    int wild = FALSE;
+    while (p < end) {
+        unsigned char kind = wordChars[(unsigned char)*p];
+        if (kind == CHAR_PLAIN || kind == CHAR_WILD) {
+            wild |= (kind == CHAR_WILD);
+            *out++ = *p++;
+        } else if (kind == CHAR_END) {
+            break;
+        } else if (kind == CHAR_DOLLAR) {
+            // Through a copy, so p itself can stay in a register
+            const char* q = p;
+            out = copyExpansion(&q, end, out, pattern, flags);
+            p = q;
+        } else if (*p == '\'') {
+            const char* close = memchr(p + 1, '\'', end - p - 1);
+            if (close == NULL) {
+                return NULL;
             }
-        } else {
-            // If the current character is not whitespace, set the flag to indicate we are in a word
-            if (!inWord) {
-                inWord = TRUE;
+            *flags |= WORD_QUOTED;
+            if (!pattern) {
+                memcpy(out, p + 1, close - p - 1);
+                out += close - p - 1;
+            }
+            for (p++; pattern && p < close; p++) {
+                if (isWildcard(*p)) {
+                    *out++ = '\\';
+                }
+                *out++ = *p;
+            }
+            p = close + 1;
+        } else if (*p == '"') {
+            *flags |= WORD_QUOTED;
+            p++;
+            while (p < end && *p != '"') {
+                if (*p == '$') {
+                    const char* q = p;
+                    out = copyExpansion(&q, end, out, pattern, flags);
+                    p = q;
+                    continue;
+                }
+                if (*p == '\\' && p + 1 < end &&
+                    (p[1] == '"' || p[1] == '\\' || p[1] == '$' || p[1] == '`')) {
+                    p++;
+                }
+                if (pattern && isWildcard(*p)) {
+                    *out++ = '\\';
+                }
+                *out++ = *p++;
             }
+            if (p == end) {
+                return NULL;
+            }
+            p++;
+        } else if (*p == '\\' && p + 1 < end) {
+            *flags |= WORD_QUOTED;
+            if (pattern && isWildcard(p[1])) {
+                *out++ = '\\';
+            }
+            *out++ = p[1];
+            p += 2;
+        } else {
+            *out++ = *p++;
         }
-        line++; // Move to the next character
     }
+    *pp = p;
+    *flags |= wild ? WORD_WILD : 0;
+    return out;
+}
 
-    // If we were in a word when reaching the end of the string, increment the count
-    if (inWord) {
-        count++;
+/*
+* expansionLength is a helper function that adds up the lengths of the values
+* of every expansion in the line, quoted or not, which bounds how much longer
+* than the line its words can get.
+*/
+static size_t expansionLength(const char* line, const char* end)
+{
+    size_t extra = 0;
+    for (const char* p = line; (p = memchr(p, '$', end - p)) != NULL; ) {
+        size_t used;
+        const char* value = expansionAt(p, end, &used);
+        if (value == NULL) {
+            p++;
+            continue;
+        }
+        extra += strlen(value);
+        p += used;
     }
-
-    return count;
+    return extra;
 }
 
 /*
 * Argparse takes in a String and returns an array of strings from the input.
-* The arguments in the String are broken up by whitespaces in the string.
+* The line is read once: each argument is unquoted straight into one buffer
+* taken from the arena and NUL terminated there. No argument is ever longer than
+* the text it came from plus the values expanded into it, and every argument after
+* the first consumed at least one separator or operator character, so len + 1
+* bytes plus the length of every value in the line always hold them all, and
+* len + 1 pointers always hold the array.
+* An unquoted # at the start of a word comments out the rest of the line.
+* Variables are expanded inside words and are not split again, and a word that
+* was nothing but unquoted expansions of empty values is dropped.
+* Words with unquoted wildcards are expanded into the paths they match once
+* the whole line is split, so their patterns are only built for those words.
 * The count of how many arguments there are is saved in the argcp pointer
 */
-char** argparse(char* line, int* argcp)
+char** argparse(const char* line, size_t len, int* argcp, struct arena* arena)
 {
-    // Count the number of arguments
-    *argcp = argCount(line);
-
-    // Allocate memory for an array of strings (pointers)
-    char** args = (char**)malloc((*argcp + 1) * sizeof(char*)); // Add 1 for NULL terminator
-    if (args == NULL) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(EXIT_FAILURE);
-    }
+    const char* p = line;
+    const char* end = line + len;
+    size_t extra = memchr(line, '$', len) ? expansionLength(line, end) : 0;
+    char** args = arenaAlloc(arena, (len + 2) * sizeof(char*));
+    char* out = arenaAlloc(arena, len + extra + 1);
+    char** patterns = NULL;
+    int count = 0;
 
-    int i = 0;
-    while (*line != '\0') {
-        // Skip leading whitespace
-        while (isspace(*line)) {
-            line++;
+    for (;;) {
+        while (p < end && isBlank(*p)) {
+            p++;
         }
-        if (*line == '\0') {
-            break; // Exit loop if end of string is reached
+        if (p == end || *p == '#') {
+            break;
         }
 
-        // Store the starting position of the argument
-        char* start = line;
-
-        // Find the end of the argument
-        while (*line != '\0' && !isspace(*line)) {
-            line++;
+        int opLength;
+        char* op = operatorAt(p, end, TRUE, &opLength);
+        if (op != NULL) {
+            args[count++] = op;
+            p += opLength;
+            continue;
         }
 
-        // Calculate the length of the argument
-        size_t length = line - start;
+        // Copy one argument, removing quotes and escapes as they are found
+        const char* wordStart = p;
+        char* start = out;
+        int flags = 0;
+        out = copyWord(&p, end, out, FALSE, &flags);
+        if (out == NULL) {
+            fprintf(stderr, "syntax error: unterminated quote\n");
+            return NULL;
+        }
+        if (out == start && (flags & (WORD_EXPANDED | WORD_QUOTED)) == WORD_EXPANDED) {
+            continue;
+        }
+        *out++ = '\0';
 
-        // Allocate memory for the argument and copy it into the args array
-        args[i] = strndup(start, length);
-        if (args[i] == NULL) {
-            // Free all previously allocated memory
-            for (int j = 0; j < i; j++) {
-                free(args[j]);
+        // A word with an unquoted wildcard also gets a pattern for expansion
+        if (flags & WORD_WILD) {
+            if (patterns == NULL) {
+                patterns = arenaAlloc(arena, (len + 2) * sizeof(char*));
+                memset(patterns, 0, (len + 2) * sizeof(char*));
             }
-            free(args);
-            fprintf(stderr, "Memory allocation failed\n");
-            exit(EXIT_FAILURE);
+            const char* q = wordStart;
+            char* pattern = arenaAlloc(arena, 2 * (p - wordStart + extra) + 1);
+            *copyWord(&q, end, pattern, TRUE, &flags) = '\0';
+            patterns[count] = pattern;
         }
-        i++;
+        args[count++] = start;
     }
 
     // Add NULL terminator to the end of the args array
-    args[i] = NULL;
-
+    args[count] = NULL;
+    *argcp = count;
+    if (patterns != NULL) {
+        args = wildcardExpand(args, argcp, patterns, arena);
+    }
     return args;
 }
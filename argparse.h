@@ -1,12 +1,37 @@
 #ifndef ARGPARSE_H
 #define ARGPARSE_H
 
+#include <stddef.h>
+#include "arena.h"
+
+/* The operators |, <, >, >>, 2> and & are returned as these exact pointers, so
+* callers compare against them instead of with strcmp; a quoted "|" is then
+* an ordinary argument that happens to contain a bar.
+*/
+extern char argPipe[];
+extern char argInput[];
+extern char argOutput[];
+extern char argAppend[];
+extern char argError[];
+extern char argBackground[];
+
 /*Argparse
-* line        the input string that contains arguments seperated by whitespaces
+* line        the input string that contains arguments seperated by whitespaces;
+*             the operators |, <, >, >>, 2> and & are split into arguments of their own
+*             unless they are quoted. '...' quotes everything literally, "..." allows
+*             \" \\ \$ and \` escapes, and outside quotes \ escapes any character.
+*             An unquoted # at the start of a word begins a comment.
+*             $NAME, ${NAME}, $? and $$ are expanded outside single quotes; the
+*             value stays part of its word and is never split or globbed.
+*             A word with an unquoted *, ? or [...] is replaced by the paths it
+*             matches, sorted, or left as it is if it matches none.
+*             line is not modified and need not be NUL terminated.
+* len         the length of line
 * arggcp      A int pointer that the count of the amount of arguments will be stored
-* returns a array of char*'s each of which is a argument 
+* arena       the arena the arguments and the array are allocated from
+* returns a array of char*'s each of which is a argument, or NULL on an unterminated
+*         quote (already reported)
 */
-char** argparse(char* line, int* argcp);
+char** argparse(const char* line, size_t len, int* argcp, struct arena* arena);
 
 #endif
-
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Compares benchmark results with a baseline, both as written by run.sh.
+#
+# usage: compare.sh baseline.jsonl results.jsonl [threshold-percent]
+#
+# Prints every result next to its baseline and exits with status 1 if any
+# result is worse than its baseline by more than the threshold (default 10%).
+# Results without a baseline are listed but never fail.
+set -e
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 baseline.jsonl results.jsonl [threshold-percent]" >&2
+    exit 2
+fi
+if [ ! -f "$1" ]; then
+    echo "compare: no baseline at $1; store one with make bench-baseline" >&2
+    exit 1
+fi
+
+awk -v threshold="${3:-10}" '
+function field(line, key,    pattern, value) {
+    pattern = "\"" key "\": *"
+    if (!match(line, pattern "(\"[^\"]*\"|[-0-9.e+]+)")) {
+        return ""
+    }
+    value = substr(line, RSTART, RLENGTH)
+    sub(pattern, "", value)
+    gsub("\"", "", value)
+    return value
+}
+FNR == NR {
+    base[field($0, "name")] = field($0, "value")
+    next
+}
+{
+    name = field($0, "name")
+    value = field($0, "value") + 0
+    if (!(name in base)) {
+        printf "%-22s %14.6g %-10s (no baseline)\n", name, value, field($0, "unit")
+        next
+    }
+    old = base[name] + 0
+    change = old != 0 ? (value - old) / old * 100 : 0
+    worse = field($0, "better") == "higher" ? -change : change
+    status = worse > threshold ? "REGRESSION" : "ok"
+    if (worse > threshold) {
+        failed++
+    }
+    printf "%-22s %14.6g %-10s baseline %14.6g  %+7.1f%%  %s\n", name, value, field($0, "unit"), old, change, status
+}
+END {
+    if (failed) {
+        printf "%d regression(s) beyond %s%%\n", failed, threshold
+        exit 1
+    }
+}' "$1" "$2"
@@ -0,0 +1,57 @@
+/* dispatch_bench -- latency of resolving and running a builtin.
+ *
+ * builtIn is called in a loop on a builtin that does no I/O (set +e) and on
+ * a name that is not a builtin, which is what every external command pays
+ * before it is spawned.
+ *
+ * usage: dispatch_bench [-n iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include "builtin.h"
+#include "shell.h"
+
+// builtin.c reads the shell state that myshell.c normally defines
+struct shellState shell;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double measure(char** args, int argc, int iterations)
+{
+    int status;
+    double start = now();
+    for (int i = 0; i < iterations; i++) {
+        builtIn(args, argc, &status);
+    }
+    return (now() - start) / iterations * 1e9;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 5000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt == 'n') {
+            iterations = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    char* hit[] = { "set", "+e", NULL };
+    char* miss[] = { "gzip", "-9", NULL };
+    printf("{\"name\": \"dispatch.builtin\", \"unit\": \"ns\", \"value\": %.2f, \"better\": \"lower\", "
+           "\"iterations\": %d}\n", measure(hit, 2, iterations), iterations);
+    printf("{\"name\": \"dispatch.external\", \"unit\": \"ns\", \"value\": %.2f, \"better\": \"lower\", "
+           "\"iterations\": %d}\n", measure(miss, 2, iterations), iterations);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,115 @@
+/* harness -- times a command for the macrobenchmarks.
+ *
+ * The command is run the given number of times with its output thrown away,
+ * after an untimed preparation command each time, and one JSON line is
+ * printed with the median. Without -k the value is the median in seconds,
+ * where lower is better; with -k COUNT it is COUNT divided by the median,
+ * a rate in UNIT/s where higher is better.
+ *
+ * usage: harness [-n runs] [-p prep] [-k count -u unit] name -- command...
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int compareDoubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
+
+static double runOnce(char** command)
+{
+    double start = now();
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        int nullFD = open("/dev/null", O_WRONLY);
+        dup2(nullFD, STDOUT_FILENO);
+        execvp(command[0], command);
+        perror(command[0]);
+        _exit(127);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    double elapsed = now() - start;
+    if (!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+        fprintf(stderr, "harness: %s failed\n", command[0]);
+        exit(EXIT_FAILURE);
+    }
+    return elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    int runs = 5;
+    const char* prep = NULL;
+    double count = 0;
+    const char* unit = "items";
+    int opt;
+    while ((opt = getopt(argc, argv, "+n:p:k:u:")) != -1) {
+        if (opt == 'n') {
+            runs = atoi(optarg);
+        } else if (opt == 'p') {
+            prep = optarg;
+        } else if (opt == 'k') {
+            count = atof(optarg);
+        } else if (opt == 'u') {
+            unit = optarg;
+        } else {
+            break;
+        }
+    }
+    if (runs < 1 || optind + 2 >= argc || strcmp(argv[optind + 1], "--") != 0) {
+        fprintf(stderr, "usage: %s [-n runs] [-p prep] [-k count -u unit] name -- command...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char* name = argv[optind];
+    char** command = &argv[optind + 2];
+
+    double* times = malloc(runs * sizeof(double));
+    if (times == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    for (int i = 0; i < runs; i++) {
+        if (prep != NULL && system(prep) != 0) {
+            fprintf(stderr, "harness: preparation failed: %s\n", prep);
+            return EXIT_FAILURE;
+        }
+        times[i] = runOnce(command);
+    }
+    qsort(times, runs, sizeof(double), compareDoubles);
+    double median = times[runs / 2];
+
+    if (count > 0) {
+        printf("{\"name\": \"%s\", \"unit\": \"%s/s\", \"value\": %.3f, \"better\": \"higher\", "
+               "\"runs\": %d, \"median_s\": %.6f, \"min_s\": %.6f}\n",
+               name, unit, count / median, runs, median, times[0]);
+    } else {
+        printf("{\"name\": \"%s\", \"unit\": \"s\", \"value\": %.6f, \"better\": \"lower\", "
+               "\"runs\": %d, \"min_s\": %.6f, \"max_s\": %.6f}\n",
+               name, median, runs, times[0], times[runs - 1]);
+    }
+    free(times);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,83 @@
+#!/bin/sh
+# Runs every benchmark and prints one JSON line per result.
+#
+# Synthetic data is generated once under BENCH_DIR and reused by later runs.
+# Sizes can be lowered for a quick run:
+#   BENCH_DIR          where the data lives (default: $TMPDIR/myshell-bench)
+#   BENCH_RUNS         runs per macrobenchmark; the median is reported (default: 5)
+#   BENCH_TAIL_SIZES   sizes of the sparse tail inputs (default: 1G 10G 100G)
+#   BENCH_CP_MB        size of the file copied by cp (default: 1024)
+#   BENCH_CP_FILES     number of 64 KiB files in the tree copied by cp -r (default: 4096)
+#   BENCH_LS_ENTRIES   number of entries in the ls -l directory (default: 1000000)
+set -e
+
+BUILD=${BUILD:-build}
+BIN=$BUILD/bench
+SHELL_BIN=$(pwd)/myshell
+DIR=${BENCH_DIR:-${TMPDIR:-/tmp}/myshell-bench}
+RUNS=${BENCH_RUNS:-5}
+TAIL_SIZES=${BENCH_TAIL_SIZES:-1G 10G 100G}
+CP_MB=${BENCH_CP_MB:-1024}
+CP_FILES=${BENCH_CP_FILES:-4096}
+LS_ENTRIES=${BENCH_LS_ENTRIES:-1000000}
+
+mkdir -p "$DIR"
+log() { echo "bench: $*" >&2; }
+
+# Microbenchmarks
+$BIN/tokenize_bench
+$BIN/dispatch_bench
+$BIN/spawn_bench -n 2000 -m 256
+
+# A script of builtins: the whole per-line path without any process launches
+if [ ! -f "$DIR/script.msh" ]; then
+    log "generating script"
+    seq 1 100000 | sed 's/.*/set +e # line &/' > "$DIR/script.msh"
+fi
+$BIN/harness -n "$RUNS" -k 100000 -u lines script.lines -- "$SHELL_BIN" "$DIR/script.msh"
+
+# tail on sparse files: only the last block holds data, so the time must not grow with the size
+for size in $TAIL_SIZES; do
+    file="$DIR/tail_$size"
+    if [ ! -f "$file" ]; then
+        log "generating $file"
+        truncate -s "$size" "$file"
+        seq 1 1000 | sed 's/$/ synthetic log line/' >> "$file"
+    fi
+    $BIN/harness -n "$RUNS" "tail.$size" -- "$SHELL_BIN" -c "tail -n 10 $file"
+done
+
+# cp of one large file and of a tree of small ones
+if [ ! -f "$DIR/cp_src" ]; then
+    log "generating $DIR/cp_src"
+    head -c "$((CP_MB * 1024 * 1024))" /dev/urandom > "$DIR/cp_src"
+fi
+$BIN/harness -n "$RUNS" -p "rm -f $DIR/cp_dst" -k "$CP_MB" -u MiB cp.file -- \
+    "$SHELL_BIN" -c "cp $DIR/cp_src $DIR/cp_dst"
+rm -f "$DIR/cp_dst"
+
+if [ ! -d "$DIR/cp_tree" ]; then
+    log "generating $DIR/cp_tree"
+    mkdir -p "$DIR/cp_tree"
+    head -c 65536 /dev/urandom > "$DIR/cp_tree/seed"
+    i=0
+    while [ $i -lt "$CP_FILES" ]; do
+        mkdir -p "$DIR/cp_tree/d$((i / 256))"
+        i=$((i + 1))
+    done
+    seq 1 "$CP_FILES" | awk -v d="$DIR/cp_tree" '{ printf "%s/d%d/f%d\n", d, ($1 - 1) / 256, $1 }' |
+        xargs -n 256 sh -c 'for f; do cp "$0" "$f"; done' "$DIR/cp_tree/seed"
+    rm "$DIR/cp_tree/seed"
+fi
+$BIN/harness -n "$RUNS" -p "rm -rf $DIR/cp_tree_dst" -k "$((CP_FILES * 64 / 1024))" -u MiB cp.tree -- \
+    "$SHELL_BIN" -c "cp -r $DIR/cp_tree $DIR/cp_tree_dst"
+rm -rf "$DIR/cp_tree_dst"
+
+# ls -l on one huge directory
+if [ ! -d "$DIR/ls_$LS_ENTRIES" ]; then
+    log "generating $DIR/ls_$LS_ENTRIES"
+    mkdir -p "$DIR/ls_$LS_ENTRIES.tmp"
+    (cd "$DIR/ls_$LS_ENTRIES.tmp" && seq -f 'entry%.0f' 1 "$LS_ENTRIES" | xargs touch)
+    mv "$DIR/ls_$LS_ENTRIES.tmp" "$DIR/ls_$LS_ENTRIES"
+fi
+$BIN/harness -n "$RUNS" -k "$LS_ENTRIES" -u entries ls.long -- "$SHELL_BIN" -c "ls -l $DIR/ls_$LS_ENTRIES"
@@ -0,0 +1,98 @@
+/* spawn_bench -- compares process launch rates of the shell's two spawn paths.
+ *
+ * The old path is what processline used to do: fork() followed by execvp().
+ * The new path is spawnCommand from spawncmd.c. Both launch the same program
+ * repeatedly and wait for it; the shell's growing resident memory is
+ * simulated by touching a configurable amount of heap first, since that is
+ * what makes fork slower.
+ *
+ * usage: spawn_bench [-n iterations] [-m megabytes] [program]
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "spawncmd.h"
+
+extern char **environ;
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static pid_t forkExec(char** argv)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t posixSpawn(char** argv)
+{
+    int fds[3] = { -1, -1, -1 };
+    return spawnCommand(argv, fds, environ, -1);
+}
+
+static double measure(const char* name, pid_t (*launch)(char**), char** argv, int iterations, int megabytes)
+{
+    double start = now();
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = launch(argv);
+        if (pid == -1) {
+            perror(name);
+            exit(EXIT_FAILURE);
+        }
+        waitpid(pid, NULL, 0);
+    }
+    double rate = iterations / (now() - start);
+    printf("{\"name\": \"%s\", \"unit\": \"spawns/s\", \"value\": %.1f, \"better\": \"higher\", "
+           "\"rss_mb\": %d, \"iterations\": %d}\n", name, rate, megabytes, iterations);
+    return rate;
+}
+
+int main(int argc, char** argv)
+{
+    int iterations = 2000;
+    int megabytes = 256;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:m:")) != -1) {
+        if (opt == 'n') {
+            iterations = atoi(optarg);
+        } else if (opt == 'm') {
+            megabytes = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n iterations] [-m megabytes] [program]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    char* program[] = { optind < argc ? argv[optind] : "true", NULL };
+
+    // Stand-in for a long-running shell's heap: resident pages that fork has to copy page tables for
+    size_t bytes = (size_t)megabytes << 20;
+    char* heap = malloc(bytes ? bytes : 1);
+    if (heap == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    memset(heap, 1, bytes);
+
+    double forkRate = measure("spawn.fork_execvp", forkExec, program, iterations, megabytes);
+    double spawnRate = measure("spawn.posix_spawn", posixSpawn, program, iterations, megabytes);
+    printf("{\"name\": \"spawn.speedup\", \"unit\": \"x\", \"value\": %.2f, \"better\": \"higher\", "
+           "\"rss_mb\": %d}\n", spawnRate / forkRate, megabytes);
+
+    free(heap);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/* tokenize_bench -- tokenizer throughput on generated command lines.
+ *
+ * A fixed-seed generator builds lines that mix plain words, quoted strings,
+ * escapes, pipes and redirections, and argparse is run over all of them with
+ * the arena reset after each line, as processline does.
+ *
+ * usage: tokenize_bench [-n lines] [-r rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "argparse.h"
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char* pieces[] = {
+    "ls", "-l", "/usr/lib/x86_64-linux-gnu", "|", "grep", "\"foo bar\"", "'a b c'", ">",
+    "out.txt", "2>", "err.log", "cp", "-r", "src\\ dir", "dest/", "tail", "-n", "100",
+    "file.log", "\"escaped \\\"quote\\\"\"", "<", "input", ">>", "append.txt", "--verbose",
+};
+
+int main(int argc, char** argv)
+{
+    int lines = 200000;
+    int rounds = 5;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:")) != -1) {
+        if (opt == 'n') {
+            lines = atoi(optarg);
+        } else if (opt == 'r') {
+            rounds = atoi(optarg);
+        } else {
+            fprintf(stderr, "usage: %s [-n lines] [-r rounds]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Lines of 4 to 19 pieces, stored back to back with their lengths
+    size_t capacity = (size_t)lines * 512;
+    char* text = malloc(capacity);
+    size_t* lengths = malloc(lines * sizeof(size_t));
+    if (text == NULL || lengths == NULL) {
+        perror("malloc");
+        return EXIT_FAILURE;
+    }
+    srand(347);
+    size_t used = 0;
+    for (int i = 0; i < lines; i++) {
+        size_t start = used;
+        int words = 4 + rand() % 16;
+        for (int w = 0; w < words; w++) {
+            const char* piece = pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+            size_t len = strlen(piece);
+            memcpy(text + used, piece, len);
+            used += len;
+            text[used++] = ' ';
+        }
+        lengths[i] = used - start;
+    }
+
+    struct arena arena = {0};
+    long long tokens = 0;
+    double best = 0;
+    for (int r = 0; r < rounds; r++) {
+        double start = now();
+        const char* line = text;
+        for (int i = 0; i < lines; i++) {
+            int count;
+            if (argparse(line, lengths[i], &count, &arena) != NULL) {
+                tokens += count;
+            }
+            arenaReset(&arena);
+            line += lengths[i];
+        }
+        double elapsed = now() - start;
+        if (r == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+
+    printf("{\"name\": \"tokenizer.lines\", \"unit\": \"lines/s\", \"value\": %.0f, \"better\": \"higher\", "
+           "\"lines\": %d, \"tokens\": %lld}\n", lines / best, lines, tokens / rounds);
+    printf("{\"name\": \"tokenizer.bytes\", \"unit\": \"MB/s\", \"value\": %.1f, \"better\": \"higher\", "
+           "\"bytes\": %zu}\n", used / best / 1e6, used);
+    arenaFree(&arena);
+    free(lengths);
+    free(text);
+    return EXIT_SUCCESS;
+}
@@ -1,5 +1,8 @@
 // Author: Jonathan Ly
 
+#define _GNU_SOURCE
+
+#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,78 +11,252 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <sys/stat.h> 
+#include <sys/sysmacros.h>
 #include <fcntl.h> 
 #include <dirent.h>
 #include <time.h>
-#include <pwd.h>
-#include <grp.h>
+#include <fnmatch.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include "builtin.h"
-#include <utime.h>
-
-#define MAX_LINES 10
+#include "copy.h"
+#include "wspool.h"
+#include "dirscan.h"
+#include "idcache.h"
+#include "statbatch.h"
+#include "cmdhash.h"
+#include "shell.h"
+#include "jobs.h"
+#include "parallel.h"
+#include "stats.h"
+#include "outbuf.h"
+#include "history.h"
+#include "vars.h"
+#include "cwd.h"
+#include "walk.h"
+#include "grep.h"
+#include <limits.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#define TAIL_DEFAULT_LINES 10
+#define TAIL_BLOCK_SIZE (64 * 1024)
 
 // Declarations
-static void exitProgram(char** args, int argcp);
-static void cd(char** args, int argcp);
-static void pwd(char** args, int argcp);
-static void ls(char** args, int argcp);
-static void cp(char** args, int argcp);
-static void env(char** args, int argcp);
-static void stat_file(char** args, int argcp);
-static void tail(char** args, int argcp);
-static void touch(char** args, int argcp);
+static int exitProgram(char** args, int argcp);
+static int cd(char** args, int argcp);
+static int pwd(char** args, int argcp);
+static int ls(char** args, int argcp);
+static int find(char** args, int argcp);
+static int du(char** args, int argcp);
+static int grep(char** args, int argcp);
+static int cp(char** args, int argcp);
+static int env(char** args, int argcp);
+static int stat_file(char** args, int argcp);
+static int tail(char** args, int argcp);
+static int touch(char** args, int argcp);
+static int hash(char** args, int argcp);
+static int setOptions(char** args, int argcp);
+static int jobs(char** args, int argcp);
+static int waitJobs(char** args, int argcp);
+static int fg(char** args, int argcp);
+static int bg(char** args, int argcp);
+static int parallel(char** args, int argcp);
+static int shellstats(char** args, int argcp);
+static int history(char** args, int argcp);
+static int exportVars(char** args, int argcp);
+static int unset(char** args, int argcp);
+static int help(char** args, int argcp);
+
+// Builtin flags
+#define BUILTIN_SHELL 0x1   // changes the shell itself, so it only has an effect outside a pipeline
+
+// One entry of the builtin dispatch table
+struct builtin {
+    const char* name;
+    int (*handler)(char** args, int argcp);
+    int flags;
+    const char* usage;
+};
+
+/* The dispatch table is indexed by a perfect hash of the command name built
+ * from its first character, last character and length. The slot of every
+ * entry is computed at compile time by BUILTIN, so resolving a command costs
+ * one hash and at most one strcmp, no matter how many builtins exist.
+ * To add a builtin, add a BUILTIN line with its first and last characters;
+ * if it lands on a slot that is already taken the build fails on the
+ * overridden initializer, and the multipliers in BUILTIN_HASH need to be
+ * re-picked.
+ */
+#define BUILTIN_TABLE_SIZE 64
+#define BUILTIN_HASH(first, last, len) \
+    (((unsigned)(unsigned char)(first) + 17u * (unsigned)(unsigned char)(last) + 5u * (unsigned)(len)) & (BUILTIN_TABLE_SIZE - 1))
+#define BUILTIN(name, first, last, handler, flags, usage) \
+    [BUILTIN_HASH(first, last, sizeof(name) - 1)] = { name, handler, flags, usage }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic error "-Woverride-init"
+static const struct builtin builtinTable[BUILTIN_TABLE_SIZE] = {
+    BUILTIN("exit",  'e', 't', exitProgram, BUILTIN_SHELL, "exit [status]"),
+    BUILTIN("pwd",   'p', 'd', pwd,         0,             "pwd"),
+    BUILTIN("cd",    'c', 'd', cd,          BUILTIN_SHELL, "cd [directory]"),
+    BUILTIN("ls",    'l', 's', ls,          0,             "ls [-laRtSr] [path...]"),
+    BUILTIN("find",  'f', 'd', find,        0,             "find [path...] [-name PATTERN] [-type c] [-size [+-]N[bcwkMG]] [-mtime [+-]N] [-maxdepth N] [-print0] [-j N]"),
+    BUILTIN("du",    'd', 'u', du,          0,             "du [-sh] [-j N] [path...]"),
+    BUILTIN("grep",  'g', 'p', grep,        0,             "grep [-Ficnv] [-j N] PATTERN [file...]"),
+    BUILTIN("cp",    'c', 'p', cp,          0,             "cp [-r] [-v] [-j N] <source>... <destination>"),
+    BUILTIN("env",   'e', 'v', env,         BUILTIN_SHELL, "env or env NAME=VALUE"),
+    BUILTIN("stat",  's', 't', stat_file,   0,             "stat [-c FORMAT] [-j N] <file/directory>..."),
+    BUILTIN("tail",  't', 'l', tail,        0,             "tail [-n N] [-f|-F] [file...]"),
+    BUILTIN("touch", 't', 'h', touch,       0,             "touch [-acm] [-d DATE | -r FILE] [-j N] <file>..."),
+    BUILTIN("hash",  'h', 'h', hash,        BUILTIN_SHELL, "hash [-r] [-p path name] [name...]"),
+    BUILTIN("help",  'h', 'p', help,        0,             "help [builtin...]"),
+    BUILTIN("set",   's', 't', setOptions,  BUILTIN_SHELL, "set [-e|+e]"),
+    BUILTIN("jobs",  'j', 's', jobs,        BUILTIN_SHELL, "jobs"),
+    BUILTIN("wait",  'w', 't', waitJobs,    BUILTIN_SHELL, "wait [%job...]"),
+    BUILTIN("fg",    'f', 'g', fg,          BUILTIN_SHELL, "fg [%job]"),
+    BUILTIN("bg",    'b', 'g', bg,          BUILTIN_SHELL, "bg [%job...]"),
+    BUILTIN("parallel", 'p', 'l', parallel, 0,             "parallel [-j N] [-v] command [{}]... [::: argument...]"),
+    BUILTIN("shellstats", 's', 's', shellstats, BUILTIN_SHELL, "shellstats [-j] [-r]"),
+    BUILTIN("history", 'h', 'y', history,   0,             "history [N] or history -s PREFIX [N]"),
+    BUILTIN("export", 'e', 't', exportVars, BUILTIN_SHELL, "export [NAME[=VALUE]...]"),
+    BUILTIN("unset", 'u', 't', unset,       BUILTIN_SHELL, "unset NAME..."),
+};
+#pragma GCC diagnostic pop
+
+#ifndef NDEBUG
+/* checkBuiltinTable
+ * The characters passed to BUILTIN cannot be checked at compile time, so a
+ * debug build verifies once at startup that every entry sits in its slot.
+ */
+__attribute__((constructor)) static void checkBuiltinTable(void)
+{
+    for (unsigned i = 0; i < BUILTIN_TABLE_SIZE; i++) {
+        const char* name = builtinTable[i].name;
+        if (name != NULL) {
+            size_t len = strlen(name);
+            assert(BUILTIN_HASH(name[0], name[len - 1], len) == i);
+        }
+    }
+}
+#endif
+
+/* builtinLookup
+ * Returns the table entry for name, or NULL if name is not a builtin.
+ */
+static const struct builtin* builtinLookup(const char* name)
+{
+    size_t len = strlen(name);
+    if (len == 0) {
+        return NULL;
+    }
+    const struct builtin* entry = &builtinTable[BUILTIN_HASH(name[0], name[len - 1], len)];
+    if (entry->name == NULL || strcmp(entry->name, name) != 0) {
+        return NULL;
+    }
+    return entry;
+}
+
+/* usage
+ * Prints the usage line of the named builtin from the dispatch table
+ * and returns the status builtins exit with on a usage error.
+ */
+static int usage(const char* name)
+{
+    const struct builtin* entry = builtinLookup(name);
+    fprintf(stderr, "Usage: %s\n", entry ? entry->usage : name);
+    return 2;
+}
+
+/* isBuiltIn
+ * Returns 1 if name is one of the built-in commands, 0 otherwise.
+ */
+int isBuiltIn(const char* name)
+{
+    return builtinLookup(name) != NULL;
+}
 
 /* builtIn
- * builtIn checks each built-in command against the given command.
- * If the given command matches one of the built-in commands,
- * that command is executed, and builtIn returns 1.
+ * builtIn looks the given command up in the dispatch table.
+ * If the given command is one of the built-in commands,
+ * that command is executed, its exit status is stored in *status,
+ * and builtIn returns 1.
  * If none of the built-in commands match the provided command,
  * builtIn returns 0.
  */
-int builtIn(char** args, int argcp)
+int builtIn(char** args, int argcp, int* status)
 {
-    if (strcmp(args[0], "exit") == 0) {
-        exitProgram(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "pwd") == 0) {
-        pwd(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "cd") == 0) {
-        cd(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "ls") == 0) {
-        ls(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "cp") == 0) {
-        cp(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "env") == 0) {
-        env(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "stat") == 0) {
-        stat_file(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "tail") == 0) {
-        tail(args, argcp);
-        return 1;
-    } else if (strcmp(args[0], "touch") == 0) {
-        touch(args, argcp);
-        return 1;
+    uint64_t start = statsNow();
+    const struct builtin* entry = builtinLookup(args[0]);
+    if (entry == NULL) {
+        return 0;
+    }
+    *status = entry->handler(args, argcp);
+    outFlush();
+    statsRecord(STATS_BUILTIN, start);
+    return 1;
+}
+
+// Help helper function: orders table entries by name
+static int compareBuiltins(const void* a, const void* b) {
+    const struct builtin* x = *(const struct builtin* const*)a;
+    const struct builtin* y = *(const struct builtin* const*)b;
+    return strcmp(x->name, y->name);
+}
+
+/**
+ * Print the usage of the given builtins, or of all of them.
+ * Builtins that change the shell itself are marked, since they
+ * have no lasting effect when run as part of a pipeline.
+ */
+static int help(char** args, int argcp) {
+    if (argcp > 1) {
+        int status = 0;
+        for (int i = 1; i < argcp; i++) {
+            const struct builtin* entry = builtinLookup(args[i]);
+            if (entry == NULL) {
+                fprintf(stderr, "help: no builtin named '%s'\n", args[i]);
+                status = 1;
+            } else {
+                printf("%s\n", entry->usage);
+            }
+        }
+        return status;
+    }
+
+    const struct builtin* sorted[BUILTIN_TABLE_SIZE];
+    int count = 0;
+    for (int i = 0; i < BUILTIN_TABLE_SIZE; i++) {
+        if (builtinTable[i].name != NULL) {
+            sorted[count++] = &builtinTable[i];
+        }
+    }
+    qsort(sorted, count, sizeof(sorted[0]), compareBuiltins);
+    for (int i = 0; i < count; i++) {
+        if (sorted[i]->flags & BUILTIN_SHELL) {
+            printf("  %-48s(shell)\n", sorted[i]->usage);
+        } else {
+            printf("  %s\n", sorted[i]->usage);
+        }
     }
     return 0;
 }
+
 /**
 * Exit the program with specified exit value. 
 * If an argument is provided it is parsed as the exit value
-* otherwise, the default exit value is 0.
+* otherwise, the default exit value is the status of the last command.
 */ 
-static void exitProgram(char** args, int argcp)
+static int exitProgram(char** args, int argcp)
 {
     // Check if an argument is provided for the exit value
-    int exitValue = 0;
+    int exitValue = shell.lastStatus;
     if (argcp > 1) {
         exitValue = atoi(args[1]);
     }
+    shell.lastStatus = exitValue;
     exit(exitValue);
 }
 
@@ -89,15 +266,17 @@ static void exitProgram(char** args, int argcp)
  * an error message is printed to the standard error.
  */
 
-static void pwd(char** args, int argcp)
+static int pwd(char** args, int argcp)
 {
-    // Get the current working directory
-    char cwd[1024];
-    if (getcwd(cwd, sizeof(cwd)) != NULL) {
-        printf("%s\n", cwd);
-    } else {
-        perror("getcwd() error");
+    // The path is only looked up again after a cd
+    const char* cwd = cwdPath();
+    if (cwd != NULL) {
+        outStr(cwd);
+        outChar('\n');
+        return 0;
     }
+    perror("getcwd() error");
+    return 1;
 }
 
 /**
@@ -106,212 +285,928 @@ static void pwd(char** args, int argcp)
  * If an error occurs during the directory change, an error message is printed.
  */
 
-static void cd(char** args, int argcp)
+static int cd(char** args, int argcp)
 {
     // Change directory
     if (argcp > 1) {
-        if (chdir(args[1]) != 0) {
+        if (cwdChange(args[1]) != 0) {
             perror("cd");
+            return 1;
         }
     } else {
         // If no directory provided, change to home directory
-        char* home = getenv("HOME");
+        const char* home = varsGet("HOME", 4);
         if (home != NULL) {
-            if (chdir(home) != 0) {
+            if (cwdChange(home) != 0) {
                 perror("cd");
+                return 1;
             }
         } else {
             printf("cd: No HOME environment variable\n");
+            return 1;
         }
     }
+    return 0;
 }
 
 
-// LS helper function
-static void printPermissions(mode_t mode) {
-    char perm[10] = "---------";
-
-    // User permissions
-    if (mode & S_IRUSR) perm[0] = 'r';
-    if (mode & S_IWUSR) perm[1] = 'w';
-    if (mode & S_IXUSR) perm[2] = 'x';
+// LS entry: one directory entry and the metadata the listing needs
+struct lsEntry {
+    size_t nameOffset;      // offset into the listing's name pool
+    const char* name;       // resolved once the pool stops growing
+    unsigned char type;     // DT_* type
+    mode_t mode;
+    nlink_t nlink;
+    uid_t uid;
+    gid_t gid;
+    off_t size;
+    struct statx_timestamp mtime;
+};
+
+// LS options
+struct lsOptions {
+    int longFormat;
+    int all;
+    int recursive;
+    int reverse;
+    char sortKey;           // 'n'ame, 't'ime or 'S'ize
+};
+
+// LS helper function: the statx fields needed for the requested output
+static unsigned int lsStatxMask(const struct lsOptions* opts) {
+    unsigned int mask = 0;
+    if (opts->longFormat) {
+        mask |= STATX_TYPE | STATX_MODE | STATX_NLINK | STATX_UID | STATX_GID | STATX_SIZE | STATX_MTIME;
+    }
+    if (opts->sortKey == 't') {
+        mask |= STATX_MTIME;
+    }
+    if (opts->sortKey == 'S') {
+        mask |= STATX_SIZE;
+    }
+    return mask;
+}
 
-    // Group permissions
-    if (mode & S_IRGRP) perm[3] = 'r';
-    if (mode & S_IWGRP) perm[4] = 'w';
-    if (mode & S_IXGRP) perm[5] = 'x';
+// LS helper function
+static void lsFill(struct lsEntry* entry, const struct statx* stx) {
+    entry->mode = stx->stx_mode;
+    entry->nlink = stx->stx_nlink;
+    entry->uid = stx->stx_uid;
+    entry->gid = stx->stx_gid;
+    entry->size = stx->stx_size;
+    entry->mtime = stx->stx_mtime;
+    if (stx->stx_mask & STATX_TYPE) {
+        entry->type = S_ISDIR(stx->stx_mode) ? DT_DIR : S_ISLNK(stx->stx_mode) ? DT_LNK :
+                      S_ISREG(stx->stx_mode) ? DT_REG : entry->type;
+    }
+}
 
-    // Others permissions
-    if (mode & S_IROTH) perm[6] = 'r';
-    if (mode & S_IWOTH) perm[7] = 'w';
-    if (mode & S_IXOTH) perm[8] = 'x';
+static char lsSortKey;
+static int lsReverse;
+
+// LS helper function: qsort comparator for the selected sort key
+static int lsCompare(const void* a, const void* b) {
+    const struct lsEntry* x = a;
+    const struct lsEntry* y = b;
+    int result = 0;
+    if (lsSortKey == 't') {
+        if (x->mtime.tv_sec != y->mtime.tv_sec) {
+            result = (x->mtime.tv_sec < y->mtime.tv_sec) ? 1 : -1;
+        } else if (x->mtime.tv_nsec != y->mtime.tv_nsec) {
+            result = (x->mtime.tv_nsec < y->mtime.tv_nsec) ? 1 : -1;
+        }
+    } else if (lsSortKey == 'S') {
+        if (x->size != y->size) {
+            result = (x->size < y->size) ? 1 : -1;
+        }
+    }
+    if (result == 0) {
+        result = strcmp(x->name, y->name);
+    }
+    return lsReverse ? -result : result;
+}
 
-    printf("%c%s", S_ISDIR(mode) ? 'd' : '-', perm);
+// LS helper function: one line of the long format, built in the output buffer
+static void printFileInfo(const struct lsEntry* entry, int dirFD) {
+    outMode(entry->mode);
+    outChar(' ');
+    outUnsigned(entry->nlink, 0);
+
+    const char* user = idcacheUser(entry->uid);
+    outChar(' ');
+    outStr(user ? user : "???");
+    const char* group = idcacheGroup(entry->gid);
+    outChar(' ');
+    outStr(group ? group : "???");
+
+    outChar(' ');
+    outUnsigned(entry->size, 5);
+    outChar(' ');
+    outTime(entry->mtime.tv_sec, OUT_TIME_SHORT);
+    outChar(' ');
+    outStr(entry->name);
+
+    // Show where a symbolic link points
+    if (S_ISLNK(entry->mode)) {
+        char target[PATH_MAX];
+        ssize_t len = readlinkat(dirFD, entry->name, target, sizeof(target));
+        if (len >= 0) {
+            outWrite(" -> ", 4);
+            outWrite(target, len);
+        }
+    }
+    outChar('\n');
 }
 
-// LS helper function
-static void printFileInfo(struct dirent* entry, char* path) {
-    struct stat statbuf;
-    char fullPath[1024];
-    snprintf(fullPath, sizeof(fullPath), "%s/%s", path, entry->d_name);
+// LS helper function: joins a directory path and an entry name for headers
+static char* lsJoin(const char* dir, const char* name) {
+    size_t dirLen = strlen(dir);
+    char* path = malloc(dirLen + strlen(name) + 2);
+    if (path != NULL) {
+        sprintf(path, "%s%s%s", dir, (dirLen > 0 && dir[dirLen - 1] == '/') ? "" : "/", name);
+    }
+    return path;
+}
 
-    if (stat(fullPath, &statbuf) == -1) {
-        perror("stat");
+/* LS helper function
+ * Lists one open directory: entries are read in getdents64 batches,
+ * names are packed into a single pool, and statx is called relative to
+ * the directory descriptor only when the output or sort order needs it.
+ */
+static void lsDirectory(int dirFD, const char* path, const struct lsOptions* opts) {
+    struct dirScan scan;
+    if (dirscanOpen(&scan, dirFD) == -1) {
+        perror("ls");
         return;
     }
 
-    // Print file permissions
-    printPermissions(statbuf.st_mode);
+    struct lsEntry* entries = NULL;
+    size_t count = 0, capacity = 0;
+    char* pool = NULL;
+    size_t poolUsed = 0, poolSize = 0;
+    const char* name;
+    unsigned char type;
+    int rc;
+
+    while ((rc = dirscanNext(&scan, &name, &type)) == 1) {
+        // Skip hidden files
+        if (name[0] == '.' && !opts->all) continue;
+
+        size_t len = strlen(name) + 1;
+        if (count == capacity || poolUsed + len > poolSize) {
+            size_t newCapacity = (count == capacity) ? (capacity ? capacity * 2 : 256) : capacity;
+            size_t newPoolSize = (poolUsed + len > poolSize) ? (poolSize ? poolSize * 2 : 16384) + len : poolSize;
+            struct lsEntry* newEntries = realloc(entries, newCapacity * sizeof(struct lsEntry));
+            if (newEntries != NULL) entries = newEntries;
+            char* newPool = realloc(pool, newPoolSize);
+            if (newPool != NULL) pool = newPool;
+            if (newEntries == NULL || newPool == NULL) {
+                perror("ls");
+                break;
+            }
+            capacity = newCapacity;
+            poolSize = newPoolSize;
+        }
 
-    // Print number of links
-    printf(" %lu", (unsigned long)statbuf.st_nlink);
+        struct lsEntry* entry = &entries[count++];
+        memset(entry, 0, sizeof(*entry));
+        entry->nameOffset = poolUsed;
+        entry->type = type;
+        memcpy(pool + poolUsed, name, len);
+        poolUsed += len;
+    }
+    if (rc == -1) {
+        perror(path);
+    }
+    dirscanClose(&scan);
+
+    // Entries that cannot be looked up are reported and dropped, so they are neither sorted nor printed
+    unsigned int mask = lsStatxMask(opts);
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        struct lsEntry* entry = &entries[kept];
+        if (kept != i) {
+            *entry = entries[i];
+        }
+        entry->name = pool + entry->nameOffset;
 
-    // Print owner name
-    struct passwd *pwd = getpwuid(statbuf.st_uid);
-    printf(" %s", pwd ? pwd->pw_name : "???");
+        unsigned int need = mask;
+        if (opts->recursive && entry->type == DT_UNKNOWN) {
+            need |= STATX_TYPE;
+        }
+        if (need != 0) {
+            struct statx stx;
+            if (statx(dirFD, entry->name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT, need, &stx) == -1) {
+                fprintf(stderr, "ls: %s: %s\n", entry->name, strerror(errno));
+                continue;
+            }
+            lsFill(entry, &stx);
+        }
+        kept++;
+    }
+    count = kept;
 
-    // Print group name
-    struct group *grp = getgrgid(statbuf.st_gid);
-    printf(" %s", grp ? grp->gr_name : "???");
+    lsSortKey = opts->sortKey;
+    lsReverse = opts->reverse;
+    qsort(entries, count, sizeof(struct lsEntry), lsCompare);
 
-    // Print file size
-    printf(" %5ld", (long)statbuf.st_size);
+    for (size_t i = 0; i < count; i++) {
+        if (opts->longFormat) {
+            printFileInfo(&entries[i], dirFD);
+        } else {
+            outStr(entries[i].name);
+            outChar('\n');
+        }
+    }
 
-    // Print modification time
-    char timeBuf[20];
-    struct tm *tm = localtime(&statbuf.st_mtime);
-    strftime(timeBuf, sizeof(timeBuf), "%b %d %H:%M", tm);
-    printf(" %s", timeBuf);
+    if (opts->recursive) {
+        for (size_t i = 0; i < count; i++) {
+            const char* sub = entries[i].name;
+            if (entries[i].type != DT_DIR || strcmp(sub, ".") == 0 || strcmp(sub, "..") == 0) {
+                continue;
+            }
+            char* subPath = lsJoin(path, sub);
+            int subFD = openat(dirFD, sub, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (subFD == -1 || subPath == NULL) {
+                fprintf(stderr, "ls: cannot open directory '%s': %s\n", subPath ? subPath : sub, strerror(errno));
+            } else {
+                outChar('\n');
+                outStr(subPath);
+                outWrite(":\n", 2);
+                lsDirectory(subFD, subPath, opts);
+            }
+            if (subFD != -1) {
+                close(subFD);
+            }
+            free(subPath);
+        }
+    }
 
-    // Print file name
-    printf(" %s\n", entry->d_name);
+    free(entries);
+    free(pool);
 }
 
 /**
- * List the contents of the current directory.
- * If the '-l' argument is provided, 
- * print detailed information about each entry.
+ * List the contents of the given directories (default: the current one).
+ * Options:
+ *   -l  print detailed information about each entry
+ *   -a  include entries whose names start with '.'
+ *   -R  list subdirectories recursively
+ *   -t  sort by modification time, newest first
+ *   -S  sort by size, largest first
+ *   -r  reverse the sort order
+ * Entries are sorted by name unless -t or -S is given.
  * If an error occurs during directory opening or reading,
  *  an error message is printed.
  */
 
-static void ls(char** args, int argcp) {
-    DIR* dir;
-    struct dirent* entry;
-    int longFormat = 0;
+static int ls(char** args, int argcp) {
+    struct lsOptions opts = { 0, 0, 0, 0, 'n' };
+    char** paths = malloc((argcp + 1) * sizeof(char*));
+    int pathCount = 0;
+    if (paths == NULL) {
+        perror("ls");
+        return 1;
+    }
 
-    // Check for '-l' argument
     for (int i = 1; i < argcp; i++) {
-        if (strcmp(args[i], "-l") == 0) {
-            longFormat = 1;
-            break;
+        if (args[i][0] != '-' || args[i][1] == '\0') {
+            paths[pathCount++] = args[i];
+            continue;
+        }
+        for (const char* opt = &args[i][1]; *opt != '\0'; opt++) {
+            switch (*opt) {
+            case 'l': opts.longFormat = 1; break;
+            case 'a': opts.all = 1; break;
+            case 'R': opts.recursive = 1; break;
+            case 'r': opts.reverse = 1; break;
+            case 't': opts.sortKey = 't'; break;
+            case 'S': opts.sortKey = 'S'; break;
+            default:
+                fprintf(stderr, "ls: invalid option -- '%c'\n", *opt);
+                free(paths);
+                return usage("ls");
+            }
+        }
+    }
+    if (pathCount == 0) {
+        paths[pathCount++] = ".";
+    }
+
+    // Operands that are not directories are listed first, as one group
+    int printed = 0;
+    int status = 0;
+    for (int i = 0; i < pathCount; i++) {
+        struct statx stx;
+        if (statx(cwdFD(), paths[i], AT_NO_AUTOMOUNT, STATX_TYPE | lsStatxMask(&opts), &stx) == -1) {
+            fprintf(stderr, "ls: cannot access '%s': %s\n", paths[i], strerror(errno));
+            paths[i] = NULL;
+            status = 2;
+            continue;
+        }
+        if (S_ISDIR(stx.stx_mode)) {
+            continue;
         }
+        struct lsEntry entry = { 0 };
+        entry.name = paths[i];
+        lsFill(&entry, &stx);
+        if (opts.longFormat) {
+            printFileInfo(&entry, cwdFD());
+        } else {
+            outStr(entry.name);
+            outChar('\n');
+        }
+        paths[i] = NULL;
+        printed = 1;
     }
 
-    // Open current directory
-    char* path = ".";
-    dir = opendir(path);
-    if (!dir) {
-        perror("opendir");
-        return;
+    for (int i = 0; i < pathCount; i++) {
+        if (paths[i] == NULL) {
+            continue;
+        }
+        int dirFD = openat(cwdFD(), paths[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFD == -1) {
+            fprintf(stderr, "ls: cannot open directory '%s': %s\n", paths[i], strerror(errno));
+            status = 2;
+            continue;
+        }
+        if (pathCount > 1 || opts.recursive) {
+            if (printed) {
+                outChar('\n');
+            }
+            outStr(paths[i]);
+            outWrite(":\n", 2);
+        }
+        lsDirectory(dirFD, paths[i], &opts);
+        close(dirFD);
+        printed = 1;
     }
 
-    // Read and print entries
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip hidden files
-        if (entry->d_name[0] == '.') continue;
+    free(paths);
+    return status;
+}
+
+// Tree walk output: each worker gathers lines and hands them to outWrite a batch at a time
+#define TREE_OUTPUT_BATCH (32 * 1024)
+
+struct treeBatch {
+    char* data;
+    size_t len;
+};
+
+struct treeOutput {
+    pthread_mutex_t lock;
+    struct treeBatch* batches;  // one per worker
+    int workers;
+};
+
+// Tree walk helper function: returns -1 if the batches could not be allocated
+static int treeOutInit(struct treeOutput* out, int workers) {
+    pthread_mutex_init(&out->lock, NULL);
+    out->workers = workers;
+    out->batches = calloc(workers, sizeof(struct treeBatch));
+    for (int i = 0; out->batches != NULL && i < workers; i++) {
+        if ((out->batches[i].data = malloc(TREE_OUTPUT_BATCH)) == NULL) {
+            return -1;
+        }
+    }
+    return (out->batches == NULL) ? -1 : 0;
+}
+
+// Tree walk helper function: writes out what a worker has gathered
+static void treeOutFlush(struct treeOutput* out, int worker) {
+    struct treeBatch* batch = &out->batches[worker];
+    if (batch->len > 0) {
+        pthread_mutex_lock(&out->lock);
+        outWrite(batch->data, batch->len);
+        pthread_mutex_unlock(&out->lock);
+        batch->len = 0;
+    }
+}
+
+// Tree walk helper function: adds one line, prefix then path then end, to a worker's batch
+static void treeOutRecord(struct treeOutput* out, int worker, const char* prefix, size_t prefixLen,
+                          const char* path, size_t pathLen, char end) {
+    struct treeBatch* batch = &out->batches[worker];
+    size_t len = prefixLen + pathLen + 1;
+    if (batch->len + len > TREE_OUTPUT_BATCH) {
+        treeOutFlush(out, worker);
+        if (len > TREE_OUTPUT_BATCH) {
+            // A line never straddles two batches, or another worker's could land in between
+            pthread_mutex_lock(&out->lock);
+            outWrite(prefix, prefixLen);
+            outWrite(path, pathLen);
+            outWrite(&end, 1);
+            pthread_mutex_unlock(&out->lock);
+            return;
+        }
+    }
+    char* p = batch->data + batch->len;
+    memcpy(p, prefix, prefixLen);
+    memcpy(p + prefixLen, path, pathLen);
+    p[prefixLen + pathLen] = end;
+    batch->len += len;
+}
+
+// Tree walk helper function: flushes every batch once the walk is over and frees them
+static void treeOutFinish(struct treeOutput* out) {
+    for (int i = 0; out->batches != NULL && i < out->workers; i++) {
+        if (out->batches[i].data != NULL) {
+            treeOutFlush(out, i);
+        }
+        free(out->batches[i].data);
+    }
+    free(out->batches);
+    pthread_mutex_destroy(&out->lock);
+}
+
+// Find helper function: the tests an entry has to pass to be printed
+struct findOptions {
+    const char* name;               // -name pattern, or NULL
+    int type;                       // -type as a DT_* type, or -1
+    int sizeCmp;                    // -1, 0 or 1 for -size -N, N and +N; 2 when not given
+    unsigned long long size;
+    unsigned long long sizeUnit;    // bytes per unit of size
+    int mtimeCmp;                   // likewise for -mtime
+    unsigned long long mtime;       // in days
+    time_t now;
+    char terminator;                // '\n', or '\0' for -print0
+    struct treeOutput out;
+};
+
+/* Find helper function
+ * Reads a [+-]N argument into *cmp and *value, returning what follows the digits,
+ * or NULL if there are none.
+ */
+static const char* findNumber(const char* s, int* cmp, unsigned long long* value) {
+    *cmp = (*s == '+') ? 1 : (*s == '-') ? -1 : 0;
+    s += (*cmp != 0);
+    if (*s < '0' || *s > '9') {
+        return NULL;
+    }
+    char* end;
+    *value = strtoull(s, &end, 10);
+    return end;
+}
+
+// Find helper function: tells whether value passes a [+-]N test
+static int findCompare(unsigned long long value, int cmp, unsigned long long n) {
+    return (cmp > 0) ? value > n : (cmp < 0) ? value < n : value == n;
+}
+
+// Find helper function: tests one entry and prints it if it passes
+static unsigned long long findVisit(const struct walkEntry* entry, int worker, void* ctx) {
+    struct findOptions* opts = ctx;
+    if (opts->type != -1 && entry->type != opts->type) {
+        return 0;
+    }
+    if (opts->name != NULL && fnmatch(opts->name, entry->name, 0) != 0) {
+        return 0;
+    }
+    if (opts->sizeCmp != 2) {
+        unsigned long long units = (entry->stx->stx_size + opts->sizeUnit - 1) / opts->sizeUnit;
+        if (!findCompare(units, opts->sizeCmp, opts->size)) {
+            return 0;
+        }
+    }
+    if (opts->mtimeCmp != 2) {
+        long long age = (long long)opts->now - entry->stx->stx_mtime.tv_sec;
+        if (age < 0 || !findCompare((unsigned long long)age / 86400, opts->mtimeCmp, opts->mtime)) {
+            return 0;
+        }
+    }
+    treeOutRecord(&opts->out, worker, "", 0, entry->path, entry->pathLen, opts->terminator);
+    return 0;
+}
+
+/**
+ * Search directory trees for entries that pass every test given and print
+ * their paths. Directories are read by a pool of threads, so paths from
+ * different directories come out in no fixed order.
+ */
+
+static int find(char** args, int argcp) {
+    struct findOptions opts = { .type = -1, .sizeCmp = 2, .mtimeCmp = 2, .terminator = '\n' };
+    int maxDepth = -1, threads = 0;
+    int i = 1;
+    while (i < argcp && (args[i][0] != '-' || args[i][1] == '\0')) {
+        i++;
+    }
+    char** roots = args + 1;
+    int rootCount = i - 1;
+
+    for (; i < argcp; i++) {
+        const char* test = args[i];
+        if (strcmp(test, "-print") == 0 || strcmp(test, "-print0") == 0) {
+            opts.terminator = (test[6] == '0') ? '\0' : '\n';
+            continue;
+        }
+        if (strcmp(test, "-name") != 0 && strcmp(test, "-type") != 0 && strcmp(test, "-size") != 0 &&
+            strcmp(test, "-mtime") != 0 && strcmp(test, "-maxdepth") != 0 && strcmp(test, "-j") != 0) {
+            fprintf(stderr, "find: unknown predicate '%s'\n", test);
+            return usage("find");
+        }
+        if (i + 1 == argcp) {
+            fprintf(stderr, "find: missing argument to '%s'\n", test);
+            return usage("find");
+        }
+        const char* value = args[++i];
+        const char* rest = "";
+        if (strcmp(test, "-name") == 0) {
+            opts.name = value;
+        } else if (strcmp(test, "-type") == 0) {
+            const char* types = "fdlbcps";
+            static const int dtTypes[] = { DT_REG, DT_DIR, DT_LNK, DT_BLK, DT_CHR, DT_FIFO, DT_SOCK };
+            const char* found = (value[0] != '\0' && value[1] == '\0') ? strchr(types, value[0]) : NULL;
+            rest = (found == NULL) ? NULL : "";
+            opts.type = (found == NULL) ? -1 : dtTypes[found - types];
+        } else if (strcmp(test, "-size") == 0) {
+            rest = findNumber(value, &opts.sizeCmp, &opts.size);
+            opts.sizeUnit = 512;
+            if (rest != NULL && *rest != '\0') {
+                const char* units = "bcwkMG";
+                static const unsigned long long sizes[] = { 512, 1, 2, 1024, 1024 * 1024, 1024 * 1024 * 1024 };
+                const char* found = (rest[1] == '\0') ? strchr(units, *rest) : NULL;
+                opts.sizeUnit = (found == NULL) ? 0 : sizes[found - units];
+                rest = (found == NULL) ? NULL : "";
+            }
+        } else if (strcmp(test, "-mtime") == 0) {
+            rest = findNumber(value, &opts.mtimeCmp, &opts.mtime);
+        } else {
+            int cmp;
+            unsigned long long n;
+            rest = findNumber(value, &cmp, &n);
+            if (rest != NULL && (cmp != 0 || n > INT_MAX || (strcmp(test, "-j") == 0 && n == 0))) {
+                rest = NULL;
+            }
+            if (test[1] == 'j') {
+                threads = (int)n;
+            } else {
+                maxDepth = (int)n;
+            }
+        }
+        if (rest == NULL || *rest != '\0') {
+            fprintf(stderr, "find: invalid argument '%s' to '%s'\n", value, test);
+            return usage("find");
+        }
+    }
+
+    static char* here[] = { "." };
+    if (rootCount == 0) {
+        roots = here;
+        rootCount = 1;
+    }
+    if (threads == 0) {
+        threads = 4 * wspoolDefaultThreads();
+    }
+    opts.now = time(NULL);
+    unsigned int mask = (opts.sizeCmp != 2 ? STATX_SIZE : 0) | (opts.mtimeCmp != 2 ? STATX_MTIME : 0);
+    struct walkOptions walk = { "find", mask, maxDepth, 0, threads, findVisit, NULL, &opts };
+    if (treeOutInit(&opts.out, threads) == -1) {
+        perror("find");
+        treeOutFinish(&opts.out);
+        return 1;
+    }
+    int status = walkTree(cwdFD(), roots, rootCount, &walk);
+    treeOutFinish(&opts.out);
+    return (status == 0) ? 0 : 1;
+}
+
+// DU helper function: what to print
+struct duOptions {
+    int summarize;      // -s: only the total of each operand
+    int human;          // -h: sizes with K, M, G... instead of kilobytes
+    struct treeOutput out;
+};
 
-        if (longFormat) {
-            printFileInfo(entry, path);
+/* DU helper function
+ * Writes bytes as du -h does: one decimal below ten, rounded up, and a unit letter.
+ * returns the length written
+ */
+static size_t duHuman(char* out, unsigned long long bytes) {
+    static const char units[] = "KMGTPE";
+    size_t len = 0;
+    if (bytes < 1024) {
+        return outFormatUnsigned(out, bytes);
+    }
+    int unit = 0;
+    double divisor = 1024.0;
+    while (unit + 1 < (int)sizeof(units) - 1 && bytes >= divisor * 1024.0) {
+        divisor *= 1024.0;
+        unit++;
+    }
+    double value = bytes / divisor;
+    unsigned long long tenths = (unsigned long long)(value * 10.0);
+    tenths += (tenths < value * 10.0);
+    if (tenths < 100) {
+        len = outFormatUnsigned(out, tenths / 10);
+        out[len++] = '.';
+        out[len++] = '0' + tenths % 10;
+    } else {
+        unsigned long long whole = (unsigned long long)value;
+        whole += (whole < value);
+        if (whole >= 1024 && unit + 1 < (int)sizeof(units) - 1) {
+            unit++;
+            len = outFormatUnsigned(out, 1);
+            out[len++] = '.';
+            out[len++] = '0';
         } else {
-            printf("%s\n", entry->d_name);
+            len = outFormatUnsigned(out, whole);
         }
     }
+    out[len++] = units[unit];
+    return len;
+}
+
+// DU helper function: prints one size in 512-byte blocks and its path
+static void duPrint(struct duOptions* opts, int worker, unsigned long long blocks, const char* path) {
+    char size[32];
+    size_t len = opts->human ? duHuman(size, blocks * 512) : outFormatUnsigned(size, (blocks + 1) / 2);
+    size[len++] = '\t';
+    treeOutRecord(&opts->out, worker, size, len, path, strlen(path), '\n');
+}
+
+// DU helper function: every entry adds its blocks; an operand that is not a directory is printed here
+static unsigned long long duVisit(const struct walkEntry* entry, int worker, void* ctx) {
+    if (entry->depth == 0 && entry->type != DT_DIR) {
+        duPrint(ctx, worker, entry->stx->stx_blocks, entry->path);
+    }
+    return entry->stx->stx_blocks;
+}
 
-    // Close directory
-    closedir(dir);
+// DU helper function: a directory is printed once everything below it is counted
+static void duLeave(const char* path, unsigned long long total, int depth, int worker, void* ctx) {
+    struct duOptions* opts = ctx;
+    if (!opts->summarize || depth == 0) {
+        duPrint(opts, worker, total, path);
+    }
 }
+
 /**
- * Copy a file from a source path to a destination path.
- * 
+ * Estimate the disk space used by directory trees, in kilobytes, counting
+ * each file with several hard links once. Every directory is printed after
+ * its contents, or with -s only the operands.
  */
-static void cp(char** args, int argcp) {
-    if (argcp != 3) {
-        fprintf(stderr, "Usage: cp <source> <destination>\n");
-        return;
+
+static int du(char** args, int argcp) {
+    struct duOptions opts = { 0 };
+    int threads = 0;
+    int i = 1;
+    for (; i < argcp && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char* flag = args[i] + 1; *flag != '\0'; flag++) {
+            if (*flag == 's') {
+                opts.summarize = 1;
+            } else if (*flag == 'h') {
+                opts.human = 1;
+            } else if (*flag == 'j') {
+                const char* value = (flag[1] != '\0') ? flag + 1 : (i + 1 < argcp ? args[++i] : NULL);
+                if (value == NULL || (threads = atoi(value)) < 1) {
+                    fprintf(stderr, "du: -j needs a positive thread count\n");
+                    return usage("du");
+                }
+                break;
+            } else {
+                fprintf(stderr, "du: invalid option -- '%c'\n", *flag);
+                return usage("du");
+            }
+        }
+    }
+
+    static char* here[] = { "." };
+    char** roots = (i < argcp) ? args + i : here;
+    int rootCount = (i < argcp) ? argcp - i : 1;
+    if (threads == 0) {
+        threads = 4 * wspoolDefaultThreads();
+    }
+    struct walkOptions walk = { "du", STATX_BLOCKS | STATX_NLINK | STATX_INO, -1, 1, threads,
+                                duVisit, duLeave, &opts };
+    if (treeOutInit(&opts.out, threads) == -1) {
+        perror("du");
+        treeOutFinish(&opts.out);
+        return 1;
+    }
+    int status = walkTree(cwdFD(), roots, rootCount, &walk);
+    treeOutFinish(&opts.out);
+    return (status == 0) ? 0 : 1;
+}
+
+/**
+ * Print the lines of files, or of standard input, that contain a pattern.
+ * '-F' searches for the pattern as a plain string, '-i' ignores the case
+ * of letters, '-c' prints only how many lines were selected, '-n' numbers
+ * the lines and '-v' selects the lines that do not match. Several files are
+ * searched at once on '-j N' threads and printed in the order given.
+ */
+static int grep(char** args, int argcp) {
+    struct grepOptions opts = { 0 };
+    int i = 1;
+    for (; i < argcp && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char* flag = args[i] + 1; *flag != '\0'; flag++) {
+            if (*flag == 'F') {
+                opts.fixed = 1;
+            } else if (*flag == 'i') {
+                opts.ignoreCase = 1;
+            } else if (*flag == 'c') {
+                opts.count = 1;
+            } else if (*flag == 'n') {
+                opts.lineNumbers = 1;
+            } else if (*flag == 'v') {
+                opts.invert = 1;
+            } else if (*flag == 'j') {
+                const char* value = (flag[1] != '\0') ? flag + 1 : (i + 1 < argcp ? args[++i] : NULL);
+                if (value == NULL || (opts.threads = atoi(value)) < 1) {
+                    fprintf(stderr, "grep: -j needs a positive thread count\n");
+                    return usage("grep");
+                }
+                break;
+            } else {
+                fprintf(stderr, "grep: invalid option -- '%c'\n", *flag);
+                return usage("grep");
+            }
+        }
+    }
+    if (i >= argcp) {
+        return usage("grep");
+    }
+
+    opts.pattern = args[i++];
+    if (opts.threads == 0) {
+        opts.threads = wspoolDefaultThreads();
     }
+    return grepFiles(cwdFD(), args + i, argcp - i, &opts);
+}
 
-    const char* srcPath = args[1];
-    const char* destPath = args[2];
+// CP helper function
+static double elapsedSeconds(const struct timespec* start, const struct timespec* end) {
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
 
+// CP helper function: copies a single regular file, the common case
+static int copySingleFile(const char* srcPath, const char* destPath, int verbose) {
     // Check if source and destination are the same
     struct stat srcStat, destStat;
-    if (stat(srcPath, &srcStat) == 0) {
-        if (stat(destPath, &destStat) == 0) {
+    if (fstatat(cwdFD(), srcPath, &srcStat, 0) == 0) {
+        if (fstatat(cwdFD(), destPath, &destStat, 0) == 0) {
             if (srcStat.st_ino == destStat.st_ino && srcStat.st_dev == destStat.st_dev) {
                 fprintf(stderr, "cp: '%s' and '%s' are the same file\n", srcPath, destPath);
-                return;
+                return 1;
             }
         }
     } else {
         perror("Error getting source file info");
-        return;
+        return 1;
     }
 
     // Open source file
-    int srcFD = open(srcPath, O_RDONLY);
+    int srcFD = openat(cwdFD(), srcPath, O_RDONLY | O_CLOEXEC);
     if (srcFD == -1) {
         perror("Error opening source file");
-        return;
+        return 1;
     }
 
     // Open destination file
-    int destFD = open(destPath, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
+    int destFD = openat(cwdFD(), destPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
     if (destFD == -1) {
         perror("Error opening destination file");
         close(srcFD); // Close the source file descriptor before returning
-        return;
+        return 1;
     }
 
     // Copy process
-    char buffer[4096];
-    ssize_t readBytes, writeBytes;
-    
-    while ((readBytes = read(srcFD, buffer, sizeof(buffer))) > 0) {
-        writeBytes = write(destFD, buffer, readBytes);
-        if (writeBytes != readBytes) {
-            perror("Error writing to destination file");
-            break;
-        }
+    struct copyStats stats = {0};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int status = 0;
+    if (copyFileData(srcFD, destFD, S_ISREG(srcStat.st_mode) ? srcStat.st_size : -1, &stats) == -1) {
+        perror("cp");
+        status = 1;
     }
 
-    if (readBytes == -1) {
-        perror("Error reading source file");
-    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
 
     // Close file descriptors
     close(srcFD);
     close(destFD);
+
+    if (verbose) {
+        double seconds = elapsedSeconds(&start, &end);
+        const char* method = stats.reflinked ? "reflink" : stats.kernel ? "in-kernel" : "buffered";
+        printf("'%s' -> '%s'\n", srcPath, destPath);
+        printf("cp: %llu bytes in %.3f s (%.1f MiB/s, %s)\n", stats.bytes, seconds,
+               seconds > 0 ? stats.bytes / seconds / (1024.0 * 1024.0) : 0.0, method);
+    }
+    return status;
 }
 
+/**
+ * Copy files and directories.
+ * 'cp SOURCE DEST' copies one file, 'cp SOURCE... DIRECTORY' copies
+ * each source into an existing directory.
+ * '-r' (or '-R') copies directories recursively, on a pool of
+ * worker threads whose size is set with '-j N' (default: one per CPU).
+ * '-v' prints what was copied and the throughput achieved.
+ */
+static int cp(char** args, int argcp) {
+    int verbose = 0;
+    int recursive = 0;
+    int threads = 0;
+    char** operands = malloc(argcp * sizeof(char*));
+    int count = 0;
+    if (operands == NULL) {
+        perror("cp");
+        return 1;
+    }
+
+    for (int i = 1; i < argcp; i++) {
+        if (args[i][0] != '-' || args[i][1] == '\0') {
+            operands[count++] = args[i];
+            continue;
+        }
+        for (const char* opt = &args[i][1]; *opt != '\0'; opt++) {
+            if (*opt == 'v') {
+                verbose = 1;
+            } else if (*opt == 'r' || *opt == 'R') {
+                recursive = 1;
+            } else if (*opt == 'j') {
+                const char* value = (opt[1] != '\0') ? opt + 1 : (i + 1 < argcp ? args[++i] : NULL);
+                threads = value ? atoi(value) : 0;
+                if (threads < 1) {
+                    fprintf(stderr, "cp: -j needs a positive thread count\n");
+                    free(operands);
+                    return usage("cp");
+                }
+                break;
+            } else {
+                fprintf(stderr, "cp: invalid option -- '%c'\n", *opt);
+                free(operands);
+                return usage("cp");
+            }
+        }
+    }
+    if (count < 2) {
+        free(operands);
+        return usage("cp");
+    }
+
+    const char* dest = operands[count - 1];
+    struct stat destStat, srcStat;
+    int destIsDir = (fstatat(cwdFD(), dest, &destStat, 0) == 0 && S_ISDIR(destStat.st_mode));
+    if (count > 2 && !destIsDir) {
+        fprintf(stderr, "cp: target '%s' is not a directory\n", dest);
+        free(operands);
+        return 1;
+    }
+
+    // A single file to a file name needs no thread pool
+    if (count == 2 && !destIsDir && fstatat(cwdFD(), operands[0], &srcStat, 0) == 0 && !S_ISDIR(srcStat.st_mode)) {
+        int status = copySingleFile(operands[0], dest, verbose);
+        free(operands);
+        return status;
+    }
+
+    if (threads == 0) {
+        threads = wspoolDefaultThreads();
+    }
+    struct copyStats stats = {0};
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = (copyTree(cwdFD(), operands, count - 1, dest, destIsDir, recursive, threads, &stats) == 0) ? 0 : 1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (verbose) {
+        double seconds = elapsedSeconds(&start, &end);
+        printf("cp: %llu files, %llu bytes in %.3f s (%.1f MiB/s, %d threads)\n", stats.files, stats.bytes,
+               seconds, seconds > 0 ? stats.bytes / seconds / (1024.0 * 1024.0) : 0.0, threads);
+    }
+    free(operands);
+    return status;
+}
 
 
-extern char **environ; // External variable pointing to the environment
 
 /**
  * Display environment variables 
  * or set a new environment variable.
- * If no arguments provided, print all environment variables.
+ * If no arguments provided, print all exported variables.
  * If one argument provided in the format NAME=VALUE, attempt 
- * to set the environment variable.
+ * to set and export the variable.
  */
 
-static void env(char** args, int argcp) {
+static int env(char** args, int argcp) {
     if (argcp == 1) {
         // Print all environment variables
-        for (char **env = environ; *env != 0; env++) {
-            char *thisEnv = *env;
-            printf("%s\n", thisEnv);
+        for (char **env = varsEnviron(); *env != 0; env++) {
+            outStr(*env);
+            outChar('\n');
         }
     } else if (argcp == 2) {
         // Attempt to set an environment variable
@@ -321,7 +1216,7 @@ static void env(char** args, int argcp) {
 
         if (value == NULL) {
             fprintf(stderr, "Invalid format. Use NAME=VALUE.\n");
-            return;
+            return 1;
         }
 
         // Split the string into name and value
@@ -330,163 +1225,1304 @@ static void env(char** args, int argcp) {
 
         if (*value == '\0') {
             fprintf(stderr, "Invalid format. Use NAME=VALUE.\n");
-            return;
+            return 1;
         }
 
-        if (setenv(name, value, 1) == 0) {
+        if (varsSet(name, value, 1) == 0) {
             // Provide feedback that the variable was set
             printf("Environment variable '%s' set to '%s'\n", name, value);
         } else {
-            perror("Failed to set environment variable");
+            fprintf(stderr, "env: '%s': not a valid name\n", name);
+            return 1;
         }
     } else {
-        fprintf(stderr, "Usage: env or env NAME=VALUE\n");
+        return usage("env");
     }
+    return 0;
 }
 
-// Stat Helper Function
-
-static void printFileStat(const char *path) {
-    struct stat sb;
+/*
+* Export shell variables to the commands the shell starts.
+* NAME=VALUE sets the variable as well; with no arguments the exported
+* variables are listed.
+*/
+static int exportVars(char** args, int argcp) {
+    if (argcp == 1) {
+        for (char** env = varsEnviron(); *env != NULL; env++) {
+            outStr("export ");
+            outStr(*env);
+            outChar('\n');
+        }
+        return 0;
+    }
+    int status = 0;
+    for (int i = 1; i < argcp; i++) {
+        char* value = strchr(args[i], '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+        if ((value ? varsSet(args[i], value, 1) : varsExport(args[i])) == -1) {
+            fprintf(stderr, "export: '%s': not a valid name\n", args[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
 
-    if (stat(path, &sb) == -1) {
-        perror(path);
-        return;
+/*
+* Remove shell variables, exported or not.
+*/
+static int unset(char** args, int argcp) {
+    if (argcp == 1) {
+        return usage("unset");
+    }
+    for (int i = 1; i < argcp; i++) {
+        varsUnset(args[i]);
     }
+    return 0;
+}
+
+// Stat Helper Function: the fields the default output needs
+#define STAT_DEFAULT_MASK (STATX_TYPE | STATX_MODE | STATX_UID | STATX_GID | STATX_SIZE | STATX_BLOCKS | \
+                           STATX_ATIME | STATX_MTIME | STATX_CTIME)
 
-    printf("  File: '%s'\n", path);
-    printf("  Size: %lld\tBlocks: %lld\tIO Block: %ld\t", (long long)sb.st_size, (long long)sb.st_blocks, (long)sb.st_blksize);
+// Stat Helper Function
+static void printFileStat(const char *path, const struct statx* stx) {
+    outStr("  File: '");
+    outStr(path);
+    outStr("'\n  Size: ");
+    outUnsigned(stx->stx_size, 0);
+    outStr("\tBlocks: ");
+    outUnsigned(stx->stx_blocks, 0);
+    outStr("\tIO Block: ");
+    outUnsigned(stx->stx_blksize, 0);
+    outChar('\t');
 
     // File type
-    printf("%s\n", S_ISDIR(sb.st_mode) ? "Directory" : S_ISREG(sb.st_mode) ? "Regular file" : "Other");
+    outStr(S_ISDIR(stx->stx_mode) ? "Directory" : S_ISREG(stx->stx_mode) ? "Regular file" : "Other");
 
     // Permissions
-    printf("  Access: (%04o/", sb.st_mode & ~S_IFMT);
-    printPermissions(sb.st_mode);
-    printf(")\n");
+    outStr("\n  Access: (");
+    outOctal(stx->stx_mode & ~S_IFMT, 4);
+    outChar('/');
+    outMode(stx->stx_mode);
+    outStr(")\n");
 
     // UID and GID
-    struct passwd *pwd = getpwuid(sb.st_uid);
-    struct group *grp = getgrgid(sb.st_gid);
-    printf("  UID: (%d/%s)   GID: (%d/%s)\n", sb.st_uid, (pwd != NULL) ? pwd->pw_name : "unknown", sb.st_gid, (grp != NULL) ? grp->gr_name : "unknown");
+    const char* user = idcacheUser(stx->stx_uid);
+    const char* group = idcacheGroup(stx->stx_gid);
+    outStr("  UID: (");
+    outUnsigned(stx->stx_uid, 0);
+    outChar('/');
+    outStr(user ? user : "unknown");
+    outStr(")   GID: (");
+    outUnsigned(stx->stx_gid, 0);
+    outChar('/');
+    outStr(group ? group : "unknown");
+    outStr(")\n");
 
     // Times
-    char timebuf[256];
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", localtime(&sb.st_atime));
-    printf("  Access: %s\n", timebuf);
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", localtime(&sb.st_mtime));
-    printf("  Modify: %s\n", timebuf);
-    strftime(timebuf, sizeof(timebuf), "%Y-%m-%d %H:%M:%S", localtime(&sb.st_ctime));
-    printf("  Change: %s\n", timebuf);
+    outStr("  Access: ");
+    outTime(stx->stx_atime.tv_sec, OUT_TIME_FULL);
+    outStr("\n  Modify: ");
+    outTime(stx->stx_mtime.tv_sec, OUT_TIME_FULL);
+    outStr("\n  Change: ");
+    outTime(stx->stx_ctime.tv_sec, OUT_TIME_FULL);
+    outChar('\n');
 }
-/**
- * Print file or directory statistics 
- * for each specified file or directory.
+
+/* Stat helper function
+ * Returns the statx fields a -c format string refers to, so the kernel
+ * (and a network filesystem behind it) only has to produce those.
+ */
+static unsigned int statFormatMask(const char* format) {
+    unsigned int mask = 0;
+    for (const char* p = format; *p != '\0'; p++) {
+        if (*p != '%' || p[1] == '\0') {
+            continue;
+        }
+        switch (*++p) {
+        case 's': mask |= STATX_SIZE; break;
+        case 'b': mask |= STATX_BLOCKS; break;
+        case 'f': mask |= STATX_TYPE | STATX_MODE; break;
+        case 'a': case 'A': mask |= STATX_MODE; break;
+        case 'F': mask |= STATX_TYPE; break;
+        case 'h': mask |= STATX_NLINK; break;
+        case 'i': mask |= STATX_INO; break;
+        case 'u': case 'U': mask |= STATX_UID; break;
+        case 'g': case 'G': mask |= STATX_GID; break;
+        case 'x': case 'X': mask |= STATX_ATIME; break;
+        case 'y': case 'Y': mask |= STATX_MTIME; break;
+        case 'z': case 'Z': mask |= STATX_CTIME; break;
+        case 'w': case 'W': mask |= STATX_BTIME; break;
+        }
+    }
+    return mask;
+}
+
+// Stat helper function: the %F name of a file type
+static const char* statTypeName(mode_t mode) {
+    switch (mode & S_IFMT) {
+    case S_IFREG:  return "regular file";
+    case S_IFDIR:  return "directory";
+    case S_IFLNK:  return "symbolic link";
+    case S_IFIFO:  return "fifo";
+    case S_IFSOCK: return "socket";
+    case S_IFCHR:  return "character special file";
+    case S_IFBLK:  return "block special file";
+    default:       return "unknown";
+    }
+}
+
+/* Stat helper function
+ * Writes one line of -c output. The directives follow coreutils stat;
+ * anything unrecognized after a '%' is copied through unchanged.
  */
-static void stat_file(char** args, int argcp) {
-    if (argcp < 2) {
-        fprintf(stderr, "Usage: stat <file/directory>...\n");
+static void printFileFormat(const char* path, const struct statx* stx, const char* format) {
+    for (const char* p = format; *p != '\0'; p++) {
+        const char* start = p;
+        while (*p != '\0' && *p != '%') {
+            p++;
+        }
+        outWrite(start, p - start);
+        if (*p == '\0') {
+            break;
+        }
+        if (p[1] == '\0') {
+            outChar('%');
+            break;
+        }
+
+        const char* name;
+        switch (*++p) {
+        case '%': outChar('%'); break;
+        case 'n': outStr(path); break;
+        case 's': outUnsigned(stx->stx_size, 0); break;
+        case 'b': outUnsigned(stx->stx_blocks, 0); break;
+        case 'B': outUnsigned(512, 0); break;
+        case 'o': outUnsigned(stx->stx_blksize, 0); break;
+        case 'f': {
+            static const char hex[] = "0123456789abcdef";
+            char text[8];
+            int len = 0;
+            unsigned int mode = stx->stx_mode;
+            do {
+                text[sizeof(text) - ++len] = hex[mode & 0xf];
+                mode >>= 4;
+            } while (mode != 0);
+            outWrite(text + sizeof(text) - len, len);
+            break;
+        }
+        case 'a': outOctal(stx->stx_mode & ~S_IFMT, 0); break;
+        case 'A': outMode(stx->stx_mode); break;
+        case 'F': outStr(statTypeName(stx->stx_mode)); break;
+        case 'h': outUnsigned(stx->stx_nlink, 0); break;
+        case 'i': outUnsigned(stx->stx_ino, 0); break;
+        case 'd': outUnsigned(makedev(stx->stx_dev_major, stx->stx_dev_minor), 0); break;
+        case 'u': outUnsigned(stx->stx_uid, 0); break;
+        case 'U':
+            name = idcacheUser(stx->stx_uid);
+            outStr(name ? name : "UNKNOWN");
+            break;
+        case 'g': outUnsigned(stx->stx_gid, 0); break;
+        case 'G':
+            name = idcacheGroup(stx->stx_gid);
+            outStr(name ? name : "UNKNOWN");
+            break;
+        case 'x': outTime(stx->stx_atime.tv_sec, OUT_TIME_FULL); break;
+        case 'X': outSigned(stx->stx_atime.tv_sec); break;
+        case 'y': outTime(stx->stx_mtime.tv_sec, OUT_TIME_FULL); break;
+        case 'Y': outSigned(stx->stx_mtime.tv_sec); break;
+        case 'z': outTime(stx->stx_ctime.tv_sec, OUT_TIME_FULL); break;
+        case 'Z': outSigned(stx->stx_ctime.tv_sec); break;
+        case 'w':
+            if (stx->stx_mask & STATX_BTIME) {
+                outTime(stx->stx_btime.tv_sec, OUT_TIME_FULL);
+            } else {
+                outChar('-');
+            }
+            break;
+        case 'W': outSigned((stx->stx_mask & STATX_BTIME) ? stx->stx_btime.tv_sec : 0); break;
+        default:
+            outWrite(p - 1, 2);
+            break;
+        }
+    }
+    outChar('\n');
+}
+
+// Stat options, and what has been printed so far
+struct statOptions {
+    const char* format;     // -c FORMAT, or NULL for the default output
+    int printed;            // files printed, for the blank line between them
+    int status;
+};
+
+// Stat helper function: prints one statBatch result
+static void statEmit(const char* path, const struct statx* stx, int error, void* ctx) {
+    struct statOptions* opts = ctx;
+    if (error != 0) {
+        fprintf(stderr, "stat: cannot stat '%s': %s\n", path, strerror(error));
+        opts->status = 1;
         return;
     }
+    if (opts->format != NULL) {
+        printFileFormat(path, stx, opts->format);
+        return;
+    }
+    if (opts->printed++ > 0) {
+        outChar('\n'); // Separate the stat info for multiple files/directories
+    }
+    printFileStat(path, stx);
+}
 
-    for (int i = 1; i < argcp; i++) {
-        printFileStat(args[i]);
-        if (i < argcp - 1) {
-            printf("\n"); // Separate the stat info for multiple files/directories
+/**
+ * Print file or directory statistics 
+ * for each specified file or directory.
+ * Options:
+ *   -c FORMAT  print FORMAT for each file instead of the full report
+ *   -j N       look up at most N files at once (default: 4 per CPU)
+ * The lookups run concurrently, since on a network filesystem each one
+ * mostly waits on the server; the output still follows argument order.
+ */
+static int stat_file(char** args, int argcp) {
+    struct statOptions opts = { NULL, 0, 0 };
+    int threads = 0;
+    int i = 1;
+    for (; i < argcp && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        char option = args[i][1];
+        if (option != 'c' && option != 'j') {
+            fprintf(stderr, "stat: invalid option '%s'\n", args[i]);
+            return usage("stat");
+        }
+        const char* value = (args[i][2] != '\0') ? args[i] + 2 : (i + 1 < argcp ? args[++i] : NULL);
+        if (value == NULL) {
+            fprintf(stderr, "stat: option '-%c' needs a value\n", option);
+            return usage("stat");
         }
+        if (option == 'c') {
+            opts.format = value;
+        } else if ((threads = atoi(value)) < 1) {
+            fprintf(stderr, "stat: -j needs a positive thread count\n");
+            return usage("stat");
+        }
+    }
+    if (i == argcp) {
+        return usage("stat");
+    }
+
+    if (threads == 0) {
+        threads = 4 * wspoolDefaultThreads();
+    }
+    unsigned int mask = (opts.format != NULL) ? statFormatMask(opts.format) : STAT_DEFAULT_MASK;
+    statBatch(cwdFD(), &args[i], argcp - i, mask, AT_NO_AUTOMOUNT, threads, statEmit, &opts);
+    return opts.status;
+}
+
+/* Tail helper function
+ * Scans buf[0..len) backwards for newlines, decrementing *need for each one.
+ * Returns the offset just past the newline that brings *need to zero,
+ * or -1 if the block does not contain enough lines.
+ */
+static ssize_t scanBackForLines(const char* buf, size_t len, long* need) {
+    const char* nl;
+    while (*need > 0 && len > 0 && (nl = memrchr(buf, '\n', len)) != NULL) {
+        len = nl - buf;
+        if (--(*need) == 0) {
+            return len + 1;
+        }
+    }
+    return -1;
+}
+
+// Tail helper function: writes bytes [start, end) of fd and returns the offset reached
+static off_t writeRange(int fd, off_t start, off_t end, char* block) {
+    while (start < end) {
+        size_t want = (end - start < TAIL_BLOCK_SIZE) ? (size_t)(end - start) : TAIL_BLOCK_SIZE;
+        ssize_t got = pread(fd, block, want, start);
+        if (got <= 0) {
+            if (got == -1 && errno == EINTR) continue;
+            if (got == -1) perror("tail: read");
+            break;
+        }
+        outWrite(block, got);
+        start += got;
     }
+    return start;
 }
 
+/* Tail helper function
+ * Seekable files are read in fixed-size blocks backwards from EOF, stopping
+ * as soon as enough newlines have been seen, so the cost depends on the
+ * size of the output rather than the size of the file. A file truncated
+ * while it is scanned, such as a log being rotated, is scanned again from
+ * its new end. Returns the size the output ends at, or -1 on a read error.
+ */
+static off_t printLastLinesSeekable(int fd, off_t size, long lines) {
+    char* block = malloc(TAIL_BLOCK_SIZE);
+    if (block == NULL) {
+        perror("tail");
+        return -1;
+    }
+
+    off_t start = 0;
+    off_t pos = size;
+    long need = lines;
+    int atEnd = 1;
+    if (need == 0) {
+        start = size;
+    }
+    while (need > 0 && pos > 0) {
+        size_t len = (pos < TAIL_BLOCK_SIZE) ? (size_t)pos : TAIL_BLOCK_SIZE;
+        pos -= len;
+        ssize_t got = pread(fd, block, len, pos);
+        if (got != (ssize_t)len) {
+            if (got == -1 && errno == EINTR) {
+                pos += len;
+                continue;
+            }
+            struct stat sb;
+            if (got >= 0 && fstat(fd, &sb) == 0 && sb.st_size < size) {
+                size = sb.st_size;
+                pos = size;
+                need = lines;
+                atEnd = 1;
+                start = 0;
+                continue;
+            }
+            if (got >= 0) {
+                errno = EIO;
+            }
+            perror("tail: read");
+            free(block);
+            return -1;
+        }
+        // A newline at the very end terminates the last line rather than starting a new one
+        if (atEnd && block[len - 1] == '\n') {
+            len--;
+        }
+        atEnd = 0;
+        ssize_t found = scanBackForLines(block, len, &need);
+        if (found >= 0) {
+            start = pos + found;
+        }
+    }
+
+    writeRange(fd, start, size, block);
+    free(block);
+    return size;
+}
+
+/* Tail helper function
+ * Pipes and other non-seekable inputs are read forward into a buffer that is
+ * periodically trimmed to the lines that can still end up in the output.
+ */
+static void printLastLinesStream(int fd, long lines) {
+    size_t cap = 2 * TAIL_BLOCK_SIZE;
+    size_t len = 0;
+    char* buf = malloc(cap);
+    if (buf == NULL) {
+        perror("tail");
+        return;
+    }
+
+    while (1) {
+        if (cap - len < TAIL_BLOCK_SIZE) {
+            long need = lines;
+            size_t scan = (len > 0 && buf[len - 1] == '\n') ? len - 1 : len;
+            ssize_t keep = (need == 0) ? (ssize_t)len : scanBackForLines(buf, scan, &need);
+            if (keep > 0) {
+                memmove(buf, buf + keep, len - keep);
+                len -= keep;
+            }
+            if (cap - len < TAIL_BLOCK_SIZE) {
+                char* bigger = realloc(buf, cap * 2);
+                if (bigger == NULL) {
+                    perror("tail");
+                    free(buf);
+                    return;
+                }
+                buf = bigger;
+                cap *= 2;
+            }
+        }
+        ssize_t got = read(fd, buf + len, cap - len);
+        if (got == 0) break;
+        if (got == -1) {
+            if (errno == EINTR) continue;
+            perror("tail: read");
+            break;
+        }
+        len += got;
+    }
+
+    long need = lines;
+    size_t scan = (len > 0 && buf[len - 1] == '\n') ? len - 1 : len;
+    ssize_t start = (need == 0) ? (ssize_t)len : scanBackForLines(buf, scan, &need);
+    if (start < 0) {
+        start = 0;
+    }
+    outWrite(buf + start, len - start);
+    free(buf);
+}
+
+// Tail state for one file, kept across follow mode
+struct tailFile {
+    const char* name;   // name as given on the command line
+    const char* base;   // last path component, matched against directory events
+    int fd;             // open descriptor, or -1 while the file is missing
+    off_t offset;       // bytes of the file already written
+    int wd;             // inotify watch on the file itself
+    int dirWd;          // inotify watch on the parent directory (-F only)
+};
+
 // Tail helper function
-static void printLastLines(const char* filename) {
-    FILE* file = fopen(filename, "r");
-    if (!file) {
-        perror(filename);
+static int printLastLines(struct tailFile* file, long lines, int follow) {
+    if (strcmp(file->name, "-") == 0) {
+        file->fd = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 0);
+    } else {
+        file->fd = openat(cwdFD(), file->name, O_RDONLY | O_CLOEXEC);
+    }
+    if (file->fd == -1) {
+        perror(file->name);
+        return 1;
+    }
+
+    struct stat sb;
+    if (fstat(file->fd, &sb) == -1) {
+        perror(file->name);
+        close(file->fd);
+        file->fd = -1;
+        return 1;
+    }
+
+    if (S_ISREG(sb.st_mode)) {
+        file->offset = printLastLinesSeekable(file->fd, sb.st_size, lines);
+        if (file->offset == -1) {
+            close(file->fd);
+            file->fd = -1;
+            return 1;
+        }
+    } else {
+        printLastLinesStream(file->fd, lines);
+        if (follow) {
+            fprintf(stderr, "tail: %s: cannot follow a non-regular file\n", file->name);
+        }
+        close(file->fd);
+        file->fd = -1;
+    }
+    return 0;
+}
+
+/* Tail follow helper
+ * Writes whatever has been appended to the file since the last call.
+ * A file that shrank below the saved offset is treated as truncated
+ * and followed again from the start.
+ */
+static void tailCatchUp(struct tailFile* files, int count, int index, int* lastPrinted, char* block) {
+    struct tailFile* file = &files[index];
+    struct stat sb;
+    if (file->fd == -1 || fstat(file->fd, &sb) == -1) {
+        return;
+    }
+
+    if (sb.st_size < file->offset) {
+        fprintf(stderr, "tail: %s: file truncated\n", file->name);
+        file->offset = 0;
+    }
+    if (sb.st_size == file->offset) {
         return;
     }
 
-    char* lines[MAX_LINES] = {NULL}; // Array to hold the last 10 lines, initialized to NULL
-    size_t currentLine = 0;
-    size_t totalLines = 0;
+    if (count > 1 && *lastPrinted != index) {
+        outStr("\n==> ");
+        outStr(file->name);
+        outStr(" <==\n");
+    }
+    *lastPrinted = index;
+    file->offset = writeRange(file->fd, file->offset, sb.st_size, block);
+    outFlush();
+}
 
-    // Read file line by line and store the last 10 lines
-    char* buffer = NULL;
-    size_t len = 0;
-    ssize_t nread;
-    while ((nread = getline(&buffer, &len, file)) != -1) {
-        if (lines[currentLine] != NULL) {
-            free(lines[currentLine]); // Free the old line if it exists
+// Tail follow helper
+static void tailStopFollowing(int ifd, struct tailFile* file) {
+    if (file->wd != -1) {
+        inotify_rm_watch(ifd, file->wd);
+        file->wd = -1;
+    }
+    if (file->fd != -1) {
+        close(file->fd);
+        file->fd = -1;
+    }
+}
+
+/* Tail follow helper
+ * (Re)opens a followed name after it appeared in its directory, following
+ * the new file from its first byte.
+ */
+static void tailReopen(int ifd, struct tailFile* files, int count, int index, int* lastPrinted, char* block) {
+    struct tailFile* file = &files[index];
+    int replaced = (file->fd != -1);
+
+    // Drain whatever was written to the old file before it was rotated away
+    tailCatchUp(files, count, index, lastPrinted, block);
+    tailStopFollowing(ifd, file);
+
+    file->fd = openat(cwdFD(), file->name, O_RDONLY | O_CLOEXEC);
+    if (file->fd == -1) {
+        return;
+    }
+    file->offset = 0;
+    file->wd = inotify_add_watch(ifd, file->name, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    fprintf(stderr, "tail: '%s' has %s; following new file\n", file->name, replaced ? "been replaced" : "appeared");
+    tailCatchUp(files, count, index, lastPrinted, block);
+}
+
+// Tail follow helper
+static void tailHandleEvent(int ifd, const struct inotify_event* ev, struct tailFile* files, int count,
+                            int byName, int* lastPrinted, char* block) {
+    for (int i = 0; i < count; i++) {
+        struct tailFile* file = &files[i];
+
+        if (file->wd != -1 && ev->wd == file->wd) {
+            if (ev->mask & IN_IGNORED) {
+                file->wd = -1;
+                continue;
+            }
+            if (ev->mask & (IN_MODIFY | IN_ATTRIB)) {
+                tailCatchUp(files, count, i, lastPrinted, block);
+            }
+            if (byName && (ev->mask & (IN_MOVE_SELF | IN_DELETE_SELF))) {
+                tailCatchUp(files, count, i, lastPrinted, block);
+                tailStopFollowing(ifd, file);
+                fprintf(stderr, "tail: '%s' has become inaccessible\n", file->name);
+            }
+        }
+
+        if (byName && file->dirWd != -1 && ev->wd == file->dirWd && ev->len > 0 &&
+            (ev->mask & (IN_CREATE | IN_MOVED_TO)) && strcmp(ev->name, file->base) == 0) {
+            tailReopen(ifd, files, count, i, lastPrinted, block);
         }
-        lines[currentLine] = strdup(buffer); // Store the new line
-        currentLine = (currentLine + 1) % MAX_LINES; // Circular buffer logic
-        totalLines++;
     }
-    fclose(file);
-    free(buffer);
+}
 
-    // Determine the starting line for printing
-    size_t startLine = (totalLines < MAX_LINES) ? 0 : currentLine;
+/* Tail follow mode
+ * One inotify instance watches every file (and, with -F, every parent
+ * directory so rotated names can be picked up again). epoll waits on it
+ * together with a signalfd for SIGINT, so the shell sleeps until a file
+ * changes and Ctrl-C returns to the prompt. Only bytes appended since the
+ * saved offset are read.
+ */
+static void tailFollow(struct tailFile* files, int count, int byName) {
+    int ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (ifd == -1) {
+        perror("tail: inotify_init1");
+        return;
+    }
 
-    // Print the last 10 lines or less if the file is shorter
-    for (size_t i = 0; i < MAX_LINES && lines[(startLine + i) % MAX_LINES]; i++) {
-        printf("%s", lines[(startLine + i) % MAX_LINES]);
-        free(lines[(startLine + i) % MAX_LINES]); // Free after printing
+    int watching = 0;
+    for (int i = 0; i < count; i++) {
+        struct tailFile* file = &files[i];
+        if (file->fd != -1) {
+            file->wd = inotify_add_watch(ifd, file->name, IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+            if (file->wd == -1) {
+                perror(file->name);
+            } else {
+                watching++;
+            }
+        }
+        if (byName) {
+            char* slash = strrchr(file->name, '/');
+            char* dir = slash ? strndup(file->name, slash == file->name ? 1 : (size_t)(slash - file->name)) : strdup(".");
+            if (dir != NULL) {
+                file->dirWd = inotify_add_watch(ifd, dir, IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+                if (file->dirWd == -1) {
+                    perror(dir);
+                } else {
+                    watching++;
+                }
+                free(dir);
+            }
+        }
     }
+    if (watching == 0) {
+        fprintf(stderr, "tail: no files remaining\n");
+        close(ifd);
+        return;
+    }
+
+    // Route SIGINT through a signalfd so Ctrl-C ends follow mode instead of the shell
+    sigset_t mask, oldMask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigprocmask(SIG_BLOCK, &mask, &oldMask);
+    int sfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    int efd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = ifd;
+    epoll_ctl(efd, EPOLL_CTL_ADD, ifd, &ev);
+    if (sfd != -1) {
+        ev.data.fd = sfd;
+        epoll_ctl(efd, EPOLL_CTL_ADD, sfd, &ev);
+    }
+
+    char* block = malloc(TAIL_BLOCK_SIZE);
+    char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+        __attribute__((aligned(__alignof__(struct inotify_event))));
+    int lastPrinted = count - 1;
+    int running = (block != NULL && efd != -1);
+    outFlush();
+
+    while (running) {
+        struct epoll_event ready[2];
+        int n = epoll_wait(efd, ready, 2, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            perror("tail: epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (ready[i].data.fd == sfd) {
+                struct signalfd_siginfo info;
+                while (read(sfd, &info, sizeof(info)) == sizeof(info)) {
+                    running = 0;
+                }
+                continue;
+            }
+
+            ssize_t len;
+            while ((len = read(ifd, events, sizeof(events))) > 0) {
+                for (char* p = events; p < events + len;) {
+                    const struct inotify_event* event = (const struct inotify_event*)p;
+                    tailHandleEvent(ifd, event, files, count, byName, &lastPrinted, block);
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+        }
+    }
+
+    free(block);
+    if (efd != -1) close(efd);
+    if (sfd != -1) close(sfd);
+    sigprocmask(SIG_SETMASK, &oldMask, NULL);
+    close(ifd);
 }
 
 /**
- * Print the last few lines of each specified file.
+ * Print the last few lines of each specified file,
+ * or of standard input if no file (or '-') is given.
+ * '-n N' selects how many lines are printed (default 10).
+ * '-f' keeps following the open files and prints data as it is appended;
+ * '-F' follows the names instead, so rotated or recreated logs are reopened.
  */
-static void tail(char** args, int argcp) {
-    if (argcp < 2) {
-        fprintf(stderr, "Usage: tail <file1...fileN>\n");
-        return;
+static int tail(char** args, int argcp) {
+    long lines = TAIL_DEFAULT_LINES;
+    int follow = 0;
+    int byName = 0;
+    int first = 1;
+
+    // Parse options before the file list
+    while (first < argcp && args[first][0] == '-' && args[first][1] != '\0') {
+        if (strcmp(args[first], "-f") == 0) {
+            follow = 1;
+            first++;
+            continue;
+        }
+        if (strcmp(args[first], "-F") == 0) {
+            follow = 1;
+            byName = 1;
+            first++;
+            continue;
+        }
+        if (args[first][1] != 'n') {
+            fprintf(stderr, "tail: invalid option '%s'\n", args[first]);
+            return usage("tail");
+        }
+
+        const char* count = args[first][2] != '\0' ? &args[first][2] : NULL;
+        if (count == NULL) {
+            if (first + 1 >= argcp) {
+                fprintf(stderr, "tail: option requires an argument -- 'n'\n");
+                return usage("tail");
+            }
+            count = args[++first];
+        }
+        char* end;
+        errno = 0;
+        lines = strtol(count, &end, 10);
+        if (errno != 0 || *end != '\0' || end == count || lines < 0) {
+            fprintf(stderr, "tail: invalid number of lines: '%s'\n", count);
+            return 1;
+        }
+        first++;
+    }
+
+    // With no files, read standard input
+    char* standardInput[] = { "-" };
+    if (first >= argcp) {
+        args = standardInput;
+        first = 0;
+        argcp = 1;
+    }
+
+    int count = argcp - first;
+    int status = 0;
+    struct tailFile* files = calloc(count, sizeof(struct tailFile));
+    if (files == NULL) {
+        perror("tail");
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct tailFile* file = &files[i];
+        file->name = args[first + i];
+        char* slash = strrchr(file->name, '/');
+        file->base = slash ? slash + 1 : file->name;
+        file->fd = -1;
+        file->wd = -1;
+        file->dirWd = -1;
+
+        if (count > 1) { // Print header if there are multiple files
+            outStr("==> ");
+            outStr(file->name);
+            outStr(" <==\n");
+        }
+        status |= printLastLines(file, lines, follow);
+        if (i < count - 1) {
+            outChar('\n'); // Separate output for multiple files
+        }
+    }
+
+    if (follow) {
+        tailFollow(files, count, byName);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (files[i].fd != -1) {
+            close(files[i].fd);
+        }
+    }
+    free(files);
+    return status;
+}
+
+// Touch helper function: each file is a single openat and futimens, so the
+// pool only pays off for long lists, and a task takes a run of files at a time
+#define TOUCH_SERIAL 64
+#define TOUCH_CHUNK 32
+
+// Touch helper function: what every file of one touch shares
+struct touchBatch {
+    char* const* files;
+    int dirFD;
+    int noCreate;
+    const struct timespec* times;
+    atomic_int failed;
+};
+
+/* Touch helper function
+ * One openat creates the file or opens it as it is, and futimens sets its
+ * times through that descriptor. Directories and files that cannot be opened
+ * for writing fall back to utimensat, as does -c, which never creates.
+ */
+static int touchOne(int dirFD, const char* name, int noCreate, const struct timespec* times) {
+    int openError = 0;
+    if (!noCreate) {
+        int fd = openat(dirFD, name, O_WRONLY | O_CREAT | O_NOCTTY | O_NONBLOCK | O_CLOEXEC, 0666);
+        if (fd != -1) {
+            int result = futimens(fd, times);
+            int error = errno;
+            close(fd);
+            if (result == 0) {
+                return 0;
+            }
+            fprintf(stderr, "touch: setting times of '%s': %s\n", name, strerror(error));
+            return -1;
+        }
+        openError = errno;
+    }
+    if (utimensat(dirFD, name, times, 0) == 0) {
+        return 0;
+    }
+    if (errno == ENOENT && noCreate) {
+        return 0;
+    }
+    // A missing file that could not be created is reported with the reason it could not
+    fprintf(stderr, "touch: cannot touch '%s': %s\n", name,
+            strerror((errno == ENOENT && openError != 0) ? openError : errno));
+    return -1;
+}
+
+// Touch helper function: touches one file of the batch
+static void touchItem(int index, int worker, void* ctx) {
+    (void)worker;
+    struct touchBatch* batch = ctx;
+    if (touchOne(batch->dirFD, batch->files[index], batch->noCreate, batch->times) == -1) {
+        atomic_store(&batch->failed, 1);
+    }
+}
+
+// Touch helper function: reads a decimal fraction of a second, up to nanoseconds
+static const char* touchFraction(const char* s, long* nsec) {
+    *nsec = 0;
+    if (*s != '.' && *s != ',') {
+        return s;
+    }
+    long scale = 100000000;
+    for (s++; *s >= '0' && *s <= '9'; s++, scale /= 10) {
+        *nsec += (*s - '0') * scale;
+    }
+    return s;
+}
+
+/* Touch helper function
+ * Parses -d: @SECONDS[.FRACTION] since the epoch, or a local
+ * YYYY-MM-DD[ HH:MM[:SS[.FRACTION]]] with a space or a T between the parts.
+ * returns 0, or -1 if the date is not understood
+ */
+static int touchParseDate(const char* s, struct timespec* ts) {
+    char* end;
+    if (*s == '@') {
+        errno = 0;
+        ts->tv_sec = strtoll(s + 1, &end, 10);
+        if (end == s + 1 || errno != 0) {
+            return -1;
+        }
+        return (*touchFraction(end, &ts->tv_nsec) == '\0') ? 0 : -1;
+    }
+
+    struct tm tm = { 0 };
+    int used = 0;
+    if (sscanf(s, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &used) != 3) {
+        return -1;
+    }
+    s += used;
+    if (*s == ' ' || *s == 'T') {
+        used = 0;
+        if (sscanf(s + 1, "%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &used) != 2) {
+            return -1;
+        }
+        s += 1 + used;
+        if (*s == ':') {
+            used = 0;
+            if (sscanf(s + 1, "%2d%n", &tm.tm_sec, &used) != 1) {
+                return -1;
+            }
+            s += 1 + used;
+        }
+    }
+    s = touchFraction(s, &ts->tv_nsec);
+    if (*s != '\0' || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31 ||
+        tm.tm_hour > 23 || tm.tm_min > 59 || tm.tm_sec > 60) {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    ts->tv_sec = mktime(&tm);
+    return 0;
+}
+
+/**
+ * Create empty files or update the access and modification times of
+ * existing ones, to now or to the time given by -d or taken from -r.
+ * -a and -m change only the access or only the modification time, and
+ * -c never creates a file. Long lists are spread over a thread pool.
+ */
+
+static int touch(char** args, int argcp) {
+    int noCreate = 0, accessOnly = 0, modifyOnly = 0, threads = 0;
+    const char* date = NULL;
+    const char* reference = NULL;
+    int i = 1;
+    for (; i < argcp && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "--") == 0) {
+            i++;
+            break;
+        }
+        for (const char* flag = args[i] + 1; *flag != '\0'; flag++) {
+            if (*flag == 'c') {
+                noCreate = 1;
+            } else if (*flag == 'a') {
+                accessOnly = 1;
+            } else if (*flag == 'm') {
+                modifyOnly = 1;
+            } else if (*flag == 'd' || *flag == 'r' || *flag == 'j') {
+                const char* value = (flag[1] != '\0') ? flag + 1 : (i + 1 < argcp ? args[++i] : NULL);
+                if (value == NULL) {
+                    fprintf(stderr, "touch: option '-%c' needs a value\n", *flag);
+                    return usage("touch");
+                }
+                if (*flag == 'd') {
+                    date = value;
+                } else if (*flag == 'r') {
+                    reference = value;
+                } else if ((threads = atoi(value)) < 1) {
+                    fprintf(stderr, "touch: -j needs a positive thread count\n");
+                    return usage("touch");
+                }
+                break;
+            } else {
+                fprintf(stderr, "touch: invalid option -- '%c'\n", *flag);
+                return usage("touch");
+            }
+        }
+    }
+    if (i == argcp || (date != NULL && reference != NULL)) {
+        return usage("touch");
+    }
+
+    // Both times default to now; with neither -a nor -m both are set
+    struct timespec times[2] = { { 0, UTIME_NOW }, { 0, UTIME_NOW } };
+    if (date != NULL) {
+        if (touchParseDate(date, &times[0]) == -1) {
+            fprintf(stderr, "touch: invalid date format '%s'\n", date);
+            return 1;
+        }
+        times[1] = times[0];
+    } else if (reference != NULL) {
+        struct stat sb;
+        if (fstatat(cwdFD(), reference, &sb, 0) == -1) {
+            fprintf(stderr, "touch: failed to get attributes of '%s': %s\n", reference, strerror(errno));
+            return 1;
+        }
+        times[0] = sb.st_atim;
+        times[1] = sb.st_mtim;
+    }
+    if (accessOnly && !modifyOnly) {
+        times[1].tv_nsec = UTIME_OMIT;
+    } else if (modifyOnly && !accessOnly) {
+        times[0].tv_nsec = UTIME_OMIT;
+    }
+
+    int dirFD = cwdFD();
+    int count = argcp - i;
+    if (threads == 0) {
+        threads = wspoolDefaultThreads();
+    }
+    struct wsPool* pool = (threads > 1 && count >= TOUCH_SERIAL) ? wspoolCreate(threads) : NULL;
+    struct touchBatch batch = { &args[i], dirFD, noCreate, times, 0 };
+    wspoolForEach(pool, count, TOUCH_CHUNK, touchItem, &batch);
+    if (pool != NULL) {
+        wspoolDestroy(pool);
+    }
+    return atomic_load(&batch.failed);
+}
+
+/**
+ * Show or change the remembered locations of external commands.
+ * With no arguments, list every remembered command and its hit count.
+ * '-r' forgets all of them; '-p PATH NAME' always runs NAME from PATH;
+ * any other argument is looked up in PATH and remembered.
+ */
+static int hash(char** args, int argcp) {
+    if (argcp == 1) {
+        cmdhashPrint();
+        return 0;
+    }
+
+    if (strcmp(args[1], "-r") == 0) {
+        cmdhashClear();
+        return 0;
+    }
+
+    if (strcmp(args[1], "-p") == 0) {
+        if (argcp != 4) {
+            return usage("hash");
+        }
+        if (cmdhashPin(args[3], args[2]) == -1) {
+            perror("hash");
+            return 1;
+        }
+        return 0;
+    }
+
+    int status = 0;
+    for (int i = 1; i < argcp; i++) {
+        if (strchr(args[i], '/') == NULL && cmdhashLookup(args[i]) == NULL) {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+            status = 1;
+        }
+    }
+    return status;
+}
+
+/**
+ * Set or clear shell options.
+ * '-e' makes the shell exit as soon as a command fails, '+e' turns that off.
+ * With no arguments, the current options are listed.
+ */
+static int setOptions(char** args, int argcp) {
+    if (argcp == 1) {
+        printf("set %ce\n", shell.errexit ? '-' : '+');
+        return 0;
     }
 
     for (int i = 1; i < argcp; i++) {
-        if (argcp > 2) { // Print header if there are multiple files
-            printf("==> %s <==\n", args[i]);
+        if (strcmp(args[i], "-e") == 0) {
+            shell.errexit = 1;
+        } else if (strcmp(args[i], "+e") == 0) {
+            shell.errexit = 0;
+        } else {
+            return usage("set");
         }
-        printLastLines(args[i]);
-        if (i < argcp - 1) {
-            printf("\n"); // Separate output for multiple files
+    }
+    return 0;
+}
+
+/**
+ * List the background and stopped jobs with their state.
+ */
+static int jobs(char** args, int argcp) {
+    if (argcp > 1) {
+        return usage("jobs");
+    }
+    jobsList();
+    return 0;
+}
+
+/**
+ * Wait for the given jobs, or for every job when none are given.
+ * Returns the exit status of the last job waited for.
+ */
+static int waitJobs(char** args, int argcp) {
+    if (argcp == 1) {
+        return jobsWaitAll();
+    }
+
+    int status = 0;
+    for (int i = 1; i < argcp; i++) {
+        int id = jobsResolve(args[i]);
+        if (id == -1) {
+            fprintf(stderr, "wait: %s: no such job\n", args[i]);
+            status = 127;
+            continue;
         }
+        status = jobsWait(id);
     }
+    return status;
 }
 
 /**
- * Create a new empty file or update the access and
- *  modification times of an existing file.
+ * Bring a job, by default the most recent one, into the foreground.
  */
+static int fg(char** args, int argcp) {
+    if (argcp > 2) {
+        return usage("fg");
+    }
+    int id = jobsResolve(args[1]);
+    if (id == -1) {
+        fprintf(stderr, "fg: %s: no such job\n", argcp > 1 ? args[1] : "current");
+        return 1;
+    }
+    return jobsForeground(id);
+}
 
-static void touch(char** args, int argcp) {
-    // Check if the correct number of arguments are provided
-    if (argcp != 2) {
-        fprintf(stderr, "Usage: touch <filename>\n");
-        return;
+/**
+ * Continue stopped jobs, by default the most recent one, in the background.
+ */
+static int bg(char** args, int argcp) {
+    if (argcp == 1) {
+        int id = jobsResolve(NULL);
+        if (id == -1) {
+            fprintf(stderr, "bg: current: no such job\n");
+            return 1;
+        }
+        return jobsBackground(id);
     }
 
-    // Get the file name from the arguments
-    char* filename = args[1];
+    int status = 0;
+    for (int i = 1; i < argcp; i++) {
+        int id = jobsResolve(args[i]);
+        if (id == -1) {
+            fprintf(stderr, "bg: %s: no such job\n", args[i]);
+            status = 1;
+        } else if (jobsBackground(id) != 0) {
+            status = 1;
+        }
+    }
+    return status;
+}
 
-    // Check if the file already exists
-    if (access(filename, F_OK) == 0) {
-        // File already exists, update its access and modification times
-        if (utime(filename, NULL) == -1) {
-            perror("utime");
-            return;
+/*
+* readLines is a helper function that reads all of fd and splits it into
+* lines, skipping empty ones. The lines point into *buffer, which the caller frees.
+* returns the number of lines, or -1 on a read error (already reported)
+*/
+static int readLines(int fd, char** buffer, char*** lines) {
+    size_t size = 64 * 1024;
+    size_t have = 0;
+    *buffer = malloc(size);
+    *lines = NULL;
+    if (*buffer == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    ssize_t n;
+    while ((n = read(fd, *buffer + have, size - have)) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("read");
+            return -1;
+        }
+        have += n;
+        if (have == size) {
+            size *= 2;
+            char* grown = realloc(*buffer, size);
+            if (grown == NULL) {
+                perror("realloc");
+                return -1;
+            }
+            *buffer = grown;
         }
-        printf("Updated access and modification times of '%s'\n", filename);
-        return; // Early return
     }
 
-    // File does not exist, create a new empty file
-    FILE* file = fopen(filename, "w");
-    if (file == NULL) {
-        perror("fopen");
-        return;
+    int count = 0;
+    int capacity = 0;
+    for (char* p = *buffer; p < *buffer + have; ) {
+        char* newline = memchr(p, '\n', *buffer + have - p);
+        char* end = (newline != NULL) ? newline : *buffer + have;
+        *end = '\0'; // There is always room, since the buffer is never full here
+        if (end > p) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                char** grown = realloc(*lines, capacity * sizeof(char*));
+                if (grown == NULL) {
+                    perror("realloc");
+                    return -1;
+                }
+                *lines = grown;
+            }
+            (*lines)[count++] = p;
+        }
+        p = end + 1;
     }
-    fclose(file);
-    printf("Created new file '%s'\n", filename);
+    return count;
 }
 
+/**
+ * Run a command once per argument, up to N at a time ('-j N', default: one per CPU).
+ * Every {} in the command is replaced by the argument; without any {}, the argument
+ * is appended. The arguments follow ':::', or are read from stdin one per line.
+ * The output of each job is printed in one piece when it ends, failed jobs are
+ * reported with their exit status ('-v' reports every job), and a summary with the
+ * total wall time is printed at the end. The exit status is the number of failed jobs.
+ */
+static int parallel(char** args, int argcp) {
+    int jobs = 0;
+    int verbose = 0;
+    int i = 1;
+    for (; i < argcp && args[i][0] == '-' && args[i][1] != '\0'; i++) {
+        if (strcmp(args[i], "-v") == 0) {
+            verbose = 1;
+        } else if (strncmp(args[i], "-j", 2) == 0) {
+            const char* value = (args[i][2] != '\0') ? args[i] + 2 : (i + 1 < argcp ? args[++i] : NULL);
+            jobs = value ? atoi(value) : 0;
+            if (jobs < 1) {
+                fprintf(stderr, "parallel: -j needs a positive job count\n");
+                return usage("parallel");
+            }
+        } else {
+            fprintf(stderr, "parallel: invalid option '%s'\n", args[i]);
+            return usage("parallel");
+        }
+    }
+
+    char** command = &args[i];
+    int separator = i;
+    while (separator < argcp && strcmp(args[separator], ":::") != 0) {
+        separator++;
+    }
+    if (separator == i) {
+        return usage("parallel");
+    }
+    if (jobs == 0) {
+        jobs = wspoolDefaultThreads();
+    }
+
+    int status;
+    if (separator < argcp) {
+        // args is NULL terminated, so the separator slot can end the template
+        char* saved = args[separator];
+        args[separator] = NULL;
+        status = parallelRun(command, &args[separator + 1], argcp - separator - 1, jobs, -1, verbose);
+        args[separator] = saved;
+        return status;
+    }
+
+    char* buffer;
+    char** lines;
+    int count = readLines(STDIN_FILENO, &buffer, &lines);
+    if (count == -1) {
+        free(lines);
+        free(buffer);
+        return 1;
+    }
+    // stdin held the arguments, so the jobs get an empty one
+    int nullFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    status = parallelRun(command, lines, count, jobs, nullFD, verbose);
+    if (nullFD != -1) {
+        close(nullFD);
+    }
+    free(lines);
+    free(buffer);
+    return status;
+}
+
+/**
+ * Print how long each phase of running commands took: counts, mean, min,
+ * percentiles and max as a table, or with '-j' as JSON including the
+ * histograms. '-r' starts the measurements over.
+ */
+static int shellstats(char** args, int argcp) {
+    if (argcp == 1) {
+        statsPrint(0);
+        return 0;
+    }
+    if (argcp == 2 && strcmp(args[1], "-j") == 0) {
+        statsPrint(1);
+        return 0;
+    }
+    if (argcp == 2 && strcmp(args[1], "-r") == 0) {
+        statsReset();
+        return 0;
+    }
+    return usage("shellstats");
+}
+
+/**
+ * List the command history, numbered from the oldest command.
+ *   history            every command
+ *   history N          the last N commands
+ *   history -s PREFIX  the commands starting with PREFIX, newest first;
+ *                      a count after PREFIX limits how many are listed
+ * A search that matches nothing returns 1.
+ */
+static int history(char** args, int argcp) {
+    int search = (argcp > 1 && strcmp(args[1], "-s") == 0);
+    int first = search ? 3 : 1;
+    if ((search && argcp < 3) || argcp > first + 1) {
+        return usage("history");
+    }
+    long count = 0;
+    if (argcp == first + 1) {
+        char* end;
+        count = strtol(args[first], &end, 10);
+        if (*end != '\0' || count < 1) {
+            fprintf(stderr, "history: %s: positive count expected\n", args[first]);
+            return usage("history");
+        }
+    }
+    if (search) {
+        return historySearch(args[2], count) > 0 ? 0 : 1;
+    }
+    historyPrint(count);
+    return 0;
+}
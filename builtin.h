@@ -5,9 +5,16 @@
 * args    args is an array of char*'s that contain a command and the arguements
 *that command
 *argcp    The count of how many arguments are in args
+*status   where the exit status of the builtin is stored if one was run
 * returns 1 if it finds a builtin command to run, returns 0 otherwise
 */
-int builtIn(char** args, int argcp);
+int builtIn(char** args, int argcp, int* status);
+
+/*isBuiltIn
+* name    a command name
+* returns 1 if name is a builtin command, 0 otherwise
+*/
+int isBuiltIn(const char* name);
 
 #endif
 
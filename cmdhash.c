@@ -0,0 +1,227 @@
+// Hashed PATH lookups for external commands
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "cmdhash.h"
+#include "vars.h"
+
+#define CMDHASH_INITIAL_BUCKETS 64
+
+struct cmdEntry {
+    struct cmdEntry* next;
+    char* name;
+    char* path;
+    unsigned long hits;
+    int pinned;         // set with hash -p; never searched for or forgotten
+};
+
+// A chained hash table from command name to absolute path
+static struct cmdEntry** buckets;
+static size_t bucketCount;      // always a power of two
+static size_t entryCount;
+
+static size_t nameHash(const char* name)
+{
+    // FNV-1a
+    size_t hash = 2166136261u;
+    for (; *name != '\0'; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+    return hash;
+}
+
+static struct cmdEntry** findSlot(const char* name)
+{
+    struct cmdEntry** slot = &buckets[nameHash(name) & (bucketCount - 1)];
+    while (*slot != NULL && strcmp((*slot)->name, name) != 0) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+static int growTable(void)
+{
+    size_t count = bucketCount ? bucketCount * 2 : CMDHASH_INITIAL_BUCKETS;
+    struct cmdEntry** table = calloc(count, sizeof(struct cmdEntry*));
+    if (table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < bucketCount; i++) {
+        struct cmdEntry* entry = buckets[i];
+        while (entry != NULL) {
+            struct cmdEntry* next = entry->next;
+            size_t index = nameHash(entry->name) & (count - 1);
+            entry->next = table[index];
+            table[index] = entry;
+            entry = next;
+        }
+    }
+    free(buckets);
+    buckets = table;
+    bucketCount = count;
+    return 0;
+}
+
+/* Adds or replaces an entry; the table takes ownership of path.
+ * Returns the entry, or NULL if memory ran out.
+ */
+static struct cmdEntry* storeEntry(const char* name, char* path, int pinned)
+{
+    if ((bucketCount == 0 || entryCount >= bucketCount) && growTable() == -1 && bucketCount == 0) {
+        free(path);
+        return NULL;
+    }
+
+    struct cmdEntry** slot = findSlot(name);
+    struct cmdEntry* entry = *slot;
+    if (entry == NULL) {
+        entry = calloc(1, sizeof(struct cmdEntry));
+        if (entry == NULL || (entry->name = strdup(name)) == NULL) {
+            free(entry);
+            free(path);
+            return NULL;
+        }
+        *slot = entry;
+        entryCount++;
+    } else {
+        free(entry->path);
+    }
+    entry->path = path;
+    entry->pinned = pinned;
+    return entry;
+}
+
+/* Walks PATH the way execvp would, returning a newly allocated path to the
+ * first executable regular file called name. Results found through a
+ * relative PATH entry (such as "" or ".") depend on the current directory,
+ * so *cacheable is cleared for them.
+ */
+static char* searchPath(const char* name, int* cacheable)
+{
+    const char* path = varsGet("PATH", 4);
+    if (path == NULL) {
+        path = "/bin:/usr/bin";
+    }
+
+    size_t nameLen = strlen(name);
+    const char* dir = path;
+    while (1) {
+        const char* end = strchr(dir, ':');
+        size_t dirLen = end ? (size_t)(end - dir) : strlen(dir);
+
+        char* candidate = malloc(dirLen + nameLen + 3);
+        if (candidate == NULL) {
+            return NULL;
+        }
+        if (dirLen == 0) {
+            candidate[0] = '.';
+            dirLen = 1;
+        } else {
+            memcpy(candidate, dir, dirLen);
+        }
+        candidate[dirLen] = '/';
+        memcpy(candidate + dirLen + 1, name, nameLen + 1);
+
+        struct stat sb;
+        if (stat(candidate, &sb) == 0 && S_ISREG(sb.st_mode) && access(candidate, X_OK) == 0) {
+            *cacheable = (candidate[0] == '/');
+            return candidate;
+        }
+        free(candidate);
+
+        if (end == NULL) {
+            return NULL;
+        }
+        dir = end + 1;
+    }
+}
+
+const char* cmdhashLookup(const char* name)
+{
+    if (bucketCount > 0) {
+        struct cmdEntry* entry = *findSlot(name);
+        if (entry != NULL) {
+            entry->hits++;
+            return entry->path;
+        }
+    }
+
+    int cacheable = 0;
+    char* path = searchPath(name, &cacheable);
+    if (path == NULL) {
+        return NULL;
+    }
+    if (!cacheable) {
+        // Keep the uncached result alive until the next uncached lookup
+        static char* lastUncached;
+        free(lastUncached);
+        lastUncached = path;
+        return path;
+    }
+
+    struct cmdEntry* entry = storeEntry(name, path, 0);
+    if (entry == NULL) {
+        return NULL;
+    }
+    entry->hits = 1;
+    return entry->path;
+}
+
+void cmdhashForget(const char* name)
+{
+    if (bucketCount == 0) {
+        return;
+    }
+    struct cmdEntry** slot = findSlot(name);
+    struct cmdEntry* entry = *slot;
+    if (entry == NULL || entry->pinned) {
+        return;
+    }
+    *slot = entry->next;
+    free(entry->name);
+    free(entry->path);
+    free(entry);
+    entryCount--;
+}
+
+int cmdhashPin(const char* name, const char* path)
+{
+    char* copy = strdup(path);
+    if (copy == NULL) {
+        return -1;
+    }
+    return storeEntry(name, copy, 1) == NULL ? -1 : 0;
+}
+
+void cmdhashClear(void)
+{
+    for (size_t i = 0; i < bucketCount; i++) {
+        struct cmdEntry* entry = buckets[i];
+        while (entry != NULL) {
+            struct cmdEntry* next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        buckets[i] = NULL;
+    }
+    entryCount = 0;
+}
+
+void cmdhashPrint(void)
+{
+    if (entryCount == 0) {
+        printf("hash: hash table empty\n");
+        return;
+    }
+    printf("hits\tcommand\n");
+    for (size_t i = 0; i < bucketCount; i++) {
+        for (struct cmdEntry* entry = buckets[i]; entry != NULL; entry = entry->next) {
+            printf("%4lu\t%s%s\n", entry->hits, entry->path, entry->pinned ? " (pinned)" : "");
+        }
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef CMDHASH_H
+#define CMDHASH_H
+
+/*cmdhashLookup
+* name      a command name without any '/'
+* returns the absolute path the command runs from, searching PATH and
+* remembering the result on first use, or NULL if it is not in PATH
+*/
+const char* cmdhashLookup(const char* name);
+
+/*cmdhashForget
+* name      a command whose remembered path turned out to be stale
+*/
+void cmdhashForget(const char* name);
+
+/*cmdhashPin
+* name      a command name
+* path      the path to always run name from, without searching PATH
+* returns 0 on success, -1 if memory ran out
+*/
+int cmdhashPin(const char* name, const char* path);
+
+/*cmdhashClear
+* Forgets every remembered path, e.g. after PATH changed.
+*/
+void cmdhashClear(void);
+
+/*cmdhashPrint
+* Lists the remembered commands with how often each was used.
+*/
+void cmdhashPrint(void);
+
+#endif
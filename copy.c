@@ -0,0 +1,627 @@
+// File and directory tree copy engine used by the cp builtin
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include "copy.h"
+#include "wspool.h"
+
+#define COPY_CHUNK_SIZE (1 << 30)      // largest request handed to the kernel at once
+#define COPY_BUFFER_SIZE (1 << 20)     // buffer for the read/write fallback
+
+// How a data segment is moved, from cheapest to most expensive
+enum copyMethod {
+    METHOD_COPY_FILE_RANGE,
+    METHOD_SENDFILE,
+    METHOD_BUFFERED
+};
+
+/* Returns 1 if errno after a failed kernel copy means
+ * "this method does not apply here" rather than a real I/O error.
+ */
+static int unsupported(int err)
+{
+    return err == EXDEV || err == EINVAL || err == ENOSYS || err == EOPNOTSUPP ||
+           err == ENOTSUP || err == EBADF || err == ETXTBSY;
+}
+
+/* Buffered fallback. Copies [offset, offset + length) with pread/pwrite,
+ * or until EOF when length is -1. A destination that cannot seek, such as
+ * a pipe, is written at its own position with write.
+ */
+static int copyBuffered(int srcFD, int destFD, off_t offset, off_t length, int seekable,
+                        unsigned long long* copied)
+{
+    char* buffer = malloc(COPY_BUFFER_SIZE);
+    if (buffer == NULL) {
+        return -1;
+    }
+
+    int result = 0;
+    while (length != 0) {
+        size_t want = (length < 0 || length > COPY_BUFFER_SIZE) ? COPY_BUFFER_SIZE : (size_t)length;
+        ssize_t readBytes = (length < 0) ? read(srcFD, buffer, want) : pread(srcFD, buffer, want, offset);
+        if (readBytes == -1) {
+            if (errno == EINTR) continue;
+            result = -1;
+            break;
+        }
+        if (readBytes == 0) {
+            break;
+        }
+
+        for (ssize_t done = 0; done < readBytes;) {
+            ssize_t writeBytes = seekable ? pwrite(destFD, buffer + done, readBytes - done, offset + done)
+                                          : write(destFD, buffer + done, readBytes - done);
+            if (writeBytes == -1) {
+                if (errno == EINTR) continue;
+                free(buffer);
+                return -1;
+            }
+            done += writeBytes;
+        }
+
+        offset += readBytes;
+        *copied += readBytes;
+        if (length > 0) {
+            length -= readBytes;
+        }
+    }
+
+    free(buffer);
+    return result;
+}
+
+/* Copies one data segment, downgrading *method whenever the kernel reports
+ * that the current one is not supported for this pair of files. Only a
+ * seekable destination is positioned at offset; any other is appended to.
+ */
+static int copySegment(int srcFD, int destFD, off_t offset, off_t length, int seekable,
+                       enum copyMethod* method, unsigned long long* copied)
+{
+    while (length > 0) {
+        size_t want = length > COPY_CHUNK_SIZE ? COPY_CHUNK_SIZE : (size_t)length;
+        ssize_t done;
+
+        if (*method == METHOD_COPY_FILE_RANGE) {
+            loff_t inOff = offset, outOff = offset;
+            done = copy_file_range(srcFD, &inOff, destFD, &outOff, want, 0);
+            if (done == -1 && unsupported(errno)) {
+                *method = METHOD_SENDFILE;
+                continue;
+            }
+        } else if (*method == METHOD_SENDFILE) {
+            off_t inOff = offset;
+            if (seekable && lseek(destFD, offset, SEEK_SET) == -1) {
+                return -1;
+            }
+            done = sendfile(destFD, srcFD, &inOff, want);
+            if (done == -1 && unsupported(errno)) {
+                *method = METHOD_BUFFERED;
+                continue;
+            }
+        } else {
+            return copyBuffered(srcFD, destFD, offset, length, seekable, copied);
+        }
+
+        if (done == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (done == 0) {
+            break; // The source shrank underneath us
+        }
+        offset += done;
+        length -= done;
+        *copied += done;
+    }
+    return 0;
+}
+
+/* copyFileData
+ * Tries, in order, to share the extents with a FICLONE reflink, to copy in
+ * the kernel with copy_file_range, then sendfile, and finally falls back to
+ * a large read/write buffer. Only the data segments reported by
+ * SEEK_DATA/SEEK_HOLE are copied, each preallocated with fallocate first,
+ * so holes in sparse files stay holes in the copy.
+ */
+int copyFileData(int srcFD, int destFD, off_t size, struct copyStats* stats)
+{
+    unsigned long long copied = 0;
+    int result;
+
+    // Offsets only mean something for a regular destination; pipes, FIFOs and devices are written in order
+    struct stat destStat;
+    int regular = (fstat(destFD, &destStat) == 0 && S_ISREG(destStat.st_mode));
+
+    if (size < 0) {
+        // Pipes and devices have no extents; stream them until EOF
+        result = copyBuffered(srcFD, destFD, 0, -1, regular, &copied);
+        if (stats != NULL) {
+            stats->buffered++;
+        }
+    } else if (size > 0 && ioctl(destFD, FICLONE, srcFD) == 0) {
+        copied = size;
+        result = 0;
+        if (stats != NULL) {
+            stats->reflinked++;
+        }
+    } else {
+        enum copyMethod method = METHOD_COPY_FILE_RANGE;
+        off_t data = 0;
+        result = 0;
+
+        // Holes can only be preserved when the destination is a regular file
+        int sparse = regular;
+
+        while (data < size) {
+            off_t start = sparse ? lseek(srcFD, data, SEEK_DATA) : data;
+            if (start == -1) {
+                if (errno == ENXIO) {
+                    break; // Only a hole remains
+                }
+                start = data; // No hole support; treat the rest as data
+            }
+            off_t end = sparse ? lseek(srcFD, start, SEEK_HOLE) : size;
+            if (end == -1 || end > size) {
+                end = size;
+            }
+            if (start >= end) {
+                break;
+            }
+
+            // Best effort: reserve the blocks up front to avoid fragmentation
+            if (sparse) {
+                fallocate(destFD, 0, start, end - start);
+            }
+
+            if (copySegment(srcFD, destFD, start, end - start, regular, &method, &copied) == -1) {
+                result = -1;
+                break;
+            }
+            data = end;
+        }
+
+        // Extend over a trailing hole, if any
+        if (result == 0 && sparse && ftruncate(destFD, size) == -1) {
+            result = -1;
+        }
+        if (stats != NULL) {
+            if (method == METHOD_BUFFERED) {
+                stats->buffered++;
+            } else {
+                stats->kernel++;
+            }
+        }
+    }
+
+    if (stats != NULL) {
+        stats->bytes += copied;
+        stats->files++;
+    }
+    return result;
+}
+
+// A directory being copied; shared by every task copying one of its entries
+struct copyDir {
+    struct copyJob* job;
+    int srcFD;              // source directory, or the one command line operands are relative to
+    int destFD;             // destination directory, likewise
+    atomic_int refs;        // the enumerating task plus one per queued entry
+    char* srcPath;          // for messages; NULL for the command line pseudo-directory
+    char* destPath;
+    int mode;               // the mode to give destFD once its entries exist, or -1
+};
+
+// A file or subdirectory waiting to be copied by a worker
+struct copyEntry {
+    struct copyDir* parent;
+    const char* destName;
+    char name[];
+};
+
+// State shared by all tasks of one copyTree call
+struct copyJob {
+    struct wsPool* pool;
+    struct copyStats* workerStats;  // one per worker, summed at the end
+    atomic_int failed;
+    struct copyDir operands;        // pseudo-directory the command line paths are relative to
+    struct stat* roots;             // destination directories created from the command line
+    int rootCount;
+};
+
+static void copyMakeDirTask(void* arg, int worker);
+static void copyFileTask(void* arg, int worker);
+
+// Joins a directory path and an entry name; the pseudo-directory has no path
+static char* joinPath(const char* dir, const char* name)
+{
+    if (dir == NULL) {
+        return strdup(name);
+    }
+    size_t dirLen = strlen(dir), nameLen = strlen(name);
+    char* path = malloc(dirLen + nameLen + 2);
+    if (path != NULL) {
+        memcpy(path, dir, dirLen);
+        path[dirLen] = '/';
+        memcpy(path + dirLen + 1, name, nameLen + 1);
+    }
+    return path;
+}
+
+static void copyError(struct copyJob* job, const char* dir, const char* name, int err)
+{
+    char* path = joinPath(dir, name);
+    fprintf(stderr, "cp: %s: %s\n", path ? path : name, strerror(err));
+    free(path);
+    atomic_store(&job->failed, 1);
+}
+
+static void dirRelease(struct copyDir* dir)
+{
+    if (atomic_fetch_sub(&dir->refs, 1) != 1) {
+        return;
+    }
+    // Every entry has been created, and subdirectories are filled through their own descriptors
+    if (dir->mode != -1 && fchmod(dir->destFD, dir->mode) == -1) {
+        copyError(dir->job, NULL, dir->destPath, errno);
+    }
+    close(dir->srcFD);
+    close(dir->destFD);
+    free(dir->srcPath);
+    free(dir->destPath);
+    free(dir);
+}
+
+static void queueEntry(struct copyDir* dir, const char* name, const char* destName, wsTaskFn fn)
+{
+    size_t nameLen = strlen(name) + 1;
+    size_t destLen = (destName != name) ? strlen(destName) + 1 : 0;
+    struct copyEntry* entry = malloc(sizeof(struct copyEntry) + nameLen + destLen);
+    if (entry == NULL) {
+        copyError(dir->job, dir->srcPath, name, ENOMEM);
+        return;
+    }
+    entry->parent = dir;
+    memcpy(entry->name, name, nameLen);
+    entry->destName = entry->name;
+    if (destLen > 0) {
+        memcpy(entry->name + nameLen, destName, destLen);
+        entry->destName = entry->name + nameLen;
+    }
+    atomic_fetch_add(&dir->refs, 1);
+    wspoolSubmit(dir->job->pool, fn, entry);
+}
+
+static void copySymlink(struct copyDir* dir, const char* name)
+{
+    char target[PATH_MAX];
+    ssize_t len = readlinkat(dir->srcFD, name, target, sizeof(target) - 1);
+    if (len == -1) {
+        copyError(dir->job, dir->srcPath, name, errno);
+        return;
+    }
+    target[len] = '\0';
+    if (symlinkat(target, dir->destFD, name) == -1) {
+        copyError(dir->job, dir->destPath, name, errno);
+    }
+}
+
+/* Reads one source directory and queues a task for each entry.
+ * Consumes the caller's reference to dir.
+ */
+static void copyEnumerate(struct copyDir* dir)
+{
+    int fd = dup(dir->srcFD);
+    DIR* stream = (fd == -1) ? NULL : fdopendir(fd);
+    if (stream == NULL) {
+        copyError(dir->job, NULL, dir->srcPath, errno);
+        if (fd != -1) {
+            close(fd);
+        }
+        dirRelease(dir);
+        return;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(stream)) != NULL) {
+        const char* name = entry->d_name;
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat sb;
+            if (fstatat(dir->srcFD, name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+                copyError(dir->job, dir->srcPath, name, errno);
+                continue;
+            }
+            type = S_ISDIR(sb.st_mode) ? DT_DIR : S_ISREG(sb.st_mode) ? DT_REG :
+                   S_ISLNK(sb.st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+
+        if (type == DT_DIR) {
+            queueEntry(dir, name, name, copyMakeDirTask);
+        } else if (type == DT_REG) {
+            queueEntry(dir, name, name, copyFileTask);
+        } else if (type == DT_LNK) {
+            copySymlink(dir, name);
+        } else {
+            char* path = joinPath(dir->srcPath, name);
+            fprintf(stderr, "cp: skipping special file '%s'\n", path ? path : name);
+            free(path);
+        }
+    }
+    closedir(stream);
+    dirRelease(dir);
+}
+
+/* Opens (creating if needed) a destination directory. Newly created
+ * directories start out as 0700 so the workers can fill them; their real
+ * mode is applied through the descriptor when the last entry is done.
+ */
+static int openDestDir(int parentFD, const char* name, int* created)
+{
+    *created = (mkdirat(parentFD, name, S_IRWXU) == 0);
+    if (!*created && errno != EEXIST) {
+        return -1;
+    }
+    return openat(parentFD, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static struct copyDir* newCopyDir(struct copyJob* job, int srcFD, int destFD, char* srcPath, char* destPath,
+                                  int mode)
+{
+    struct copyDir* dir = malloc(sizeof(struct copyDir));
+    if (dir == NULL) {
+        return NULL;
+    }
+    dir->job = job;
+    dir->srcFD = srcFD;
+    dir->destFD = destFD;
+    atomic_init(&dir->refs, 1);
+    dir->srcPath = srcPath;
+    dir->destPath = destPath;
+    dir->mode = mode;
+    return dir;
+}
+
+static void copyMakeDirTask(void* arg, int worker)
+{
+    (void)worker;
+    struct copyEntry* entry = arg;
+    struct copyDir* parent = entry->parent;
+    struct copyJob* job = parent->job;
+    int srcFD = -1, destFD = -1;
+    char* srcPath = NULL;
+    char* destPath = NULL;
+
+    srcFD = openat(parent->srcFD, entry->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat sb;
+    if (srcFD == -1 || fstat(srcFD, &sb) == -1) {
+        copyError(job, parent->srcPath, entry->name, errno);
+        goto out;
+    }
+
+    // Never descend into a directory that is one of our own destinations
+    for (int i = 0; i < job->rootCount; i++) {
+        if (job->roots[i].st_dev == sb.st_dev && job->roots[i].st_ino == sb.st_ino) {
+            char* path = joinPath(parent->srcPath, entry->name);
+            fprintf(stderr, "cp: cannot copy a directory, '%s', into itself\n", path ? path : entry->name);
+            free(path);
+            atomic_store(&job->failed, 1);
+            goto out;
+        }
+    }
+
+    int created;
+    destFD = openDestDir(parent->destFD, entry->destName, &created);
+    srcPath = joinPath(parent->srcPath, entry->name);
+    destPath = joinPath(parent->destPath, entry->destName);
+    if (destFD == -1 || srcPath == NULL || destPath == NULL) {
+        copyError(job, parent->destPath, entry->destName, destFD == -1 ? errno : ENOMEM);
+        goto out;
+    }
+
+    struct copyDir* dir = newCopyDir(job, srcFD, destFD, srcPath, destPath, created ? (int)(sb.st_mode & 07777) : -1);
+    if (dir == NULL) {
+        copyError(job, parent->destPath, entry->destName, ENOMEM);
+        goto out;
+    }
+    dirRelease(parent);
+    free(entry);
+    copyEnumerate(dir);
+    return;
+
+out:
+    if (srcFD != -1) close(srcFD);
+    if (destFD != -1) close(destFD);
+    free(srcPath);
+    free(destPath);
+    dirRelease(parent);
+    free(entry);
+}
+
+static void copyFileTask(void* arg, int worker)
+{
+    struct copyEntry* entry = arg;
+    struct copyDir* parent = entry->parent;
+    struct copyJob* job = parent->job;
+
+    // Symlinks named on the command line are followed, those found in the tree are not
+    int noFollow = (parent == &job->operands) ? 0 : O_NOFOLLOW;
+    int srcFD = openat(parent->srcFD, entry->name, O_RDONLY | noFollow | O_CLOEXEC);
+    struct stat sb;
+    if (srcFD == -1 || fstat(srcFD, &sb) == -1) {
+        copyError(job, parent->srcPath, entry->name, errno);
+    } else {
+        int destFD = openat(parent->destFD, entry->destName, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, sb.st_mode & 07777);
+        if (destFD == -1) {
+            copyError(job, parent->destPath, entry->destName, errno);
+        } else {
+            if (copyFileData(srcFD, destFD, S_ISREG(sb.st_mode) ? sb.st_size : -1, &job->workerStats[worker]) == -1) {
+                copyError(job, parent->srcPath, entry->name, errno);
+            }
+            close(destFD);
+        }
+    }
+    if (srcFD != -1) {
+        close(srcFD);
+    }
+
+    if (parent != &job->operands) {
+        dirRelease(parent);
+    }
+    free(entry);
+}
+
+/* copyTree
+ * Destination directories for the operands are created up front on the
+ * calling thread; from there every directory is enumerated by a worker
+ * task that queues one task per entry, so both the walk and the copies
+ * spread over the pool. Directories are opened relative to their parent's
+ * descriptor and created with mkdirat, and each gets its mode with fchmod
+ * once its last entry is done, so no path is ever resolved from the top.
+ */
+int copyTree(int dirFD, char** sources, int count, const char* dest, int intoDir, int recursive,
+             int threads, struct copyStats* stats)
+{
+    struct copyJob job = {0};
+    atomic_init(&job.failed, 0);
+    job.operands.job = &job;
+    job.operands.srcFD = dirFD;
+    job.operands.destFD = dirFD;
+    job.operands.mode = -1;
+    atomic_init(&job.operands.refs, 1);
+
+    job.pool = wspoolCreate(threads);
+    job.workerStats = calloc(threads, sizeof(struct copyStats));
+    job.roots = calloc(count, sizeof(struct stat));
+    struct copyDir** rootDirs = calloc(count, sizeof(struct copyDir*));
+    char** targets = calloc(count, sizeof(char*));
+    if (job.pool == NULL || job.workerStats == NULL || job.roots == NULL || rootDirs == NULL || targets == NULL) {
+        perror("cp");
+        if (job.pool != NULL) {
+            wspoolDestroy(job.pool);
+        }
+        free(job.workerStats);
+        free(job.roots);
+        free(rootDirs);
+        free(targets);
+        return -1;
+    }
+
+    // First pass: validate the operands and create the destination roots
+    for (int i = 0; i < count; i++) {
+        const char* src = sources[i];
+        struct stat srcStat, destStat;
+        if (fstatat(dirFD, src, &srcStat, 0) == -1) {
+            copyError(&job, NULL, src, errno);
+            continue;
+        }
+
+        if (intoDir) {
+            size_t len = strlen(src);
+            while (len > 1 && src[len - 1] == '/') {
+                len--;
+            }
+            char* base = strndup(src, len);
+            char* slash = base ? strrchr(base, '/') : NULL;
+            targets[i] = base ? joinPath(dest, slash ? slash + 1 : base) : NULL;
+            free(base);
+        } else {
+            targets[i] = strdup(dest);
+        }
+        if (targets[i] == NULL) {
+            copyError(&job, NULL, src, ENOMEM);
+            continue;
+        }
+
+        if (fstatat(dirFD, targets[i], &destStat, 0) == 0 && srcStat.st_dev == destStat.st_dev && srcStat.st_ino == destStat.st_ino) {
+            fprintf(stderr, "cp: '%s' and '%s' are the same file\n", src, targets[i]);
+            atomic_store(&job.failed, 1);
+            free(targets[i]);
+            targets[i] = NULL;
+            continue;
+        }
+
+        if (!S_ISDIR(srcStat.st_mode)) {
+            continue;
+        }
+        if (!recursive) {
+            fprintf(stderr, "cp: -r not specified; omitting directory '%s'\n", src);
+            atomic_store(&job.failed, 1);
+            free(targets[i]);
+            targets[i] = NULL;
+            continue;
+        }
+
+        int created;
+        int srcFD = openat(dirFD, src, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int destFD = (srcFD == -1) ? -1 : openDestDir(dirFD, targets[i], &created);
+        if (srcFD == -1 || destFD == -1 || fstat(destFD, &job.roots[job.rootCount]) == -1) {
+            copyError(&job, NULL, srcFD == -1 ? src : targets[i], errno);
+            if (srcFD != -1) close(srcFD);
+            if (destFD != -1) close(destFD);
+            free(targets[i]);
+            targets[i] = NULL;
+            continue;
+        }
+        job.rootCount++;
+
+        rootDirs[i] = newCopyDir(&job, srcFD, destFD, strdup(src), targets[i],
+                                 created ? (int)(srcStat.st_mode & 07777) : -1);
+        if (rootDirs[i] == NULL) {
+            copyError(&job, NULL, src, ENOMEM);
+            close(srcFD);
+            close(destFD);
+            free(targets[i]);
+            targets[i] = NULL;
+            continue;
+        }
+        targets[i] = NULL; // now owned by the directory
+    }
+
+    // Second pass: hand everything to the pool
+    for (int i = 0; i < count; i++) {
+        if (rootDirs[i] != NULL) {
+            copyEnumerate(rootDirs[i]);
+        } else if (targets[i] != NULL) {
+            queueEntry(&job.operands, sources[i], targets[i], copyFileTask);
+        }
+    }
+    wspoolWait(job.pool);
+    wspoolDestroy(job.pool);
+
+    for (int i = 0; i < threads; i++) {
+        if (stats != NULL) {
+            stats->bytes += job.workerStats[i].bytes;
+            stats->files += job.workerStats[i].files;
+            stats->reflinked += job.workerStats[i].reflinked;
+            stats->kernel += job.workerStats[i].kernel;
+            stats->buffered += job.workerStats[i].buffered;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        free(targets[i]);
+    }
+    free(targets);
+    free(rootDirs);
+    free(job.roots);
+    free(job.workerStats);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
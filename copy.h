@@ -0,0 +1,46 @@
+#ifndef COPY_H
+#define COPY_H
+
+#include <sys/types.h>
+
+/* copyStats
+* Accumulates what copyFileData did, so cp -v can report throughput.
+* bytes       bytes of file data transferred (holes are not counted)
+* files       number of files copied
+* reflinked   files that were cloned with FICLONE
+* kernel      files copied in-kernel with copy_file_range or sendfile
+* buffered    files that needed the read/write fallback
+*/
+struct copyStats {
+    unsigned long long bytes;
+    unsigned long long files;
+    unsigned long long reflinked;
+    unsigned long long kernel;
+    unsigned long long buffered;
+};
+
+/*copyFileData
+* srcFD       a descriptor open for reading, positioned at offset 0
+* destFD      a descriptor open for writing on an empty destination file
+* size        the size of the source, or -1 if it is not a regular file
+* stats       statistics to update, may be NULL
+* returns 0 on success, -1 with errno set on failure
+*/
+int copyFileData(int srcFD, int destFD, off_t size, struct copyStats* stats);
+
+/*copyTree
+* dirFD       the directory relative paths are looked up from, or AT_FDCWD
+* sources     the paths to copy
+* count       the number of sources
+* dest        the destination path
+* intoDir     nonzero to copy each source to dest/<basename of source>,
+*             zero to copy the single source to dest itself
+* recursive   nonzero to copy directories and their contents
+* threads     the number of worker threads to copy with
+* stats       statistics to update, may be NULL
+* returns 0 on success, -1 if anything could not be copied (already reported)
+*/
+int copyTree(int dirFD, char** sources, int count, const char* dest, int intoDir, int recursive,
+             int threads, struct copyStats* stats);
+
+#endif
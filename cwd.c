@@ -0,0 +1,47 @@
+// The shell's current directory
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "cwd.h"
+
+static int dirFD = -1;
+static char* path;
+
+int cwdFD(void)
+{
+    if (dirFD == -1) {
+        dirFD = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+    }
+    return (dirFD == -1) ? AT_FDCWD : dirFD;
+}
+
+int cwdChange(const char* target)
+{
+    int fd = openat(cwdFD(), target, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    // fchdir checks search permission, which an O_PATH open does not
+    if (fchdir(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (dirFD != -1) {
+        close(dirFD);
+    }
+    dirFD = fd;
+    free(path);
+    path = NULL;
+    return 0;
+}
+
+const char* cwdPath(void)
+{
+    if (path == NULL) {
+        path = getcwd(NULL, 0);
+    }
+    return path;
+}
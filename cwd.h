@@ -0,0 +1,28 @@
+#ifndef CWD_H
+#define CWD_H
+
+/* The shell keeps its current directory open as an O_PATH descriptor, and
+ * the builtins look paths up relative to it with openat, fstatat, statx and
+ * utimensat. cd moves that descriptor and the process's own directory
+ * together, so commands the shell starts begin in the same place.
+ */
+
+/*cwdFD
+* returns the descriptor of the current directory, usable as the dirfd of any
+*         *at call; AT_FDCWD if the directory could not be opened
+*/
+int cwdFD(void);
+
+/*cwdChange
+* path      the directory to change to, relative to the current one
+* returns 0, or -1 with errno set and the current directory unchanged
+*/
+int cwdChange(const char* path);
+
+/*cwdPath
+* returns the absolute path of the current directory, kept until the next
+*         cwdChange, or NULL with errno set
+*/
+const char* cwdPath(void);
+
+#endif
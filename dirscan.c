@@ -0,0 +1,63 @@
+// Batched directory reading with getdents64
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <errno.h>
+#include <dirent.h>
+#include "dirscan.h"
+
+#define DIRSCAN_BUFFER_SIZE (256 * 1024)
+
+// Layout of the records getdents64 fills the buffer with
+struct linuxDirent64 {
+    ino64_t d_ino;
+    off64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+int dirscanOpen(struct dirScan* scan, int fd)
+{
+    scan->fd = fd;
+    scan->pos = 0;
+    scan->len = 0;
+    scan->size = DIRSCAN_BUFFER_SIZE;
+    scan->buffer = malloc(scan->size);
+    return scan->buffer == NULL ? -1 : 0;
+}
+
+void dirscanReset(struct dirScan* scan, int fd)
+{
+    scan->fd = fd;
+    scan->pos = 0;
+    scan->len = 0;
+}
+
+int dirscanNext(struct dirScan* scan, const char** name, unsigned char* type)
+{
+    if (scan->pos >= scan->len) {
+        ssize_t len;
+        do {
+            len = getdents64(scan->fd, scan->buffer, scan->size);
+        } while (len == -1 && errno == EINTR);
+        if (len <= 0) {
+            return (int)len;
+        }
+        scan->len = len;
+        scan->pos = 0;
+    }
+
+    struct linuxDirent64* entry = (struct linuxDirent64*)(scan->buffer + scan->pos);
+    scan->pos += entry->d_reclen;
+    *name = entry->d_name;
+    *type = entry->d_type;
+    return 1;
+}
+
+void dirscanClose(struct dirScan* scan)
+{
+    free(scan->buffer);
+    scan->buffer = NULL;
+}
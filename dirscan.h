@@ -0,0 +1,45 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+
+#include <stddef.h>
+
+/* dirScan
+* Reads a directory in large getdents64 batches, so listing a directory
+* with many entries takes a handful of system calls.
+*/
+struct dirScan {
+    int fd;         // the directory being read; not owned by the scan
+    char* buffer;   // the current batch of raw records
+    size_t size;    // capacity of buffer
+    long pos;       // offset of the next record in buffer
+    long len;       // bytes of records in buffer
+};
+
+/*dirscanOpen
+* scan      the scan to initialise
+* fd        a descriptor open on a directory, positioned at its start
+* returns 0 on success, -1 with errno set on failure
+*/
+int dirscanOpen(struct dirScan* scan, int fd);
+
+/*dirscanReset
+* scan      an open scan whose directory is done with
+* fd        another directory to read with the same buffer, positioned at its start
+*/
+void dirscanReset(struct dirScan* scan, int fd);
+
+/*dirscanNext
+* scan      an open scan
+* name      set to the entry name, valid until the next call
+* type      set to the entry's DT_* type, which may be DT_UNKNOWN
+* returns 1 if an entry was read, 0 at the end of the directory,
+* -1 with errno set on failure. "." and ".." are returned like any other entry.
+*/
+int dirscanNext(struct dirScan* scan, const char** name, unsigned char* type);
+
+/*dirscanClose
+* scan      the scan to release; the directory descriptor is left open
+*/
+void dirscanClose(struct dirScan* scan);
+
+#endif
@@ -0,0 +1,615 @@
+// Fixed string and regular expression search for the grep builtin
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "grep.h"
+#include "outbuf.h"
+#include "wspool.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define GREP_X86 1
+#endif
+
+#define GREP_READ_SIZE (1 << 20)    // first block read from a pipe; grows for longer lines
+#define GREP_WINDOW_PER_THREAD 2    // files searched ahead of the one being printed, per thread
+
+// A compiled pattern
+struct grepPattern {
+    const char* text;
+    size_t len;
+    int ignoreCase;
+    unsigned char first;        // text[0], in lower case with -i
+    unsigned char last;         // text[len - 1], likewise
+    unsigned char firstFold;    // 0x20 if first is a letter that matches in either case, else 0
+    unsigned char lastFold;
+    int isRegex;
+    regex_t regex;
+};
+
+typedef const char* (*grepFindFn)(const struct grepPattern* p, const char* s, const char* end);
+typedef size_t (*grepCountFn)(const char* s, const char* end);
+
+// The fastest versions this CPU can run, picked on the first search
+static grepFindFn findFixed;
+static grepCountFn countLines;
+
+// Where the selected lines go: straight to outWrite, or kept until earlier files are printed
+struct grepOutput {
+    int direct;
+    char* data;
+    size_t len;
+    size_t capacity;
+};
+
+// State shared by every file of one grepFiles call
+struct grepJob {
+    const struct grepOptions* opts;
+    struct grepPattern pattern;
+    int dirFD;
+    int showNames;
+    pthread_mutex_t lock;       // guards done in the tasks
+    pthread_cond_t finished;
+};
+
+// The progress through one file
+struct grepScan {
+    const struct grepJob* job;
+    const char* name;               // printed before each line, or NULL
+    struct grepOutput* out;
+    unsigned long long line;        // lines before the current position
+    unsigned long long selected;
+};
+
+// One file searched on the pool
+struct grepTask {
+    struct grepJob* job;
+    const char* name;
+    struct grepOutput out;
+    int status;
+    int done;
+};
+
+static unsigned char grepLower(unsigned char c)
+{
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+/*
+* grepVerify is a helper function that compares a candidate whose first and
+* last bytes already match with the rest of the pattern.
+*/
+static int grepVerify(const struct grepPattern* p, const char* s)
+{
+    if (p->len <= 2) {
+        return 1;
+    }
+    if (!p->ignoreCase) {
+        return memcmp(s + 1, p->text + 1, p->len - 2) == 0;
+    }
+    for (size_t i = 1; i + 1 < p->len; i++) {
+        if (grepLower(s[i]) != grepLower(p->text[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static const char* grepFindScalar(const struct grepPattern* p, const char* s, const char* end)
+{
+    if (!p->ignoreCase) {
+        return memmem(s, end - s, p->text, p->len);
+    }
+    for (; (size_t)(end - s) >= p->len; s++) {
+        if (((unsigned char)s[0] | p->firstFold) == p->first &&
+            ((unsigned char)s[p->len - 1] | p->lastFold) == p->last && grepVerify(p, s)) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+static size_t grepCountScalar(const char* s, const char* end)
+{
+    size_t count = 0;
+    for (; s < end && (s = memchr(s, '\n', end - s)) != NULL; s++) {
+        count++;
+    }
+    return count;
+}
+
+#ifdef GREP_X86
+/* The vector searches compare a block of candidate positions at once: the
+ * byte at each position with the pattern's first byte and the byte len - 1
+ * further on with its last byte. Only positions where both agree are
+ * compared in full. With -i a letter is compared with bit 0x20 set on both
+ * sides, which folds exactly its two cases together.
+ */
+static const char* grepFindSSE2(const struct grepPattern* p, const char* s, const char* end)
+{
+    const __m128i first = _mm_set1_epi8((char)p->first);
+    const __m128i last = _mm_set1_epi8((char)p->last);
+    const __m128i firstFold = _mm_set1_epi8((char)p->firstFold);
+    const __m128i lastFold = _mm_set1_epi8((char)p->lastFold);
+    size_t tail = p->len - 1;
+    for (; (size_t)(end - s) >= tail + 16; s += 16) {
+        __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i*)s), firstFold);
+        __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i*)(s + tail)), lastFold);
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            const char* candidate = s + __builtin_ctz(mask);
+            if (grepVerify(p, candidate)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return grepFindScalar(p, s, end);
+}
+
+__attribute__((target("avx2")))
+static const char* grepFindAVX2(const struct grepPattern* p, const char* s, const char* end)
+{
+    const __m256i first = _mm256_set1_epi8((char)p->first);
+    const __m256i last = _mm256_set1_epi8((char)p->last);
+    const __m256i firstFold = _mm256_set1_epi8((char)p->firstFold);
+    const __m256i lastFold = _mm256_set1_epi8((char)p->lastFold);
+    size_t tail = p->len - 1;
+    for (; (size_t)(end - s) >= tail + 32; s += 32) {
+        __m256i a = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)s), firstFold);
+        __m256i b = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(s + tail)), lastFold);
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            const char* candidate = s + __builtin_ctz(mask);
+            if (grepVerify(p, candidate)) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return grepFindSSE2(p, s, end);
+}
+
+/* The vector line counts subtract each newline comparison (all ones, so -1)
+ * from byte counters, and add the counters into 64-bit totals with psadbw
+ * before any of them can overflow.
+ */
+static size_t grepCountSSE2(const char* s, const char* end)
+{
+    const __m128i newline = _mm_set1_epi8('\n');
+    __m128i total = _mm_setzero_si128();
+    while (end - s >= 16) {
+        __m128i counts = _mm_setzero_si128();
+        for (int i = 0; i < 255 && end - s >= 16; i++, s += 16) {
+            counts = _mm_sub_epi8(counts, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)s), newline));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(counts, _mm_setzero_si128()));
+    }
+    size_t count = (size_t)_mm_cvtsi128_si64(total) + (size_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total));
+    return count + grepCountScalar(s, end);
+}
+
+__attribute__((target("avx2")))
+static size_t grepCountAVX2(const char* s, const char* end)
+{
+    const __m256i newline = _mm256_set1_epi8('\n');
+    __m256i total = _mm256_setzero_si256();
+    while (end - s >= 32) {
+        __m256i counts = _mm256_setzero_si256();
+        for (int i = 0; i < 255 && end - s >= 32; i++, s += 32) {
+            counts = _mm256_sub_epi8(counts, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)s), newline));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counts, _mm256_setzero_si256()));
+    }
+    size_t count = (size_t)_mm256_extract_epi64(total, 0) + (size_t)_mm256_extract_epi64(total, 1) +
+                   (size_t)_mm256_extract_epi64(total, 2) + (size_t)_mm256_extract_epi64(total, 3);
+    return count + grepCountSSE2(s, end);
+}
+#endif
+
+static void grepInit(void)
+{
+    if (findFixed != NULL) {
+        return;
+    }
+#ifdef GREP_X86
+    if (__builtin_cpu_supports("avx2")) {
+        findFixed = grepFindAVX2;
+        countLines = grepCountAVX2;
+    } else {
+        findFixed = grepFindSSE2;
+        countLines = grepCountSSE2;
+    }
+#else
+    findFixed = grepFindScalar;
+    countLines = grepCountScalar;
+#endif
+}
+
+/*
+* grepCompile is a helper function that prepares the pattern. Without -F, only
+* a pattern that has characters special in a basic regular expression goes to
+* regcomp; any other is searched as a string.
+* returns 0, or -1 if the expression is invalid (already reported)
+*/
+static int grepCompile(struct grepPattern* p, const struct grepOptions* opts)
+{
+    memset(p, 0, sizeof(*p));
+    p->text = opts->pattern;
+    p->len = strlen(opts->pattern);
+    p->ignoreCase = opts->ignoreCase;
+    if (!opts->fixed && strpbrk(p->text, ".[]*^$\\") != NULL) {
+        int error = regcomp(&p->regex, p->text, REG_NOSUB | (opts->ignoreCase ? REG_ICASE : 0));
+        if (error != 0) {
+            char message[256];
+            regerror(error, &p->regex, message, sizeof(message));
+            fprintf(stderr, "grep: %s\n", message);
+            return -1;
+        }
+        p->isRegex = 1;
+        return 0;
+    }
+    if (p->len > 0) {
+        unsigned char first = p->text[0], last = p->text[p->len - 1];
+        p->first = opts->ignoreCase ? grepLower(first) : first;
+        p->last = opts->ignoreCase ? grepLower(last) : last;
+        p->firstFold = (opts->ignoreCase && p->first >= 'a' && p->first <= 'z') ? 0x20 : 0;
+        p->lastFold = (opts->ignoreCase && p->last >= 'a' && p->last <= 'z') ? 0x20 : 0;
+    }
+    return 0;
+}
+
+/*
+* grepFind is a helper function that returns where the next match in [s, end)
+* is, or NULL. A match never spans lines, since a pattern has no newline;
+* a regular expression match is reported at the start of its line.
+*/
+static const char* grepFind(const struct grepPattern* p, const char* s, const char* end)
+{
+    if (p->isRegex) {
+        while (s < end) {
+            const char* lineEnd = memchr(s, '\n', end - s);
+            if (lineEnd == NULL) {
+                lineEnd = end;
+            }
+            regmatch_t match = { 0, lineEnd - s };
+            if (regexec(&p->regex, s, 1, &match, REG_STARTEND) == 0) {
+                return s;
+            }
+            s = lineEnd + 1;
+        }
+        return NULL;
+    }
+    if (p->len == 0) {
+        return s;
+    }
+    if (p->len == 1 && p->firstFold == 0) {
+        return memchr(s, p->first, end - s);
+    }
+    return findFixed(p, s, end);
+}
+
+static void grepWrite(struct grepOutput* out, const char* data, size_t len)
+{
+    if (out->direct) {
+        outWrite(data, len);
+        return;
+    }
+    if (out->len + len > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity : 64 * 1024;
+        while (capacity < out->len + len) {
+            capacity *= 2;
+        }
+        char* grown = realloc(out->data, capacity);
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+// Writes one selected line, without its newline in [line, lineEnd), with its prefixes
+static void grepLine(struct grepScan* scan, const char* line, const char* lineEnd)
+{
+    if (scan->name != NULL) {
+        grepWrite(scan->out, scan->name, strlen(scan->name));
+        grepWrite(scan->out, ":", 1);
+    }
+    if (scan->job->opts->lineNumbers) {
+        char number[24];
+        size_t len = outFormatUnsigned(number, scan->line);
+        number[len++] = ':';
+        grepWrite(scan->out, number, len);
+    }
+    grepWrite(scan->out, line, lineEnd - line);
+    grepWrite(scan->out, "\n", 1);
+}
+
+/*
+* grepUnmatched is a helper function that selects the lines of [s, end), none
+* of which match, for -v. Without prefixes to add they are copied as one block.
+*/
+static void grepUnmatched(struct grepScan* scan, const char* s, const char* end)
+{
+    const struct grepOptions* opts = scan->job->opts;
+    if (s == end) {
+        return;
+    }
+    if (opts->count || (!opts->lineNumbers && scan->name == NULL)) {
+        if (!opts->count) {
+            grepWrite(scan->out, s, end - s);
+            if (end[-1] != '\n') {
+                grepWrite(scan->out, "\n", 1);
+            }
+            scan->selected++;
+            return;
+        }
+        size_t lines = countLines(s, end) + (end[-1] != '\n');
+        scan->selected += lines;
+        scan->line += lines;
+        return;
+    }
+    while (s < end) {
+        const char* newline = memchr(s, '\n', end - s);
+        const char* lineEnd = newline ? newline : end;
+        scan->line++;
+        scan->selected++;
+        grepLine(scan, s, lineEnd);
+        s = newline ? newline + 1 : end;
+    }
+}
+
+/*
+* grepBlock is a helper function that searches whole lines; only the last
+* block of a file may end without a newline. Rather than looking at every
+* line, it jumps from match to match, and finds the line around each match
+* with memrchr and memchr.
+*/
+static void grepBlock(struct grepScan* scan, const char* s, const char* end)
+{
+    const struct grepOptions* opts = scan->job->opts;
+    while (s < end) {
+        const char* match = grepFind(&scan->job->pattern, s, end);
+        if (match == NULL) {
+            if (opts->invert) {
+                grepUnmatched(scan, s, end);
+            } else if (opts->lineNumbers) {
+                scan->line += countLines(s, end);
+            }
+            return;
+        }
+        const char* before = memrchr(s, '\n', match - s);
+        const char* lineStart = before ? before + 1 : s;
+        const char* newline = memchr(match, '\n', end - match);
+        const char* lineEnd = newline ? newline : end;
+
+        if (opts->invert) {
+            grepUnmatched(scan, s, lineStart);
+            scan->line++;
+        } else {
+            if (opts->lineNumbers) {
+                scan->line += countLines(s, lineStart) + 1;
+            }
+            scan->selected++;
+            if (!opts->count) {
+                grepLine(scan, lineStart, lineEnd);
+            }
+        }
+        s = newline ? newline + 1 : end;
+    }
+}
+
+/*
+* grepStream is a helper function that searches what can only be read, such
+* as a pipe, a block of complete lines at a time.
+* returns 0, or -1 with errno set if reading failed
+*/
+static int grepStream(struct grepScan* scan, int fd)
+{
+    size_t capacity = GREP_READ_SIZE, len = 0;
+    char* buffer = malloc(capacity);
+    if (buffer == NULL) {
+        return -1;
+    }
+    int result = 0;
+    for (;;) {
+        if (len == capacity) {
+            // A line longer than the buffer
+            char* grown = realloc(buffer, capacity * 2);
+            if (grown == NULL) {
+                result = -1;
+                break;
+            }
+            buffer = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, buffer + len, capacity - len);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            result = (int)n;
+            break;
+        }
+        // What was kept from the last block has no newline, so only the new bytes need a look
+        const char* newline = memrchr(buffer + len, '\n', n);
+        len += n;
+        if (newline != NULL) {
+            size_t complete = newline + 1 - buffer;
+            grepBlock(scan, buffer, buffer + complete);
+            memmove(buffer, buffer + complete, len - complete);
+            len -= complete;
+        }
+    }
+    if (result == 0 && len > 0) {
+        grepBlock(scan, buffer, buffer + len);
+    }
+    int error = errno;
+    free(buffer);
+    errno = error;
+    return result;
+}
+
+/*
+* grepOne is a helper function that searches one file, or standard input for NULL.
+* returns 0 if a line was selected, 1 if none was, 2 if the file could not be read
+*/
+static int grepOne(const struct grepJob* job, const char* name, struct grepOutput* out)
+{
+    const char* shown = name ? name : "(standard input)";
+    struct grepScan scan = { job, job->showNames ? shown : NULL, out, 0, 0 };
+    int fd = (name == NULL) ? STDIN_FILENO : openat(job->dirFD, name, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "grep: %s: %s\n", shown, strerror(errno));
+        return 2;
+    }
+
+    int status = 0;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        st.st_mode = 0;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "grep: %s: Is a directory\n", shown);
+        status = 2;
+    } else if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (map != MAP_FAILED) {
+            grepBlock(&scan, map, (const char*)map + st.st_size);
+            munmap(map, st.st_size);
+        } else if (grepStream(&scan, fd) == -1) {
+            status = 2;
+        }
+    } else if (grepStream(&scan, fd) == -1) {
+        status = 2;
+    }
+    if (status == 2 && errno != 0 && !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "grep: %s: %s\n", shown, strerror(errno));
+    }
+    if (name != NULL) {
+        close(fd);
+    }
+
+    if (job->opts->count && status == 0) {
+        char count[24];
+        size_t len = outFormatUnsigned(count, scan.selected);
+        count[len++] = '\n';
+        if (scan.name != NULL) {
+            grepWrite(out, scan.name, strlen(scan.name));
+            grepWrite(out, ":", 1);
+        }
+        grepWrite(out, count, len);
+    }
+    return (status == 2) ? 2 : (scan.selected > 0) ? 0 : 1;
+}
+
+// Folds the status of one more file into the overall one: errors win, then matches
+static int grepMerge(int status, int file)
+{
+    return (status == 2 || file == 2) ? 2 : (status == 0 || file == 0) ? 0 : 1;
+}
+
+static void grepTaskRun(void* arg, int worker)
+{
+    (void)worker;
+    struct grepTask* task = arg;
+    task->status = grepOne(task->job, task->name, &task->out);
+    pthread_mutex_lock(&task->job->lock);
+    task->done = 1;
+    pthread_cond_broadcast(&task->job->finished);
+    pthread_mutex_unlock(&task->job->lock);
+}
+
+/*
+* grepParallel is a helper function that searches files on a pool while the
+* calling thread prints each file's lines in order, as soon as it and every
+* file before it are done. Only a window of files runs ahead, which bounds
+* how much output is held.
+* returns the merged status, or -1 if no pool could be started
+*/
+static int grepParallel(struct grepJob* job, char* const* files, int count)
+{
+    int threads = job->opts->threads;
+    struct grepTask* tasks = calloc(count, sizeof(struct grepTask));
+    struct wsPool* pool = (tasks != NULL) ? wspoolCreate(threads) : NULL;
+    if (pool == NULL) {
+        free(tasks);
+        return -1;
+    }
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->finished, NULL);
+
+    int window = threads * GREP_WINDOW_PER_THREAD;
+    int next = 0;
+    for (; next < count && next < window; next++) {
+        tasks[next] = (struct grepTask){ job, files[next], { 0 }, 0, 0 };
+        wspoolSubmit(pool, grepTaskRun, &tasks[next]);
+    }
+    int status = 1;
+    for (int i = 0; i < count; i++) {
+        pthread_mutex_lock(&job->lock);
+        while (!tasks[i].done) {
+            pthread_cond_wait(&job->finished, &job->lock);
+        }
+        pthread_mutex_unlock(&job->lock);
+        outWrite(tasks[i].out.data, tasks[i].out.len);
+        free(tasks[i].out.data);
+        status = grepMerge(status, tasks[i].status);
+        if (next < count) {
+            tasks[next] = (struct grepTask){ job, files[next], { 0 }, 0, 0 };
+            wspoolSubmit(pool, grepTaskRun, &tasks[next]);
+            next++;
+        }
+    }
+    wspoolWait(pool);
+    wspoolDestroy(pool);
+    pthread_cond_destroy(&job->finished);
+    pthread_mutex_destroy(&job->lock);
+    free(tasks);
+    return status;
+}
+
+int grepFiles(int dirFD, char* const* files, int count, const struct grepOptions* opts)
+{
+    grepInit();
+    struct grepJob job;
+    memset(&job, 0, sizeof(job));
+    job.opts = opts;
+    job.dirFD = dirFD;
+    job.showNames = (count > 1);
+    if (grepCompile(&job.pattern, opts) == -1) {
+        return 2;
+    }
+
+    int status = -1;
+    if (count > 1 && opts->threads > 1) {
+        status = grepParallel(&job, files, count);
+    }
+    if (status == -1) {
+        // One file, or no pool: everything goes straight out
+        struct grepOutput out = { 1, NULL, 0, 0 };
+        status = (count == 0) ? grepOne(&job, NULL, &out) : 1;
+        for (int i = 0; i < count; i++) {
+            status = grepMerge(status, grepOne(&job, files[i], &out));
+        }
+    }
+    if (job.pattern.isRegex) {
+        regfree(&job.pattern.regex);
+    }
+    return status;
+}
@@ -0,0 +1,42 @@
+#ifndef GREP_H
+#define GREP_H
+
+/* The search engine behind the grep builtin. Regular files are mapped and
+ * searched in place; pipes and terminals are read in large blocks. A fixed
+ * string is found with a vector filter on its first and last bytes, chosen
+ * at run time between AVX2, SSE2 and plain C, and each candidate is then
+ * compared in full. A pattern with regular expression characters is matched
+ * line by line with regexec unless fixed is set.
+ */
+
+/* grepOptions
+* pattern       the string or basic regular expression to look for
+* fixed         nonzero for -F: the pattern is always a plain string
+* ignoreCase    nonzero for -i: ASCII letters match either case
+* count         nonzero for -c: print how many lines were selected instead of the lines
+* lineNumbers   nonzero for -n: put the line number in front of each line
+* invert        nonzero for -v: select the lines that do not match
+* threads       how many files to search at once
+*/
+struct grepOptions {
+    const char* pattern;
+    int fixed;
+    int ignoreCase;
+    int count;
+    int lineNumbers;
+    int invert;
+    int threads;
+};
+
+/*grepFiles
+* dirFD     the directory relative file names are opened from, or AT_FDCWD
+* files     the files to search; with count 0, standard input is searched
+* count     the number of files; with more than one, each line or count
+*           is preceded by its file name
+* opts      what to look for and how to print it
+* returns 0 if any line was selected, 1 if none was, or 2 if the pattern
+*         was invalid or a file could not be read (already reported)
+*/
+int grepFiles(int dirFD, char* const* files, int count, const struct grepOptions* opts);
+
+#endif
@@ -0,0 +1,316 @@
+// Persistent command history
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "history.h"
+#include "outbuf.h"
+#include "vars.h"
+
+#define HISTORY_FILE ".myshell_history"
+
+// A command added by this shell
+struct historyLine {
+    char* text;
+    size_t len;
+};
+
+/* history
+* All commands are numbered from 0: first the complete lines of the file as
+* it was mapped at startup, then the commands this shell added.
+* fd          the history file, open for appending, or -1
+* map         the file as it was at startup, or NULL if it was empty
+* mapSize     the size of map
+* indexed     nonzero once offsets, byFirst and buckets have been built
+* offsets     where each line of map starts, plus one entry past the last line
+* mapped      the number of complete lines in map
+* byFirst     the line numbers grouped by their first byte, ascending in each group
+* buckets     where the group of each first byte starts in byFirst; 257 entries
+* added       the commands added by this shell, oldest first
+*/
+static struct {
+    int fd;
+    const char* map;
+    size_t mapSize;
+    int indexed;
+    uint64_t* offsets;
+    size_t mapped;
+    uint32_t* byFirst;
+    size_t buckets[UCHAR_MAX + 2];
+    struct historyLine* added;
+    size_t addedCount;
+    size_t addedCapacity;
+} history = { .fd = -1 };
+
+int historyInit(const char* path)
+{
+    char buffer[PATH_MAX];
+    if (path == NULL) {
+        path = varsGet("HISTFILE", 8);
+    }
+    if (path == NULL || *path == '\0') {
+        const char* home = varsGet("HOME", 4);
+        if (home == NULL || snprintf(buffer, sizeof(buffer), "%s/%s", home, HISTORY_FILE) >= (int)sizeof(buffer)) {
+            return -1;
+        }
+        path = buffer;
+    }
+
+    history.fd = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    if (history.fd == -1) {
+        return -1;
+    }
+    // Only map the file here; nothing is read until the history is used
+    struct stat st;
+    if (fstat(history.fd, &st) == 0 && st.st_size > 0) {
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, history.fd, 0);
+        if (map != MAP_FAILED) {
+            history.map = map;
+            history.mapSize = st.st_size;
+        }
+    }
+    return 0;
+}
+
+/*
+* historyIndex is a helper function that finds the lines of the mapped file
+* and groups them by first byte. A last line without a newline is still being
+* written by another shell, or was cut short, and is left out.
+*/
+static void historyIndex(void)
+{
+    if (history.indexed) {
+        return;
+    }
+    history.indexed = 1;
+
+    const char* text = history.map;
+    const char* end = text + history.mapSize;
+    size_t lines = 0;
+    for (const char* p = text; p < end && (p = memchr(p, '\n', end - p)) != NULL; p++) {
+        lines++;
+    }
+    if (lines == 0) {
+        return;
+    }
+
+    history.offsets = malloc((lines + 1) * sizeof(uint64_t));
+    history.byFirst = malloc(lines * sizeof(uint32_t));
+    if (history.offsets == NULL || history.byFirst == NULL) {
+        perror("history");
+        free(history.offsets);
+        free(history.byFirst);
+        history.offsets = NULL;
+        history.byFirst = NULL;
+        return;
+    }
+
+    history.offsets[0] = 0;
+    const char* p = text;
+    for (size_t i = 0; i < lines; i++) {
+        p = (const char*)memchr(p, '\n', end - p) + 1;
+        history.offsets[i + 1] = p - text;
+        history.buckets[(unsigned char)text[history.offsets[i]] + 1]++;
+    }
+    for (int c = 0; c <= UCHAR_MAX; c++) {
+        history.buckets[c + 1] += history.buckets[c];
+    }
+    size_t next[UCHAR_MAX + 1];
+    memcpy(next, history.buckets, sizeof(next));
+    for (size_t i = 0; i < lines; i++) {
+        history.byFirst[next[(unsigned char)text[history.offsets[i]]]++] = (uint32_t)i;
+    }
+    history.mapped = lines;
+}
+
+/*
+* historyEntry is a helper function that returns command number i and its length.
+*/
+static const char* historyEntry(size_t i, size_t* len)
+{
+    if (i < history.mapped) {
+        *len = history.offsets[i + 1] - history.offsets[i] - 1;
+        return history.map + history.offsets[i];
+    }
+    const struct historyLine* line = &history.added[i - history.mapped];
+    *len = line->len;
+    return line->text;
+}
+
+/*
+* historyFind is a helper function that returns the number of the newest
+* command before number `before` that starts with prefix, or -1.
+* Only the lines of the file that share the prefix's first byte are compared.
+*/
+static long historyFind(const char* prefix, size_t prefixLen, size_t before)
+{
+    size_t total = history.mapped + history.addedCount;
+    if (before > total) {
+        before = total;
+    }
+    if (prefixLen == 0) {
+        return (long)before - 1;
+    }
+
+    // This shell's commands are the newest
+    while (before > history.mapped) {
+        const struct historyLine* line = &history.added[--before - history.mapped];
+        if (line->len >= prefixLen && memcmp(line->text, prefix, prefixLen) == 0) {
+            return (long)before;
+        }
+    }
+
+    unsigned char first = prefix[0];
+    size_t start = history.buckets[first];
+    size_t lo = start, hi = history.buckets[first + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (history.byFirst[mid] < before) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    while (lo-- > start) {
+        size_t i = history.byFirst[lo];
+        size_t len;
+        const char* text = historyEntry(i, &len);
+        if (len >= prefixLen && memcmp(text, prefix, prefixLen) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
+
+void historyAdd(const char* line, size_t len)
+{
+    size_t start = 0;
+    while (start < len && (line[start] == ' ' || line[start] == '\t')) {
+        start++;
+    }
+    if (start == len) {
+        return;
+    }
+
+    if (history.addedCount == history.addedCapacity) {
+        size_t capacity = history.addedCapacity ? history.addedCapacity * 2 : 64;
+        struct historyLine* added = realloc(history.added, capacity * sizeof(struct historyLine));
+        if (added == NULL) {
+            return;
+        }
+        history.added = added;
+        history.addedCapacity = capacity;
+    }
+    char* text = malloc(len);
+    if (text == NULL) {
+        return;
+    }
+    memcpy(text, line, len);
+    history.added[history.addedCount++] = (struct historyLine){ text, len };
+
+    // One write per record, so lines from shells appending at once never mix
+    if (history.fd != -1) {
+        struct iovec iov[2] = { { (void*)line, len }, { "\n", 1 } };
+        if (writev(history.fd, iov, 2) == -1) {
+            perror("history");
+            close(history.fd);
+            history.fd = -1;
+        }
+    }
+}
+
+int historyExpand(const char* line, size_t len, char** expanded, size_t* expandedLen)
+{
+    size_t bang = 0;
+    while (bang < len && (line[bang] == ' ' || line[bang] == '\t')) {
+        bang++;
+    }
+    size_t wordEnd = bang + 1;
+    while (wordEnd < len && line[wordEnd] != ' ' && line[wordEnd] != '\t') {
+        wordEnd++;
+    }
+    if (bang >= len || line[bang] != '!' || wordEnd == bang + 1) {
+        return 0;
+    }
+
+    historyIndex();
+    const char* event = line + bang + 1;
+    size_t eventLen = wordEnd - bang - 1;
+    size_t total = history.mapped + history.addedCount;
+    size_t digits = (event[0] == '-') ? 1 : 0;
+    while (digits < eventLen && event[digits] >= '0' && event[digits] <= '9') {
+        digits++;
+    }
+
+    long found;
+    if (eventLen == 1 && event[0] == '!') {
+        found = (long)total - 1;
+    } else if (digits == eventLen && eventLen > (event[0] == '-' ? 1u : 0u)) {
+        long n = strtol(event, NULL, 10);
+        found = (n < 0) ? (long)total + n : n - 1;
+    } else {
+        found = historyFind(event, eventLen, total);
+    }
+    if (found < 0 || (size_t)found >= total) {
+        fprintf(stderr, "myshell: !%.*s: event not found\n", (int)eventLen, event);
+        return -1;
+    }
+
+    size_t entryLen;
+    const char* entry = historyEntry(found, &entryLen);
+    *expandedLen = bang + entryLen + (len - wordEnd);
+    *expanded = malloc(*expandedLen + 1);
+    if (*expanded == NULL) {
+        perror("history");
+        return -1;
+    }
+    memcpy(*expanded, line, bang);
+    memcpy(*expanded + bang, entry, entryLen);
+    memcpy(*expanded + bang + entryLen, line + wordEnd, len - wordEnd);
+    (*expanded)[*expandedLen] = '\0';
+    return 1;
+}
+
+/*
+* historyPrintEntry is a helper function that lists one command with its number.
+*/
+static void historyPrintEntry(size_t i)
+{
+    size_t len;
+    const char* text = historyEntry(i, &len);
+    outUnsigned(i + 1, 5);
+    outWrite("  ", 2);
+    outWrite(text, len);
+    outChar('\n');
+}
+
+void historyPrint(size_t last)
+{
+    historyIndex();
+    size_t total = history.mapped + history.addedCount;
+    for (size_t i = (last > 0 && last < total) ? total - last : 0; i < total; i++) {
+        historyPrintEntry(i);
+    }
+}
+
+size_t historySearch(const char* prefix, size_t limit)
+{
+    historyIndex();
+    size_t prefixLen = strlen(prefix);
+    size_t count = 0;
+    long found = (long)(history.mapped + history.addedCount);
+    while ((limit == 0 || count < limit) && (found = historyFind(prefix, prefixLen, found)) != -1) {
+        historyPrintEntry(found);
+        count++;
+    }
+    return count;
+}
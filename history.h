@@ -0,0 +1,52 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stddef.h>
+
+/* Command history is kept in an append-only file with one command per line.
+ * Every shell appends its commands with a single O_APPEND write per record,
+ * so shells running at the same time never interleave partial lines.
+ * At startup the file is only mapped; the index of line offsets is built the
+ * first time the history is searched or listed, so starting a shell costs the
+ * same however long the history has grown. Commands from other shells become
+ * visible when a shell starts.
+ */
+
+/*historyInit
+* path      the history file, or NULL for $HISTFILE or else ~/.myshell_history
+* returns 0, or -1 if there is no usable history file (history is then kept
+*         for this shell only)
+*/
+int historyInit(const char* path);
+
+/*historyAdd
+* line      a command that was run; blank lines are not recorded
+* len       the length of line
+*/
+void historyAdd(const char* line, size_t len);
+
+/*historyExpand
+* line      a command line whose first word may be a history event:
+*           !! the last command, !N command number N, !-N the Nth last
+*           command, or !prefix the last command starting with prefix
+* len       the length of line
+* expanded  receives a malloc'd copy of line with the event replaced
+* expandedLen receives its length
+* returns 1 if the line was expanded, 0 if it has no event, or -1 if the
+*         event matched nothing (already reported)
+*/
+int historyExpand(const char* line, size_t len, char** expanded, size_t* expandedLen);
+
+/*historyPrint
+* last      the number of most recent commands to list, or 0 for all of them
+*/
+void historyPrint(size_t last);
+
+/*historySearch
+* prefix    lists the commands that start with prefix, newest first
+* limit     the most matches to list, or 0 for all of them
+* returns the number of matches listed
+*/
+size_t historySearch(const char* prefix, size_t limit);
+
+#endif
@@ -0,0 +1,101 @@
+// Cached uid/gid to name lookups
+
+#include <stdlib.h>
+#include <string.h>
+#include <pwd.h>
+#include <grp.h>
+#include "idcache.h"
+
+#define IDCACHE_INITIAL_SIZE 64
+
+struct idEntry {
+    unsigned int id;
+    int used;
+    char* name;     // NULL when the id has no name
+};
+
+// An open-addressing hash map from id to name with linear probing
+struct idCache {
+    struct idEntry* entries;
+    size_t capacity;    // always a power of two
+    size_t count;
+};
+
+static struct idCache users;
+static struct idCache groups;
+
+static size_t idHash(unsigned int id)
+{
+    // Fibonacci hashing spreads the small, dense ids typical of passwd files
+    return (size_t)((id * 2654435769u) >> 7);
+}
+
+static struct idEntry* idFind(struct idCache* cache, unsigned int id)
+{
+    size_t mask = cache->capacity - 1;
+    for (size_t i = idHash(id) & mask;; i = (i + 1) & mask) {
+        struct idEntry* entry = &cache->entries[i];
+        if (!entry->used || entry->id == id) {
+            return entry;
+        }
+    }
+}
+
+static int idGrow(struct idCache* cache)
+{
+    struct idCache bigger;
+    bigger.capacity = cache->capacity ? cache->capacity * 2 : IDCACHE_INITIAL_SIZE;
+    bigger.count = cache->count;
+    bigger.entries = calloc(bigger.capacity, sizeof(struct idEntry));
+    if (bigger.entries == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < cache->capacity; i++) {
+        if (cache->entries[i].used) {
+            *idFind(&bigger, cache->entries[i].id) = cache->entries[i];
+        }
+    }
+    free(cache->entries);
+    *cache = bigger;
+    return 0;
+}
+
+static const char* idLookup(struct idCache* cache, unsigned int id, int isGroup)
+{
+    if (cache->capacity > 0) {
+        struct idEntry* entry = idFind(cache, id);
+        if (entry->used) {
+            return entry->name;
+        }
+    }
+
+    const char* name;
+    if (isGroup) {
+        struct group* grp = getgrgid(id);
+        name = grp ? grp->gr_name : NULL;
+    } else {
+        struct passwd* pwd = getpwuid(id);
+        name = pwd ? pwd->pw_name : NULL;
+    }
+
+    // Keep the table at most half full
+    if ((cache->count + 1) * 2 > cache->capacity && idGrow(cache) == -1) {
+        return name;
+    }
+    struct idEntry* entry = idFind(cache, id);
+    entry->used = 1;
+    entry->id = id;
+    entry->name = name ? strdup(name) : NULL;
+    cache->count++;
+    return entry->name ? entry->name : name;
+}
+
+const char* idcacheUser(uid_t uid)
+{
+    return idLookup(&users, uid, 0);
+}
+
+const char* idcacheGroup(gid_t gid)
+{
+    return idLookup(&groups, gid, 1);
+}
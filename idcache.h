@@ -0,0 +1,23 @@
+#ifndef IDCACHE_H
+#define IDCACHE_H
+
+#include <sys/types.h>
+
+/* The uid/gid name caches remember every lookup, including failed ones,
+ * so each id costs at most one NSS query per shell. They are not
+ * thread-safe; resolve names on the thread that prints them.
+ */
+
+/*idcacheUser
+* uid       the user id to look up
+* returns the user name, or NULL if the id has no name
+*/
+const char* idcacheUser(uid_t uid);
+
+/*idcacheGroup
+* gid       the group id to look up
+* returns the group name, or NULL if the id has no name
+*/
+const char* idcacheGroup(gid_t gid);
+
+#endif
@@ -0,0 +1,522 @@
+// Background jobs and job control
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include "jobs.h"
+#include "spawncmd.h"
+#include "stats.h"
+
+// States of one process of a job
+#define PROC_RUNNING 0
+#define PROC_STOPPED 1
+#define PROC_DONE    2
+
+struct jobProcess {
+    pid_t pid;
+    int state;
+};
+
+/* job
+* id          the number shown by jobs, or 0 while a foreground job has none
+* pgid        the process group of the job, or -1 without job control
+* procs       one entry per stage of the pipeline
+* status      the exit status of the last stage once it is done
+* notified    the state last reported to the user, so each change is reported once
+* usage       the resources used by the processes that have finished
+*/
+struct job {
+    int id;
+    pid_t pgid;
+    struct jobProcess* procs;
+    int count;
+    int status;
+    int notified;
+    char* command;
+    struct rusage usage;
+};
+
+// The job table, in order of job number
+static struct job** jobs;
+static int jobCount;
+static int jobCapacity;
+
+// The job the shell is currently waiting on in the foreground, if any
+static struct job* foregroundJob;
+
+static int childFD = -1;        // signalfd for SIGCHLD
+static int jobControl;          // process groups and terminal handoff are in use
+static pid_t shellPgid;
+static struct termios shellModes;
+static sigset_t originalMask;   // the signal mask the shell was started with
+static sigset_t ignoredSignals; // signals the shell ignores but commands must not
+
+int jobsInit(int interactive)
+{
+    sigset_t childMask;
+    sigemptyset(&childMask);
+    sigaddset(&childMask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &childMask, &originalMask);
+    sigdelset(&originalMask, SIGCHLD);
+    childFD = signalfd(-1, &childMask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (childFD == -1) {
+        perror("signalfd");
+    }
+
+    sigemptyset(&ignoredSignals);
+    if (interactive) {
+        // Wait until the shell has been put in the foreground before taking the terminal
+        while (tcgetpgrp(STDIN_FILENO) != getpgrp()) {
+            kill(-getpgrp(), SIGTTIN);
+        }
+
+        // Keyboard signals go to the foreground job, never to the shell
+        const int signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
+        for (size_t i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+            signal(signals[i], SIG_IGN);
+            sigaddset(&ignoredSignals, signals[i]);
+        }
+
+        shellPgid = getpid();
+        if (getpgrp() != shellPgid && setpgid(0, shellPgid) == -1) {
+            perror("setpgid");
+        }
+        if (tcsetpgrp(STDIN_FILENO, shellPgid) == -1 || tcgetattr(STDIN_FILENO, &shellModes) == -1) {
+            perror("tcsetpgrp");
+        } else {
+            jobControl = 1;
+        }
+    }
+    spawnSetSignals(&ignoredSignals, &originalMask);
+    return jobControl;
+}
+
+void jobsChildSetup(pid_t pgid)
+{
+    if (pgid != -1) {
+        setpgid(0, pgid);
+    }
+    for (int sig = 1; sig < NSIG; sig++) {
+        if (sigismember(&ignoredSignals, sig) == 1) {
+            signal(sig, SIG_DFL);
+        }
+    }
+    sigprocmask(SIG_SETMASK, &originalMask, NULL);
+}
+
+/*
+* jobState is a helper function that sums up the states of a job's processes:
+* running while any process runs, stopped while the rest are stopped, otherwise done.
+*/
+static int jobState(const struct job* job)
+{
+    int state = PROC_DONE;
+    for (int i = 0; i < job->count; i++) {
+        if (job->procs[i].state == PROC_RUNNING) {
+            return PROC_RUNNING;
+        }
+        if (job->procs[i].state == PROC_STOPPED) {
+            state = PROC_STOPPED;
+        }
+    }
+    return state;
+}
+
+/*
+* addUsage is a helper function that adds the resources one process used to a
+* job's total. The maximum resident set size is the largest of any process.
+*/
+static void addUsage(struct rusage* total, const struct rusage* usage)
+{
+    timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+    timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+    if (usage->ru_maxrss > total->ru_maxrss) {
+        total->ru_maxrss = usage->ru_maxrss;
+    }
+    total->ru_minflt += usage->ru_minflt;
+    total->ru_majflt += usage->ru_majflt;
+    total->ru_nvcsw += usage->ru_nvcsw;
+    total->ru_nivcsw += usage->ru_nivcsw;
+}
+
+/*
+* updateJob is a helper function that collects every state change of a job's
+* processes that is already available, without blocking.
+*/
+static void updateJob(struct job* job)
+{
+    int flags = WNOHANG | (jobControl ? WUNTRACED | WCONTINUED : 0);
+
+    for (int i = 0; i < job->count; i++) {
+        struct jobProcess* proc = &job->procs[i];
+        int wstatus;
+        struct rusage usage;
+        pid_t result;
+
+        while (proc->state != PROC_DONE && (result = wait4(proc->pid, &wstatus, flags, &usage)) != 0) {
+            if (result == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                // Nothing left to wait for
+                proc->state = PROC_DONE;
+                break;
+            }
+            if (WIFEXITED(wstatus) || WIFSIGNALED(wstatus)) {
+                proc->state = PROC_DONE;
+                addUsage(&job->usage, &usage);
+                if (i == job->count - 1) {
+                    job->status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+                }
+            } else if (WIFSTOPPED(wstatus)) {
+                int sig = WSTOPSIG(wstatus);
+                if (job == foregroundJob && (sig == SIGTTIN || sig == SIGTTOU)) {
+                    // It touched the terminal before the shell handed it over
+                    kill(proc->pid, SIGCONT);
+                } else {
+                    proc->state = PROC_STOPPED;
+                }
+            } else if (WIFCONTINUED(wstatus)) {
+                proc->state = PROC_RUNNING;
+            }
+        }
+    }
+}
+
+/*
+* reapChildren is a helper function that drains the SIGCHLD signalfd and then
+* checks each known job. Only pids the job table owns are waited for, so
+* children started elsewhere in the shell are left to their own waits.
+*/
+static void reapChildren(void)
+{
+    if (childFD != -1) {
+        struct signalfd_siginfo info[16];
+        while (read(childFD, info, sizeof(info)) > 0) {
+        }
+    }
+
+    for (int i = 0; i < jobCount; i++) {
+        updateJob(jobs[i]);
+    }
+    if (foregroundJob != NULL && foregroundJob->id == 0) {
+        updateJob(foregroundJob);
+    }
+}
+
+/*
+* waitWhileRunning is a helper function that sleeps on the signalfd until the
+* job has finished or stopped.
+*/
+static void waitWhileRunning(struct job* job)
+{
+    reapChildren();
+    while (jobState(job) == PROC_RUNNING) {
+        struct pollfd pfd = { childFD, POLLIN, 0 };
+        // Without a signalfd, fall back to checking every few milliseconds
+        if (poll(&pfd, 1, childFD == -1 ? 10 : -1) == -1 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+        reapChildren();
+    }
+}
+
+static void freeJob(struct job* job)
+{
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+static void addJob(struct job* job)
+{
+    if (jobCount == jobCapacity) {
+        jobCapacity = jobCapacity ? jobCapacity * 2 : 8;
+        jobs = realloc(jobs, jobCapacity * sizeof(struct job*));
+        if (jobs == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    job->id = (jobCount > 0) ? jobs[jobCount - 1]->id + 1 : 1;
+    jobs[jobCount++] = job;
+}
+
+static void removeJob(int index)
+{
+    freeJob(jobs[index]);
+    memmove(&jobs[index], &jobs[index + 1], (jobCount - index - 1) * sizeof(struct job*));
+    jobCount--;
+}
+
+static int findJob(int id)
+{
+    for (int i = 0; i < jobCount; i++) {
+        if (jobs[i]->id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/*
+* printJob is a helper function that prints one line of the job table. The most
+* recent job, which fg and bg use by default, is marked with a '+'.
+*/
+static void printJob(const struct job* job, int state)
+{
+    char label[32];
+    if (state == PROC_RUNNING) {
+        snprintf(label, sizeof(label), "Running");
+    } else if (state == PROC_STOPPED) {
+        snprintf(label, sizeof(label), "Stopped");
+    } else if (job->status == 0) {
+        snprintf(label, sizeof(label), "Done");
+    } else {
+        snprintf(label, sizeof(label), "Exit %d", job->status);
+    }
+    char current = (jobCount > 0 && jobs[jobCount - 1] == job) ? '+' : ' ';
+    printf("[%d]%c  %-24s%s%s\n", job->id, current, label, job->command,
+           state == PROC_RUNNING ? " &" : "");
+}
+
+/*
+* continueJob is a helper function that sends SIGCONT to a job's process group,
+* or to each of its processes without job control.
+*/
+static int continueJob(struct job* job)
+{
+    int result = 0;
+    if (job->pgid > 0) {
+        result = kill(-job->pgid, SIGCONT);
+    } else {
+        for (int i = 0; i < job->count; i++) {
+            if (job->procs[i].state == PROC_STOPPED && kill(job->procs[i].pid, SIGCONT) == -1) {
+                result = -1;
+            }
+        }
+    }
+    if (result == 0) {
+        for (int i = 0; i < job->count; i++) {
+            if (job->procs[i].state == PROC_STOPPED) {
+                job->procs[i].state = PROC_RUNNING;
+            }
+        }
+        job->notified = PROC_RUNNING;
+    }
+    return result;
+}
+
+/*
+* waitForeground is a helper function that gives the terminal to a job and
+* waits for it. A job that stops joins the job table; a finished job is freed.
+* usage, if not NULL, receives the resources the job used.
+* returns the exit status of the job, or 128 + SIGTSTP if it stopped
+*/
+static int waitForeground(struct job* job, struct rusage* usage)
+{
+    foregroundJob = job;
+    if (jobControl && job->pgid > 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+
+    uint64_t start = statsNow();
+    waitWhileRunning(job);
+    statsRecord(STATS_WAIT, start);
+    if (usage != NULL) {
+        *usage = job->usage;
+    }
+
+    if (jobControl) {
+        tcsetpgrp(STDIN_FILENO, shellPgid);
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &shellModes);
+    }
+    foregroundJob = NULL;
+
+    if (jobState(job) == PROC_STOPPED) {
+        if (job->id == 0) {
+            addJob(job);
+        }
+        job->notified = PROC_STOPPED;
+        printf("\n");
+        printJob(job, PROC_STOPPED);
+        return 128 + SIGTSTP;
+    }
+
+    int status = job->status;
+    if (jobControl && status == 128 + SIGINT) {
+        // The prompt should not follow the ^C the terminal echoed
+        printf("\n");
+    }
+    int index = findJob(job->id);
+    if (job->id != 0 && index != -1) {
+        removeJob(index);
+    } else {
+        freeJob(job);
+    }
+    return status;
+}
+
+/*
+* jobsStart wraps the started pipeline in a job. A stage that never started
+* counts as done, with status 127 if it was the last one.
+*/
+int jobsStart(pid_t* pids, int count, pid_t pgid, const char* command, int background, struct rusage* usage)
+{
+    struct job* job = calloc(1, sizeof(struct job));
+    struct jobProcess* procs = malloc(count * sizeof(struct jobProcess));
+    char* text = strdup(command);
+    if (job == NULL || procs == NULL || text == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < count; i++) {
+        procs[i].pid = pids[i];
+        procs[i].state = (pids[i] == -1) ? PROC_DONE : PROC_RUNNING;
+    }
+    job->pgid = pgid;
+    job->procs = procs;
+    job->count = count;
+    job->status = (pids[count - 1] == -1) ? 127 : 0;
+    free(pids);
+    job->command = text;
+
+    if (!background) {
+        return waitForeground(job, usage);
+    }
+
+    addJob(job);
+    if (jobControl) {
+        printf("[%d] %d\n", job->id, (int)procs[count - 1].pid);
+    }
+    return 0;
+}
+
+void jobsNotify(void)
+{
+    if (jobCount == 0) {
+        return;
+    }
+    reapChildren();
+    for (int i = 0; i < jobCount; i++) {
+        int state = jobState(jobs[i]);
+        if (state == jobs[i]->notified) {
+            continue;
+        }
+        jobs[i]->notified = state;
+        if (jobControl) {
+            printJob(jobs[i], state);
+        }
+        if (state == PROC_DONE) {
+            removeJob(i--);
+        }
+    }
+}
+
+void jobsList(void)
+{
+    reapChildren();
+    for (int i = 0; i < jobCount; i++) {
+        int state = jobState(jobs[i]);
+        printJob(jobs[i], state);
+        jobs[i]->notified = state;
+        if (state == PROC_DONE) {
+            removeJob(i--);
+        }
+    }
+}
+
+int jobsResolve(const char* spec)
+{
+    if (spec == NULL) {
+        return (jobCount > 0) ? jobs[jobCount - 1]->id : -1;
+    }
+    if (spec[0] == '%') {
+        spec++;
+    }
+    char* end;
+    long id = strtol(spec, &end, 10);
+    if (end == spec || *end != '\0' || id <= 0 || findJob(id) == -1) {
+        return -1;
+    }
+    return (int)id;
+}
+
+int jobsWait(int id)
+{
+    int index = findJob(id);
+    if (index == -1) {
+        return 127;
+    }
+    struct job* job = jobs[index];
+    uint64_t start = statsNow();
+    waitWhileRunning(job);
+    statsRecord(STATS_WAIT, start);
+    if (jobState(job) == PROC_STOPPED) {
+        return 128 + SIGTSTP;
+    }
+    int status = job->status;
+    removeJob(findJob(id));
+    return status;
+}
+
+int jobsWaitAll(void)
+{
+    int status = 0;
+    while (jobCount > 0) {
+        int index = 0;
+        // Stopped jobs would never finish; skip past them
+        while (index < jobCount && jobState(jobs[index]) == PROC_STOPPED) {
+            index++;
+        }
+        if (index == jobCount) {
+            break;
+        }
+        status = jobsWait(jobs[index]->id);
+    }
+    return status;
+}
+
+int jobsForeground(int id)
+{
+    int index = findJob(id);
+    if (index == -1) {
+        return 1;
+    }
+    struct job* job = jobs[index];
+    printf("%s\n", job->command);
+    fflush(stdout);
+    if (jobState(job) == PROC_STOPPED && continueJob(job) == -1) {
+        perror("fg");
+        return 1;
+    }
+    return waitForeground(job, NULL);
+}
+
+int jobsBackground(int id)
+{
+    int index = findJob(id);
+    if (index == -1) {
+        return 1;
+    }
+    struct job* job = jobs[index];
+    if (jobState(job) == PROC_STOPPED && continueJob(job) == -1) {
+        perror("bg");
+        return 1;
+    }
+    printf("[%d]%c %s &\n", job->id, (index == jobCount - 1) ? '+' : ' ', job->command);
+    return 0;
+}
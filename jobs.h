@@ -0,0 +1,78 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <sys/types.h>
+#include <sys/resource.h>
+
+/*jobsInit
+* interactive   nonzero if the shell reads commands from a terminal; the shell then
+*               takes its own process group and gives the terminal to foreground jobs
+* Blocks SIGCHLD so that children are reaped through a signalfd. Call before
+* any child is started.
+* returns nonzero if job control is enabled
+*/
+int jobsInit(int interactive);
+
+/*jobsChildSetup
+* pgid      the process group to join, 0 for a new one, or -1 to stay in the shell's
+* Prepares a forked copy of the shell for running a command: joins the process
+* group and restores the signal dispositions and mask the shell changed.
+*/
+void jobsChildSetup(pid_t pgid);
+
+/*jobsStart
+* pids        the pid of each stage of a pipeline that was just started, -1 for a
+*             stage that never started; the job takes ownership of this malloc'd array
+* count       the number of entries in pids
+* pgid        the process group of the pipeline, or -1 without job control
+* command     the command line, for jobs and completion messages
+* background  nonzero to return at once instead of waiting
+* usage       if not NULL, receives the resources a foreground job used, summed
+*             over its processes as reported by wait4
+* returns the exit status of the last stage, or 0 for a background job
+*/
+int jobsStart(pid_t* pids, int count, pid_t pgid, const char* command, int background, struct rusage* usage);
+
+/*jobsNotify
+* Reaps finished children without blocking, then reports background jobs that
+* finished or stopped since the last call and forgets the finished ones.
+*/
+void jobsNotify(void);
+
+/*jobsList
+* Reaps finished children and prints the job table.
+*/
+void jobsList(void);
+
+/*jobsResolve
+* spec      a job number, optionally written as %N, or NULL for the current job
+* returns the job number, or -1 if there is no such job
+*/
+int jobsResolve(const char* spec);
+
+/*jobsWait
+* id        a job number from jobsResolve
+* returns the exit status of the job once it has finished or stopped
+*/
+int jobsWait(int id);
+
+/*jobsWaitAll
+* returns the exit status of the last job to finish, after waiting for all of them
+*/
+int jobsWaitAll(void);
+
+/*jobsForeground
+* id        a job number from jobsResolve
+* Continues the job in the foreground and waits for it.
+* returns the exit status of the job
+*/
+int jobsForeground(int id);
+
+/*jobsBackground
+* id        a job number from jobsResolve
+* Continues a stopped job in the background.
+* returns 0 on success, 1 if it could not be signalled
+*/
+int jobsBackground(int id);
+
+#endif
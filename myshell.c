@@ -10,22 +10,80 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #include "argparse.h"
 #include "builtin.h"
+#include "pipeline.h"
+#include "shell.h"
+#include "jobs.h"
+#include "stats.h"
+#include "serve.h"
+#include "history.h"
+#include "vars.h"
+
+#define INPUT_BUFFER_SIZE (1024 * 1024)
+
+struct shellState shell;
+
+extern char **environ;
 
 /* PROTOTYPES */
-void processline(char *line);
 ssize_t getinput(char** line, size_t* size);
+static size_t runLines(const char* text, size_t len, int final);
+static void runFile(int fd);
 
 /* main
  * This function is the main entry point to the program.  This is essentially
  * the primary read-eval-print loop of the command interpreter.
+ * myshell -c "command" runs the command and myshell script.msh runs the script;
+ * otherwise commands come from stdin, with a prompt only when stdin is a terminal.
+ * myshell --serve socket keeps one shell running for many clients, and
+ * myshell --client socket [command] is a client for it.
  */
-int main() {
+int main(int argc, char** argv) {
+    varsInit(environ);
+    shell.interactive = (argc == 1 && isatty(STDIN_FILENO));
+    shell.jobControl = jobsInit(shell.interactive);
+
+    if (argc > 1 && (strcmp(argv[1], "--serve") == 0 || strcmp(argv[1], "--client") == 0)) {
+        if (argc < 3 || (argv[1][2] == 's' && argc > 3) || argc > 4) {
+            fprintf(stderr, "Usage: myshell --serve socket | --client socket [command]\n");
+            return 2;
+        }
+        return (argv[1][2] == 's') ? serveRun(argv[2]) : serveClient(argv[2], argv[3]);
+    }
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: myshell [-c command | script]\n");
+            return 2;
+        }
+        runLines(argv[2], strlen(argv[2]), 1);
+        return shell.lastStatus;
+    }
+    if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(argv[1]);
+            return 127;
+        }
+        runFile(fd);
+        close(fd);
+        return shell.lastStatus;
+    }
+    if (!shell.interactive) {
+        runFile(STDIN_FILENO);
+        return shell.lastStatus;
+    }
+
     char* line = NULL;
     size_t size = 0;
+    historyInit(NULL);
 
     while (1) {
+        jobsNotify(); // Report background jobs that finished since the last prompt
         printf("%s ", "%myshell%"); // Prompt
         ssize_t len = getinput(&line, &size);
         if (len < 0) {
@@ -36,8 +94,27 @@ int main() {
             continue;
         }
 
-        // Process the line
-        processline(line);
+        // Replace a !event with the command it names, and show the result
+        char* expanded;
+        size_t expandedLen;
+        int rc = historyExpand(line, len, &expanded, &expandedLen);
+        if (rc == -1) {
+            shell.lastStatus = 1;
+            free(line);
+            line = NULL;
+            continue;
+        }
+        if (rc == 1) {
+            printf("%s\n", expanded);
+            free(line);
+            line = expanded;
+            len = expandedLen;
+            size = len + 1;
+        }
+
+        // Record the line, then process it
+        historyAdd(line, len);
+        processline(line, len);
 
         // Free the allocated memory for line
         free(line);
@@ -47,6 +124,93 @@ int main() {
     return EXIT_SUCCESS;
 }
 
+/* runLines
+ * text     a block of commands separated by newlines
+ * len      the length of text
+ * final    nonzero if text ends the input, so a last line without a newline is run too
+ * returns  the number of bytes consumed; an unfinished last line is left for the caller
+ *
+ * Lines are found with memchr and handed to processline where they lie,
+ * so the input is never copied line by line.
+ */
+static size_t runLines(const char* text, size_t len, int final) {
+    const char* p = text;
+    const char* end = text + len;
+
+    while (p < end) {
+        const char* newline = memchr(p, '\n', end - p);
+        if (newline == NULL) {
+            if (!final) {
+                break;
+            }
+            newline = end;
+        }
+        processline(p, newline - p);
+        p = (newline < end) ? newline + 1 : end;
+    }
+    return p - text;
+}
+
+/* runFile
+ * fd       the script to run
+ *
+ * A regular file is mapped and run in place. Anything else, such as a pipe,
+ * is read in large blocks, so there is one read for many lines rather than
+ * one per line. Commands therefore do not see the rest of the script on stdin.
+ */
+static void runFile(int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        uint64_t start = statsNow();
+        void* text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        statsRecord(STATS_GETINPUT, start);
+        if (text != MAP_FAILED) {
+            madvise(text, st.st_size, MADV_SEQUENTIAL);
+            runLines(text, st.st_size, 1);
+            munmap(text, st.st_size);
+            return;
+        }
+    }
+
+    size_t size = INPUT_BUFFER_SIZE;
+    size_t have = 0;
+    char* buffer = malloc(size);
+    if (buffer == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1) {
+        if (have == size) {
+            // A single line fills the buffer
+            size *= 2;
+            buffer = realloc(buffer, size);
+            if (buffer == NULL) {
+                fprintf(stderr, "Memory allocation failed\n");
+                exit(EXIT_FAILURE);
+            }
+        }
+        uint64_t start = statsNow();
+        ssize_t n = read(fd, buffer + have, size - have);
+        statsRecord(STATS_GETINPUT, start);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            if (n == -1) {
+                perror("read");
+            }
+            runLines(buffer, have, 1);
+            break;
+        }
+        have += n;
+        size_t used = runLines(buffer, have, 0);
+        memmove(buffer, buffer + used, have - used);
+        have -= used;
+    }
+    free(buffer);
+}
+
 /* getinput
  * line     A pointer to a char* that points at a buffer of size *size or NULL.
  * size     The size of the buffer *line or 0 if *line is NULL.
@@ -59,11 +223,13 @@ int main() {
  * Hint: There is a standard i/o function that can make getinput easier than it sounds.
  */
 ssize_t getinput(char** line, size_t* size) {
+    uint64_t start = statsNow();
     ssize_t len = getline(line, size, stdin);
+    statsRecord(STATS_GETINPUT, start);
     if (len == -1) {
         // Error or end-of-file
         if (feof(stdin)) {
-            exit(EXIT_SUCCESS); // End-of-file
+            exit(shell.lastStatus); // End-of-file
         } else {
             perror("getline");
             return -1; // Error
@@ -77,47 +243,154 @@ ssize_t getinput(char** line, size_t* size) {
     return len;
 }
 
-/* processline
- * The parameter line is interpreted as a command name.  This function creates a
- * new process that executes that command.
- * Note the three cases of the switch: fork failed, fork succeeded and this is
- * the child, fork succeeded and this is the parent (see fork(2)).
- * processline only forks when the line is not empty, and the line is not trying to run a built in command
+/* commandText
+ * args     the arguments of one command
+ * count    the number of arguments
+ * arena    the arena the text is allocated from
+ * returns  the arguments joined with spaces, as jobs shows them
  */
-void processline(char *line) {
-    // Check whether line is empty
-    if (line[0] == '\0') {
-        return;
+static char* commandText(char** args, int count, struct arena* arena) {
+    size_t len = 0;
+    for (int i = 0; i < count; i++) {
+        len += strlen(args[i]) + 1;
     }
+    char* text = arenaAlloc(arena, len + 1);
+    char* p = text;
+    for (int i = 0; i < count; i++) {
+        size_t argLen = strlen(args[i]);
+        memcpy(p, args[i], argLen);
+        p += argLen;
+        *p++ = ' ';
+    }
+    *(p > text ? p - 1 : p) = '\0';
+    return text;
+}
+
+/* printTimes
+ * wall     the elapsed time in nanoseconds
+ * usage    the resources the command used
+ *
+ * Reports a timed command on stderr, as the time prefix does.
+ */
+static void printTimes(uint64_t wall, const struct rusage* usage) {
+    double real = wall / 1e9;
+    double user = usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6;
+    double sys = usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6;
+    fprintf(stderr, "\nreal\t%dm%.3fs\nuser\t%dm%.3fs\nsys\t%dm%.3fs\n",
+            (int)(real / 60), real - 60 * (int)(real / 60),
+            (int)(user / 60), user - 60 * (int)(user / 60),
+            (int)(sys / 60), sys - 60 * (int)(sys / 60));
+    fprintf(stderr, "maxrss\t%ld KiB\nctxsw\t%ld voluntary, %ld involuntary\n",
+            usage->ru_maxrss, usage->ru_nvcsw, usage->ru_nivcsw);
+}
+
+/*
+* isAssignment is a helper function that tells whether arg has the form NAME=value.
+*/
+static int isAssignment(const char* arg) {
+    const char* equals = strchr(arg, '=');
+    return equals != NULL && equals != arg && varsNameLength(arg, equals - arg) == (size_t)(equals - arg);
+}
+
+/*
+* assignVariables is a helper function that sets a shell variable for each
+* NAME=value word of a command, if every word is one.
+* returns 1 if the command was only assignments, 0 otherwise
+*/
+static int assignVariables(char** args, int count) {
+    for (int i = 0; i < count; i++) {
+        if (!isAssignment(args[i])) {
+            return 0;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        char* equals = strchr(args[i], '=');
+        *equals = '\0';
+        if (varsSet(args[i], equals + 1, 0) == -1) {
+            perror("myshell");
+        }
+    }
+    return 1;
+}
+
+/* processline
+ * The parameter line is interpreted as pipelines of commands separated by '|',
+ * each with optional '<', '>', '>>' and '2>' redirections. A pipeline followed
+ * by '&' runs in the background; the shell waits only for the last one.
+ * A pipeline prefixed with time is followed by a report of its wall and CPU
+ * time, peak memory and context switches.
+ * Every stage of a pipeline is started in its own process before the shell waits
+ * for any of them; builtins that are part of a pipeline run in a forked copy of
+ * the shell. A single builtin command runs in the shell itself, so it never forks.
+ * A command made only of NAME=value words sets those shell variables, which
+ * are not exported until export names them.
+ * Blank lines and comments leave the last status unchanged. After set -e a
+ * failing command ends the shell with its status.
+ */
+int processline(const char* line, size_t len) {
+    // Everything parsed from the line lives in the arena until the command is done
+    static struct arena arena;
 
-    pid_t cpid;
-    int status;
     int argCount;
-    char** arguments = argparse(line, &argCount);
-
-    // Check whether arguments are built-in commands
-    if (!builtIn(arguments, argCount)) {
-        // Fork to execute the command
-        cpid = fork();
-        if (cpid < 0) {
-            perror("fork");
-            exit(EXIT_FAILURE);
-        } else if (cpid == 0) {
-            // Child process
-            execvp(arguments[0], arguments);
-            // If execvp returns, it must have failed
-            perror("execvp");
-            exit(EXIT_FAILURE);
+    uint64_t start = statsNow();
+    varsSetStatus(shell.lastStatus);
+    char** arguments = argparse(line, len, &argCount, &arena);
+    statsRecord(STATS_ARGPARSE, start);
+
+    if (arguments == NULL) {
+        shell.lastStatus = 2;
+    }
+    for (int first = 0; arguments != NULL && first < argCount; ) {
+        int end = first;
+        while (end < argCount && arguments[end] != argBackground) {
+            end++;
+        }
+        int background = (end < argCount);
+        int timed = (end > first && strcmp(arguments[first], "time") == 0);
+        uint64_t wallStart = statsNow();
+        struct rusage usage = {0};
+        if (timed) {
+            first++;
+        }
+
+        struct pipeline pl;
+        if (end > first && !timed && assignVariables(arguments + first, end - first)) {
+            shell.lastStatus = 0;
+            first = end + 1;
+            continue;
+        }
+        if (end == first) {
+            if (timed && !background) {
+                printTimes(statsNow() - wallStart, &usage);
+                shell.lastStatus = 0;
+                break;
+            }
+            fprintf(stderr, "syntax error: empty command before '&'\n");
+            shell.lastStatus = 2;
+            break;
+        }
+        if (pipelineParse(arguments + first, end - first, &pl, &arena) == 0) {
+            char* text = commandText(arguments + first, end - first, &arena);
+            shell.lastStatus = pipelineRun(&pl, text, background, (timed && !background) ? &usage : NULL);
+            if (timed && !background) {
+                printTimes(statsNow() - wallStart, &usage);
+            }
         } else {
-            // Parent process
-            waitpid(cpid, &status, 0);
+            shell.lastStatus = 2;
+            break;
         }
+        first = end + 1;
+    }
+
+    arenaReset(&arena);
+
+    // With no prompt to report them at, finished background jobs are forgotten here
+    if (!shell.interactive) {
+        jobsNotify();
     }
 
-    // Free memory allocated for each argument
-    for (int i = 0; i < argCount; i++) {
-        free(arguments[i]);
+    if (shell.errexit && shell.lastStatus != 0) {
+        exit(shell.lastStatus);
     }
-    // Free memory allocated for the array of arguments
-    free(arguments);
+    return shell.lastStatus;
 }
@@ -0,0 +1,214 @@
+// Buffered builtin output
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "outbuf.h"
+
+#define OUTBUF_SIZE (64 * 1024)
+#define OUTBUF_DIRECT (OUTBUF_SIZE / 4)    // larger writes skip the copy into the buffer
+#define TIME_CACHE_SLOTS 64
+
+static char buffer[OUTBUF_SIZE];
+static size_t used;
+
+// -1 until the first write after a flush, then whether stdout is a terminal
+static int lineBuffered = -1;
+static int flushAtExit;
+
+/* timeCache
+* strftime output for one minute, in a direct-mapped cache per format.
+* Time zone offsets are whole minutes, so the minute since the epoch decides
+* everything in the text but the seconds.
+*/
+struct timeCache {
+    long long minute;
+    int valid;
+    size_t len;
+    char text[32];
+};
+
+static struct timeCache timeCaches[2][TIME_CACHE_SLOTS];
+
+/*
+* writeAll is a helper function that writes every byte of the iovecs,
+* continuing after partial writes. Output that cannot be written is dropped.
+*/
+static void writeAll(struct iovec* iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(STDOUT_FILENO, iov, count);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/*
+* startOutput is a helper function for the first write after a flush: it
+* empties stdio's buffer ahead of ours and looks at what stdout is now,
+* since redirections may have changed it since the last command.
+*/
+static void startOutput(void)
+{
+    fflush(stdout);
+    lineBuffered = isatty(STDOUT_FILENO);
+    if (!flushAtExit) {
+        atexit(outFlush);
+        flushAtExit = 1;
+    }
+}
+
+// Writes out the buffer without forgetting what stdout is
+static void flushBuffer(void)
+{
+    if (used > 0) {
+        struct iovec iov = { buffer, used };
+        writeAll(&iov, 1);
+        used = 0;
+    }
+}
+
+void outFlush(void)
+{
+    flushBuffer();
+    lineBuffered = -1;
+}
+
+void outWrite(const char* data, size_t len)
+{
+    if (lineBuffered == -1) {
+        startOutput();
+    }
+    if (len >= OUTBUF_DIRECT) {
+        struct iovec iov[2] = { { buffer, used }, { (void*)data, len } };
+        writeAll(used > 0 ? iov : iov + 1, used > 0 ? 2 : 1);
+        used = 0;
+        return;
+    }
+    if (used + len > OUTBUF_SIZE) {
+        flushBuffer();
+    }
+    memcpy(buffer + used, data, len);
+    used += len;
+    if (lineBuffered && memchr(data, '\n', len) != NULL) {
+        flushBuffer();
+    }
+}
+
+void outStr(const char* s)
+{
+    outWrite(s, strlen(s));
+}
+
+void outChar(char c)
+{
+    if (lineBuffered != 0 || used == OUTBUF_SIZE) {
+        outWrite(&c, 1);
+        return;
+    }
+    buffer[used++] = c;
+}
+
+void outUnsigned(unsigned long long value, int width)
+{
+    char digits[24];
+    int len = 0;
+    do {
+        digits[sizeof(digits) - 1 - len++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    while (len < width && len < (int)sizeof(digits)) {
+        digits[sizeof(digits) - 1 - len++] = ' ';
+    }
+    outWrite(digits + sizeof(digits) - len, len);
+}
+
+size_t outFormatUnsigned(char* out, unsigned long long value)
+{
+    char digits[24];
+    size_t len = 0;
+    do {
+        digits[sizeof(digits) - 1 - len++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    memcpy(out, digits + sizeof(digits) - len, len);
+    return len;
+}
+
+void outSigned(long long value)
+{
+    if (value < 0) {
+        outChar('-');
+        outUnsigned(-(unsigned long long)value, 0);
+    } else {
+        outUnsigned(value, 0);
+    }
+}
+
+void outOctal(unsigned long long value, int width)
+{
+    char digits[24];
+    int len = 0;
+    do {
+        digits[sizeof(digits) - 1 - len++] = '0' + (value & 7);
+        value >>= 3;
+    } while (value != 0);
+    while (len < width && len < (int)sizeof(digits)) {
+        digits[sizeof(digits) - 1 - len++] = '0';
+    }
+    outWrite(digits + sizeof(digits) - len, len);
+}
+
+void outMode(mode_t mode)
+{
+    char text[10];
+    text[0] = S_ISDIR(mode) ? 'd' : S_ISLNK(mode) ? 'l' : '-';
+    static const char letters[] = "rwxrwxrwx";
+    for (int i = 0; i < 9; i++) {
+        text[i + 1] = (mode & (0400 >> i)) ? letters[i] : '-';
+    }
+    outWrite(text, sizeof(text));
+}
+
+void outTime(time_t t, int format)
+{
+    // Floor division, so times before 1970 land in the right minute
+    long long minute = (t >= 0) ? t / 60 : -((-(long long)t + 59) / 60);
+    struct timeCache* entry = &timeCaches[format][minute & (TIME_CACHE_SLOTS - 1)];
+
+    if (!entry->valid || entry->minute != minute) {
+        struct tm tm;
+        time_t start = (time_t)(minute * 60);
+        entry->len = 0;
+        if (localtime_r(&start, &tm) != NULL) {
+            entry->len = strftime(entry->text, sizeof(entry->text),
+                                  format == OUT_TIME_FULL ? "%Y-%m-%d %H:%M:" : "%b %d %H:%M", &tm);
+        }
+        entry->minute = minute;
+        entry->valid = 1;
+    }
+    outWrite(entry->text, entry->len);
+
+    if (format == OUT_TIME_FULL) {
+        int seconds = (int)(t - (time_t)(minute * 60));
+        char text[2] = { '0' + seconds / 10, '0' + seconds % 10 };
+        outWrite(text, sizeof(text));
+    }
+}
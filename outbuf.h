@@ -0,0 +1,78 @@
+#ifndef OUTBUF_H
+#define OUTBUF_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* A buffered writer for builtin output on stdout. Output collects in one
+* large buffer and goes out with a single write, or a writev together with
+* a large block passed to outWrite, instead of one write per printf. When
+* stdout is a terminal, each complete line is written at once.
+* Anything already sitting in stdio's stdout buffer is flushed first, so the
+* two can follow each other, but a builtin should not interleave them.
+* builtIn flushes after every builtin, and the shell flushes before it forks.
+*/
+
+// Time formats for outTime
+#define OUT_TIME_SHORT 0    // "%b %d %H:%M", as ls -l prints it
+#define OUT_TIME_FULL  1    // "%Y-%m-%d %H:%M:%S", as stat prints it
+
+/*outWrite
+* data      the bytes to write
+* len       the number of bytes
+*/
+void outWrite(const char* data, size_t len);
+
+/*outStr
+* s         a NUL terminated string to write
+*/
+void outStr(const char* s);
+
+/*outChar
+* c         the character to write
+*/
+void outChar(char c);
+
+/*outUnsigned
+* value     written in decimal, right aligned in at least width characters
+* width     the field width, or 0
+*/
+void outUnsigned(unsigned long long value, int width);
+
+/*outSigned
+* value     written in decimal
+*/
+void outSigned(long long value);
+
+/*outOctal
+* value     written in octal, padded with zeros to at least width digits
+* width     the field width, or 0
+*/
+void outOctal(unsigned long long value, int width);
+
+/*outMode
+* mode      a file mode, written as its type character and nine permission characters
+*/
+void outMode(mode_t mode);
+
+/*outTime
+* t         the time to write in local time
+* format    OUT_TIME_SHORT or OUT_TIME_FULL
+*/
+void outTime(time_t t, int format);
+
+/*outFormatUnsigned
+* out       where value is written in decimal; 20 bytes always hold it
+* value     the value to format
+* returns the number of characters written. Nothing is buffered, so any
+* thread may call it.
+*/
+size_t outFormatUnsigned(char* out, unsigned long long value);
+
+/*outFlush
+* Writes out everything buffered.
+*/
+void outFlush(void);
+
+#endif
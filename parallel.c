@@ -0,0 +1,318 @@
+// Bounded parallel command runner
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "parallel.h"
+#include "spawncmd.h"
+#include "outbuf.h"
+#include "vars.h"
+
+#define PARALLEL_MAX_STATUS 101
+
+/* parallelSlot
+* One of the jobs running at the same time. The output descriptors are
+* memfds kept for the whole run and emptied after each job.
+* pid         the running job, or 0 if the slot is free
+* pidfd       a descriptor that becomes readable when the job exits, or -1
+* out, err    where the job's stdout and stderr are collected
+* seq         the job number, counting from 1 in argument order
+* text        the command line, for the report
+*/
+struct parallelSlot {
+    pid_t pid;
+    int pidfd;
+    int out;
+    int err;
+    long seq;
+    char* text;
+};
+
+/*
+* expandCommand is a helper function that builds the argv of one job by
+* replacing every {} in the template with arg. Returns a malloc'd array whose
+* strings are malloc'd too; *text receives the words joined with spaces.
+*/
+static char** expandCommand(char** command, const char* arg, char** text)
+{
+    int words = 0;
+    int placeholders = 0;
+    for (; command[words] != NULL; words++) {
+        if (strstr(command[words], "{}") != NULL) {
+            placeholders = 1;
+        }
+    }
+
+    char** argv = malloc((words + 2) * sizeof(char*));
+    if (argv == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    size_t argLen = strlen(arg);
+    size_t textLen = 0;
+    for (int i = 0; i < words; i++) {
+        const char* word = command[i];
+        size_t len = strlen(word);
+        for (const char* p = strstr(word, "{}"); p != NULL; p = strstr(p + 2, "{}")) {
+            len += argLen - 2;
+        }
+        char* out = malloc(len + 1);
+        if (out == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        char* dst = out;
+        for (const char* p; (p = strstr(word, "{}")) != NULL; word = p + 2) {
+            memcpy(dst, word, p - word);
+            dst += p - word;
+            memcpy(dst, arg, argLen);
+            dst += argLen;
+        }
+        strcpy(dst, word);
+        argv[i] = out;
+        textLen += len + 1;
+    }
+    if (!placeholders) {
+        argv[words++] = strdup(arg);
+        textLen += argLen + 1;
+    }
+    argv[words] = NULL;
+
+    *text = malloc(textLen + 1);
+    if (*text == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    char* p = *text;
+    for (int i = 0; i < words; i++) {
+        p = stpcpy(p, argv[i]);
+        *p++ = ' ';
+    }
+    *(p > *text ? p - 1 : p) = '\0';
+    return argv;
+}
+
+static void freeArgv(char** argv)
+{
+    for (int i = 0; argv[i] != NULL; i++) {
+        free(argv[i]);
+    }
+    free(argv);
+}
+
+/*
+* flushOutput is a helper function that copies what a job wrote into one of
+* its memfds to targetFD in one piece, then empties the memfd for the next job.
+*/
+static void flushOutput(int memFD, int targetFD)
+{
+    struct stat st;
+    if (fstat(memFD, &st) == -1 || st.st_size == 0) {
+        return;
+    }
+
+    off_t offset = 0;
+    while (offset < st.st_size) {
+        ssize_t n = sendfile(targetFD, memFD, &offset, st.st_size - offset);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            // sendfile cannot write to every kind of descriptor
+            char buffer[64 * 1024];
+            ssize_t got;
+            while ((got = pread(memFD, buffer, sizeof(buffer), offset)) > 0) {
+                if (write(targetFD, buffer, got) != got) {
+                    break;
+                }
+                offset += got;
+            }
+            break;
+        }
+    }
+
+    ftruncate(memFD, 0);
+    lseek(memFD, 0, SEEK_SET);
+}
+
+/*
+* startJob is a helper function that spawns one job in a free slot.
+* returns 0 on success, or the status to report for a job that could not start
+*/
+static int startJob(struct parallelSlot* slot, char** command, const char* arg, long seq, int stdinFD)
+{
+    char** argv = expandCommand(command, arg, &slot->text);
+    int fds[3] = { stdinFD, slot->out, slot->err };
+    slot->seq = seq;
+    slot->pid = spawnCommand(argv, fds, varsEnviron(), -1);
+    if (slot->pid == -1) {
+        if (errno == ENOENT && strchr(argv[0], '/') == NULL) {
+            fprintf(stderr, "%s: command not found\n", argv[0]);
+        } else {
+            fprintf(stderr, "%s: %s\n", argv[0], strerror(errno));
+        }
+        slot->pid = 0;
+        freeArgv(argv);
+        return 127;
+    }
+    freeArgv(argv);
+
+    slot->pidfd = (int)syscall(SYS_pidfd_open, slot->pid, 0);
+    return 0;
+}
+
+/*
+* finishJob is a helper function that collects a job that has exited, or
+* returns -1 without waiting if it is still running.
+*/
+static int finishJob(struct parallelSlot* slot)
+{
+    int wstatus;
+    pid_t result;
+    while ((result = waitpid(slot->pid, &wstatus, slot->pidfd == -1 ? WNOHANG : 0)) == -1 && errno == EINTR) {
+    }
+    if (result == 0) {
+        return -1;
+    }
+
+    if (slot->pidfd != -1) {
+        close(slot->pidfd);
+        slot->pidfd = -1;
+    }
+    slot->pid = 0;
+    if (result == -1) {
+        return 127;
+    }
+    return WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 128 + WTERMSIG(wstatus);
+}
+
+static void report(long seq, int status, const char* text, int verbose)
+{
+    if (status != 0 || verbose) {
+        fprintf(stderr, "parallel: [%ld] exit %d: %s\n", seq, status, text);
+    }
+}
+
+/*
+* parallelRun keeps up to jobs commands running and starts the next one as soon
+* as any of them exits. Exits are noticed through a pidfd per job, so the shell
+* sleeps in poll and never waits on children that are not its own. Each job
+* writes into a memfd of its slot, and that output is copied out in one piece
+* when the job ends, so lines of different jobs never interleave.
+*/
+int parallelRun(char** command, char** args, int count, int jobs, int stdinFD, int verbose)
+{
+    if (jobs > count) {
+        jobs = count > 0 ? count : 1;
+    }
+    struct parallelSlot* slots = calloc(jobs, sizeof(struct parallelSlot));
+    struct pollfd* pfds = calloc(jobs, sizeof(struct pollfd));
+    if (slots == NULL || pfds == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int failed = 0;
+    for (int i = 0; i < jobs; i++) {
+        slots[i].pidfd = -1;
+        slots[i].out = memfd_create("parallel-out", MFD_CLOEXEC);
+        slots[i].err = memfd_create("parallel-err", MFD_CLOEXEC);
+        if (slots[i].out == -1 || slots[i].err == -1) {
+            perror("parallel: memfd_create");
+            failed = count;
+            count = 0;
+        }
+    }
+
+    // Nothing the shell buffered may end up in the middle of a job's output
+    outFlush();
+    fflush(stdout);
+    fflush(stderr);
+
+    int next = 0;
+    int running = 0;
+    while (next < count || running > 0) {
+        for (int i = 0; i < jobs && next < count; i++) {
+            if (slots[i].pid != 0) {
+                continue;
+            }
+            int status = startJob(&slots[i], command, args[next], next + 1, stdinFD);
+            next++;
+            if (status != 0) {
+                report(slots[i].seq, status, slots[i].text, verbose);
+                free(slots[i].text);
+                failed++;
+                i--; // Try the slot again with the next argument
+                continue;
+            }
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        int polling = 1;
+        for (int i = 0; i < jobs; i++) {
+            pfds[i].fd = (slots[i].pid != 0) ? slots[i].pidfd : -1;
+            pfds[i].events = POLLIN;
+            pfds[i].revents = 0;
+            if (slots[i].pid != 0 && slots[i].pidfd == -1) {
+                polling = 0;
+            }
+        }
+        // Jobs without a pidfd (older kernels) are checked every few milliseconds
+        if (poll(pfds, jobs, polling ? -1 : 10) == -1 && errno != EINTR) {
+            perror("parallel: poll");
+            break;
+        }
+
+        for (int i = 0; i < jobs; i++) {
+            if (slots[i].pid == 0 || (slots[i].pidfd != -1 && pfds[i].revents == 0)) {
+                continue;
+            }
+            int status = finishJob(&slots[i]);
+            if (status == -1) {
+                continue;
+            }
+            running--;
+            flushOutput(slots[i].out, STDOUT_FILENO);
+            flushOutput(slots[i].err, STDERR_FILENO);
+            report(slots[i].seq, status, slots[i].text, verbose);
+            free(slots[i].text);
+            if (status != 0) {
+                failed++;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "parallel: %d jobs, %d failed, %.3f s\n", next, failed, seconds);
+
+    for (int i = 0; i < jobs; i++) {
+        if (slots[i].out != -1) {
+            close(slots[i].out);
+        }
+        if (slots[i].err != -1) {
+            close(slots[i].err);
+        }
+    }
+    free(slots);
+    free(pfds);
+    return failed > PARALLEL_MAX_STATUS ? PARALLEL_MAX_STATUS : failed;
+}
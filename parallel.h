@@ -0,0 +1,16 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*parallelRun
+* command     the command template, NULL terminated; every {} in it is replaced by
+*             the argument of a job, and without any {} the argument is appended
+* args        the arguments, one job each
+* count       the number of arguments
+* jobs        the most jobs to run at once
+* stdinFD     the descriptor the jobs read as stdin, or -1 to inherit the shell's
+* verbose     nonzero to report the exit status of every job, not just failures
+* returns the number of jobs that failed, at most 101
+*/
+int parallelRun(char** command, char** args, int count, int jobs, int stdinFD, int verbose);
+
+#endif
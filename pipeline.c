@@ -0,0 +1,342 @@
+// Pipelines and I/O redirection
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "pipeline.h"
+#include "builtin.h"
+#include "spawncmd.h"
+#include "argparse.h"
+#include "jobs.h"
+#include "shell.h"
+#include "stats.h"
+#include "outbuf.h"
+#include "vars.h"
+#include "cwd.h"
+
+#define PIPE_BUFFER_SIZE (1 << 20)
+
+/*
+* isRedirect is a helper function that tells whether an argument is a
+* redirection operator that takes a file name.
+*/
+static int isRedirect(const char* arg)
+{
+    return arg == argInput || arg == argOutput || arg == argAppend || arg == argError;
+}
+
+/*
+* pipelineParse splits the arguments at each '|' into stages and pulls the
+* redirections out of each stage's argument list.
+*/
+int pipelineParse(char** args, int argc, struct pipeline* pl, struct arena* arena)
+{
+    int stages = 1;
+    for (int i = 0; i < argc; i++) {
+        if (args[i] == argPipe) {
+            stages++;
+        }
+    }
+
+    pl->count = stages;
+    pl->stages = arenaAlloc(arena, stages * sizeof(struct stage));
+    memset(pl->stages, 0, stages * sizeof(struct stage));
+    // One array holds every stage's argv, with room for each NULL terminator
+    char** argvs = arenaAlloc(arena, (argc + stages) * sizeof(char*));
+
+    struct stage* stage = &pl->stages[0];
+    stage->argv = argvs;
+    for (int i = 0; i < argc; i++) {
+        if (args[i] == argPipe) {
+            if (stage->argc == 0) {
+                break; // Reported below
+            }
+            stage->argv[stage->argc] = NULL;
+            stage++;
+            stage->argv = argvs + (stage - pl->stages) + i;
+            continue;
+        }
+        if (isRedirect(args[i])) {
+            if (i + 1 >= argc || args[i + 1] == argPipe || isRedirect(args[i + 1])) {
+                fprintf(stderr, "syntax error: missing file name after '%s'\n", args[i]);
+                return -1;
+            }
+            const char* file = args[++i];
+            if (args[i - 1][0] == '<') {
+                stage->input = file;
+            } else if (args[i - 1][0] == '2') {
+                stage->error = file;
+            } else {
+                stage->output = file;
+                stage->append = (args[i - 1][1] == '>');
+            }
+            continue;
+        }
+        stage->argv[stage->argc++] = args[i];
+    }
+    stage->argv[stage->argc] = NULL;
+
+    for (int i = 0; i < pl->count; i++) {
+        if (pl->stages[i].argc == 0) {
+            fprintf(stderr, "syntax error: empty command in pipeline\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+* redirectFile is a helper function that opens a file and moves it onto targetFD.
+* returns 0 on success, -1 if the file could not be opened (already reported)
+*/
+static int redirectFile(const char* path, int flags, int targetFD)
+{
+    int fd = openat(cwdFD(), path, flags | O_CLOEXEC, 0666);
+    if (fd == -1) {
+        perror(path);
+        return -1;
+    }
+    // dup2 clears close-on-exec on the new descriptor
+    if (dup2(fd, targetFD) == -1) {
+        perror("dup2");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+/*
+* applyRedirects is a helper function that applies a stage's file redirections
+* to the current process's standard descriptors.
+*/
+static int applyRedirects(const struct stage* stage)
+{
+    if (stage->input != NULL && redirectFile(stage->input, O_RDONLY, STDIN_FILENO) == -1) {
+        return -1;
+    }
+    if (stage->output != NULL &&
+        redirectFile(stage->output, O_WRONLY | O_CREAT | (stage->append ? O_APPEND : O_TRUNC), STDOUT_FILENO) == -1) {
+        return -1;
+    }
+    if (stage->error != NULL && redirectFile(stage->error, O_WRONLY | O_CREAT | O_TRUNC, STDERR_FILENO) == -1) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* runBuiltinInShell is a helper function for a single builtin command. It runs
+* in the shell process itself, so cd, env and exit keep their effect, with any
+* redirections applied around it and undone afterwards.
+*/
+static int runBuiltinInShell(const struct stage* stage)
+{
+    int saved[3] = { -1, -1, -1 };
+    int redirected = (stage->input != NULL || stage->output != NULL || stage->error != NULL);
+    int status = 0;
+
+    if (redirected) {
+        fflush(stdout);
+        fflush(stderr);
+        for (int fd = 0; fd < 3; fd++) {
+            saved[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10);
+        }
+        if (applyRedirects(stage) == -1) {
+            status = 1;
+        }
+    }
+
+    if (status == 0) {
+        builtIn(stage->argv, stage->argc, &status);
+    }
+
+    if (redirected) {
+        fflush(stdout);
+        fflush(stderr);
+        for (int fd = 0; fd < 3; fd++) {
+            if (saved[fd] != -1) {
+                dup2(saved[fd], fd);
+                close(saved[fd]);
+            }
+        }
+    }
+    return status;
+}
+
+/*
+* runStage is a helper function that runs in the forked child of a builtin
+* stage. It wires up the pipe ends and redirections and never returns.
+* Only builtins need this fork fallback; external commands go through spawnCommand.
+*/
+static void runStage(const struct stage* stage, int inFD, int outFD, pid_t pgid)
+{
+    jobsChildSetup(pgid);
+    if (inFD != -1 && dup2(inFD, STDIN_FILENO) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    if (outFD != -1 && dup2(outFD, STDOUT_FILENO) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+    if (applyRedirects(stage) == -1) {
+        _exit(EXIT_FAILURE);
+    }
+
+    // Builtins run in this forked copy of the shell and write into the pipe
+    int status = 0;
+    builtIn(stage->argv, stage->argc, &status);
+    fflush(stdout);
+    fflush(stderr);
+    _exit(status);
+}
+
+/*
+* openRedirect is a helper function that opens a redirection target in the
+* shell, so a missing file is reported by name before anything is started.
+*/
+static int openRedirect(const char* path, int flags, int* fd)
+{
+    if (path == NULL) {
+        return 0;
+    }
+    *fd = openat(cwdFD(), path, flags | O_CLOEXEC, 0666);
+    if (*fd == -1) {
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+* launchStage is a helper function that starts one stage in process group pgid
+* (0 for a new group, -1 for the shell's) and returns its pid, or -1 if it could
+* not be started (already reported).
+*/
+static pid_t launchStage(const struct stage* stage, int inFD, int outFD, pid_t pgid)
+{
+    if (isBuiltIn(stage->argv[0])) {
+        uint64_t start = statsNow();
+        pid_t cpid = fork();
+        if (cpid < 0) {
+            perror("fork");
+        } else if (cpid == 0) {
+            // Child process
+            runStage(stage, inFD, outFD, pgid);
+        }
+        statsRecord(STATS_SPAWN, start);
+        if (cpid > 0 && pgid != -1) {
+            // Also set the group here, so it exists whichever process runs first
+            setpgid(cpid, pgid == 0 ? cpid : pgid);
+        }
+        return cpid;
+    }
+
+    int fds[3] = { inFD, outFD, -1 };
+    int files[3] = { -1, -1, -1 };
+    pid_t cpid = -1;
+    if (openRedirect(stage->input, O_RDONLY, &files[0]) == 0 &&
+        openRedirect(stage->output, O_WRONLY | O_CREAT | (stage->append ? O_APPEND : O_TRUNC), &files[1]) == 0 &&
+        openRedirect(stage->error, O_WRONLY | O_CREAT | O_TRUNC, &files[2]) == 0) {
+        for (int fd = 0; fd < 3; fd++) {
+            if (files[fd] != -1) {
+                fds[fd] = files[fd];
+            }
+        }
+        cpid = spawnCommand(stage->argv, fds, varsEnviron(), pgid);
+        if (cpid == -1 && errno == ENOENT && strchr(stage->argv[0], '/') == NULL) {
+            fprintf(stderr, "%s: command not found\n", stage->argv[0]);
+        } else if (cpid == -1) {
+            fprintf(stderr, "%s: %s\n", stage->argv[0], strerror(errno));
+        }
+    }
+
+    for (int fd = 0; fd < 3; fd++) {
+        if (files[fd] != -1) {
+            close(files[fd]);
+        }
+    }
+    return cpid;
+}
+
+/*
+* pipelineRun starts every stage before waiting for any of them, connecting
+* neighbouring stages with pipes. External commands are started with
+* spawnCommand; builtins in a pipeline need a forked copy of the shell.
+* A lone builtin in the foreground runs inside the shell. When the shell has a
+* terminal, each pipeline gets a process group of its own, led by its first stage.
+* Waiting is left to the job table.
+*/
+int pipelineRun(struct pipeline* pl, const char* command, int background, struct rusage* usage)
+{
+    if (usage != NULL) {
+        memset(usage, 0, sizeof(*usage));
+    }
+    if (!background && pl->count == 1 && isBuiltIn(pl->stages[0].argv[0])) {
+        if (usage == NULL) {
+            return runBuiltinInShell(&pl->stages[0]);
+        }
+        // The builtin's resources are what the shell itself used meanwhile
+        struct rusage before;
+        getrusage(RUSAGE_SELF, &before);
+        int status = runBuiltinInShell(&pl->stages[0]);
+        getrusage(RUSAGE_SELF, usage);
+        timersub(&usage->ru_utime, &before.ru_utime, &usage->ru_utime);
+        timersub(&usage->ru_stime, &before.ru_stime, &usage->ru_stime);
+        usage->ru_nvcsw -= before.ru_nvcsw;
+        usage->ru_nivcsw -= before.ru_nivcsw;
+        return status;
+    }
+
+    pid_t* pids = malloc(pl->count * sizeof(pid_t));
+    if (pids == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Anything still buffered would otherwise be written again by every child
+    outFlush();
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pgid = shell.jobControl ? 0 : -1;
+    int inFD = -1;
+    for (int i = 0; i < pl->count; i++) {
+        pids[i] = -1;
+        int fds[2] = { -1, -1 };
+        if (i < pl->count - 1) {
+            if (pipe2(fds, O_CLOEXEC) == -1) {
+                perror("pipe");
+                fds[0] = fds[1] = -1;
+            }
+            // Larger pipes mean fewer context switches between producer and consumer
+            fcntl(fds[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+        }
+
+        pids[i] = launchStage(&pl->stages[i], inFD, fds[1], pgid);
+        if (pgid == 0 && pids[i] != -1) {
+            pgid = pids[i];
+        }
+
+        if (inFD != -1) {
+            close(inFD);
+        }
+        if (fds[1] != -1) {
+            close(fds[1]);
+        }
+        inFD = fds[0];
+    }
+    if (inFD != -1) {
+        close(inFD);
+    }
+
+    return jobsStart(pids, pl->count, pgid > 0 ? pgid : -1, command, background, usage);
+}
@@ -0,0 +1,52 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <sys/resource.h>
+#include "arena.h"
+
+/* stage
+* One command of a pipeline together with its redirections.
+* argv      the command and its arguments, NULL terminated
+* argc      the number of entries in argv
+* input     file for '<', or NULL
+* output    file for '>' or '>>', or NULL
+* append    nonzero if output was given with '>>'
+* error     file for '2>', or NULL
+*/
+struct stage {
+    char** argv;
+    int argc;
+    const char* input;
+    const char* output;
+    int append;
+    const char* error;
+};
+
+/* pipeline
+* stages    the stages in order, stdout of each feeding stdin of the next
+* count     the number of stages
+*/
+struct pipeline {
+    struct stage* stages;
+    int count;
+};
+
+/*pipelineParse
+* args      the arguments produced by argparse
+* argc      the number of arguments
+* pl        the pipeline to fill in; its argv arrays point at the strings in args
+* arena     the arena the stages are allocated from; they last until it is reset
+* returns 0 on success, -1 on a syntax error (already reported)
+*/
+int pipelineParse(char** args, int argc, struct pipeline* pl, struct arena* arena);
+
+/*pipelineRun
+* pl          a parsed pipeline
+* command     the command line, shown by jobs
+* background  nonzero to run it as a background job instead of waiting
+* usage       if not NULL, receives the resources the pipeline used once it is done
+* returns the exit status of the last stage, or 0 for a background job
+*/
+int pipelineRun(struct pipeline* pl, const char* command, int background, struct rusage* usage);
+
+#endif
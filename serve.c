@@ -0,0 +1,446 @@
+// Command server: runs command lines sent over a Unix socket
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "serve.h"
+#include "shell.h"
+#include "outbuf.h"
+
+#define SERVE_BUFFER_SIZE (64 * 1024)
+
+/* conn
+* The connection served by this forked copy of the shell.
+* fd          the client socket, or -1 once the session is over
+* captured    nonzero while the command's stdout and stderr are the memfds below
+* outFD       memfd collecting stdout for a client that sent no descriptors
+* errFD       the same for stderr
+* nullFD      /dev/null, left on 0, 1 and 2 between commands
+*/
+static struct {
+    int fd;
+    int captured;
+    int outFD;
+    int errFD;
+    int nullFD;
+} conn = { -1, 0, -1, -1, -1 };
+
+// Control message space for the three descriptors a command frame may carry
+union serveControl {
+    char buffer[CMSG_SPACE(3 * sizeof(int))];
+    struct cmsghdr align;
+};
+
+/*
+* sendAll is a helper function that writes every byte of iov to the socket,
+* attaching fds (if nfds > 0) to the first byte.
+* returns 0, or -1 with errno set
+*/
+static int sendAll(int fd, struct iovec* iov, int count, const int* fds, int nfds)
+{
+    union serveControl control;
+    struct msghdr msg = { .msg_iov = iov, .msg_iovlen = count };
+    if (nfds > 0) {
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    while (msg.msg_iovlen > 0) {
+        ssize_t n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        // The descriptors went with the first byte
+        msg.msg_control = NULL;
+        msg.msg_controllen = 0;
+        while (msg.msg_iovlen > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (n > 0) {
+            msg.msg_iov->iov_base = (char*)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/*
+* sendFrame is a helper function that sends one frame with its payload.
+* returns 0, or -1 with errno set
+*/
+static int sendFrame(int fd, uint32_t type, const void* data, size_t len, const int* fds, int nfds)
+{
+    struct serveFrame frame = { type, (uint32_t)len };
+    struct iovec iov[2] = { { &frame, sizeof(frame) }, { (void*)data, len } };
+    return sendAll(fd, iov, 2, fds, nfds);
+}
+
+/*
+* readAll is a helper function that reads exactly len bytes.
+* returns 1, 0 at end of file, or -1 with errno set
+*/
+static int readAll(int fd, void* data, size_t len)
+{
+    size_t have = 0;
+    while (have < len) {
+        ssize_t n = read(fd, (char*)data + have, len - have);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return (n == 0 && have == 0) ? 0 : -1;
+        }
+        have += n;
+    }
+    return 1;
+}
+
+/*
+* recvHeader is a helper function that reads a frame header and any
+* descriptors attached to it. Up to three are kept in fds; any others are closed.
+* returns 1, 0 at end of file, or -1 with errno set
+*/
+static int recvHeader(int fd, struct serveFrame* frame, int fds[3], int* nfds)
+{
+    *nfds = 0;
+    size_t have = 0;
+    while (have < sizeof(*frame)) {
+        union serveControl control;
+        struct iovec iov = { (char*)frame + have, sizeof(*frame) - have };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer) };
+        ssize_t n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n == -1 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return (n == 0 && have == 0) ? 0 : -1;
+        }
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+                continue;
+            }
+            int count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            int* received = (int*)CMSG_DATA(cmsg);
+            for (int i = 0; i < count; i++) {
+                if (*nfds < 3) {
+                    fds[(*nfds)++] = received[i];
+                } else {
+                    close(received[i]);
+                }
+            }
+        }
+        have += n;
+    }
+    return 1;
+}
+
+/*
+* sendCaptured is a helper function that sends what a command wrote to a
+* capture memfd as one frame, straight from the page cache, then empties it.
+*/
+static void sendCaptured(int memFD, uint32_t type)
+{
+    struct stat st;
+    if (fstat(memFD, &st) == -1 || st.st_size == 0) {
+        return;
+    }
+    struct serveFrame frame = { type, (uint32_t)st.st_size };
+    struct iovec iov = { &frame, sizeof(frame) };
+    if (sendAll(conn.fd, &iov, 1, NULL, 0) == 0) {
+        off_t offset = 0;
+        while (offset < st.st_size) {
+            ssize_t n = sendfile(conn.fd, memFD, &offset, st.st_size - offset);
+            if (n == 0 || (n == -1 && errno != EINTR)) {
+                break;
+            }
+        }
+    }
+    if (ftruncate(memFD, 0) == -1) {
+        perror("ftruncate");
+    }
+    lseek(memFD, 0, SEEK_SET);
+}
+
+/*
+* serveFinish is a helper function that ends a command: it flushes what the
+* shell buffered, sends any captured output, lets go of the client's
+* descriptors and reports the status in a frame of the given type.
+*/
+static void serveFinish(uint32_t type)
+{
+    fflush(stdout);
+    fflush(stderr);
+    outFlush();
+    if (conn.captured) {
+        sendCaptured(conn.outFD, SERVE_STDOUT);
+        sendCaptured(conn.errFD, SERVE_STDERR);
+    }
+    // The client sees end of file once the command's own processes are done with them
+    for (int i = 0; i <= STDERR_FILENO; i++) {
+        dup2(conn.nullFD, i);
+    }
+    int32_t status = shell.lastStatus;
+    if (sendFrame(conn.fd, type, &status, sizeof(status), NULL, 0) == -1) {
+        conn.fd = -1;
+    }
+}
+
+/*
+* serveAtExit answers the command that ended the session, such as exit
+* or a failure under set -e.
+*/
+static void serveAtExit(void)
+{
+    if (conn.fd != -1) {
+        serveFinish(SERVE_EXIT);
+    }
+}
+
+/*
+* serveCommand is a helper function that runs one command line with the
+* client's descriptors, or with the capture memfds if it sent none.
+*/
+static void serveCommand(const char* line, size_t len, int* fds, int nfds)
+{
+    if (nfds == 3) {
+        for (int i = 0; i < 3; i++) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        conn.captured = 0;
+    } else {
+        for (int i = 0; i < nfds; i++) {
+            close(fds[i]);
+        }
+        if (conn.outFD == -1) {
+            conn.outFD = memfd_create("myshell-stdout", MFD_CLOEXEC);
+            conn.errFD = memfd_create("myshell-stderr", MFD_CLOEXEC);
+        }
+        dup2(conn.nullFD, STDIN_FILENO);
+        dup2(conn.outFD, STDOUT_FILENO);
+        dup2(conn.errFD, STDERR_FILENO);
+        conn.captured = 1;
+    }
+    processline(line, len);
+    serveFinish(SERVE_STATUS);
+}
+
+/*
+* serveConnection runs in the forked copy of the shell that owns one
+* connection, so the session's cwd, environment and jobs stay its own.
+*/
+static void serveConnection(int fd)
+{
+    conn.fd = fd;
+    conn.nullFD = open("/dev/null", O_RDWR | O_CLOEXEC);
+    atexit(serveAtExit);
+
+    char* line = NULL;
+    size_t size = 0;
+    while (conn.fd != -1) {
+        struct serveFrame frame;
+        int fds[3];
+        int nfds;
+        if (recvHeader(fd, &frame, fds, &nfds) <= 0) {
+            break;
+        }
+        if (frame.type != SERVE_COMMAND || frame.length > SERVE_MAX_COMMAND) {
+            for (int i = 0; i < nfds; i++) {
+                close(fds[i]);
+            }
+            break;
+        }
+        if (frame.length > size) {
+            char* bigger = realloc(line, frame.length);
+            if (bigger == NULL) {
+                break;
+            }
+            line = bigger;
+            size = frame.length;
+        }
+        if (frame.length > 0 && readAll(fd, line, frame.length) <= 0) {
+            break;
+        }
+        serveCommand(line, frame.length, fds, nfds);
+    }
+    conn.fd = -1;
+    free(line);
+    exit(shell.lastStatus);
+}
+
+/*
+* serveAddress is a helper function that fills in a socket address.
+* returns 0, or -1 if path does not fit (already reported)
+*/
+static int serveAddress(const char* path, struct sockaddr_un* addr)
+{
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+int serveRun(const char* path)
+{
+    struct sockaddr_un addr;
+    if (serveAddress(path, &addr) == -1) {
+        return 1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        perror("socket");
+        return 1;
+    }
+
+    // Replace a socket left behind by a server that is gone, but never a live one
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            fprintf(stderr, "%s: a server is already listening\n", path);
+            close(fd);
+            return 1;
+        }
+        unlink(path);
+    }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        perror(path);
+        close(fd);
+        return 1;
+    }
+
+    while (1) {
+        int client = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+        // Reap the copies whose connections have closed
+        while (waitpid(-1, NULL, WNOHANG) > 0) {
+        }
+        if (client == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            perror("accept");
+            close(fd);
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fd);
+            serveConnection(client);
+        }
+        if (pid == -1) {
+            perror("fork");
+        }
+        close(client);
+    }
+}
+
+/*
+* clientRun is a helper function that sends one command and copies any
+* output frames to stdout and stderr until the status arrives. *ended is
+* set if the command ended the session.
+* returns the status, or -1 if the server hung up first
+*/
+static int clientRun(int fd, const char* command, size_t len, const int fds[3], int* ended)
+{
+    if (sendFrame(fd, SERVE_COMMAND, command, len, fds, 3) == -1) {
+        return -1;
+    }
+
+    char buffer[SERVE_BUFFER_SIZE];
+    struct serveFrame frame;
+    while (readAll(fd, &frame, sizeof(frame)) == 1) {
+        if (frame.type == SERVE_STATUS || frame.type == SERVE_EXIT) {
+            *ended = (frame.type == SERVE_EXIT);
+            int32_t status;
+            return (frame.length == sizeof(status) && readAll(fd, &status, sizeof(status)) == 1) ? status : -1;
+        }
+        int out = (frame.type == SERVE_STDERR) ? STDERR_FILENO : STDOUT_FILENO;
+        for (uint32_t left = frame.length; left > 0; ) {
+            size_t chunk = (left < sizeof(buffer)) ? left : sizeof(buffer);
+            if (readAll(fd, buffer, chunk) != 1) {
+                return -1;
+            }
+            if (frame.type == SERVE_STDOUT || frame.type == SERVE_STDERR) {
+                if (write(out, buffer, chunk) == -1 && errno != EINTR) {
+                    perror("write");
+                }
+            }
+            left -= chunk;
+        }
+    }
+    return -1;
+}
+
+int serveClient(const char* path, const char* command)
+{
+    struct sockaddr_un addr;
+    if (serveAddress(path, &addr) == -1) {
+        return 255;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        perror(path);
+        return 255;
+    }
+
+    int status = 0;
+    int ended = 0;
+    if (command != NULL) {
+        const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+        status = clientRun(fd, command, strlen(command), fds, &ended);
+    } else {
+        // stdin holds the commands, so they get an empty one
+        int nullFD = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        const int fds[3] = { nullFD, STDOUT_FILENO, STDERR_FILENO };
+        char* line = NULL;
+        size_t size = 0;
+        ssize_t len;
+        while (status != -1 && !ended && (len = getline(&line, &size, stdin)) != -1) {
+            if (len > 0 && line[len - 1] == '\n') {
+                len--;
+            }
+            if (len > 0) {
+                status = clientRun(fd, line, len, fds, &ended);
+            }
+        }
+        free(line);
+        if (nullFD != -1) {
+            close(nullFD);
+        }
+    }
+    close(fd);
+
+    if (status == -1) {
+        fprintf(stderr, "%s: server closed the connection\n", path);
+        return 255;
+    }
+    return status;
+}
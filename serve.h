@@ -0,0 +1,52 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+
+/* Command server protocol, spoken over a Unix stream socket.
+ * Every message is a serveFrame header followed by length bytes of payload.
+ *
+ * The client sends SERVE_COMMAND frames, each holding one command line.
+ * It may attach three descriptors to a frame with SCM_RIGHTS; the command
+ * then runs with them as its stdin, stdout and stderr, so its output reaches
+ * the client as it is written. Without descriptors the command reads
+ * /dev/null, and what it writes is sent back afterwards in SERVE_STDOUT and
+ * SERVE_STDERR frames.
+ *
+ * Every command is answered with a SERVE_STATUS frame whose payload is the
+ * exit status as an int32_t. A connection is a shell session of its own:
+ * cd, env, set and jobs in one never affect another. A command that ends
+ * the session, exit or a failure under set -e, is answered with SERVE_EXIT
+ * instead, and the server then closes the connection.
+ */
+struct serveFrame {
+    uint32_t type;
+    uint32_t length;
+};
+
+#define SERVE_COMMAND 'c'
+#define SERVE_STDOUT  'o'
+#define SERVE_STDERR  'e'
+#define SERVE_STATUS  's'
+#define SERVE_EXIT    'x'
+
+#define SERVE_MAX_COMMAND (1 << 24)
+
+/*serveRun
+* path      where to create the listening socket; a stale socket there is replaced
+* Accepts connections until the process is killed, each one served by a
+* forked copy of the shell.
+* returns 1 if the socket could not be set up (already reported)
+*/
+int serveRun(const char* path);
+
+/*serveClient
+* path      the socket of a running server
+* command   the command to run with the client's own stdin, stdout and stderr,
+*           or NULL to send each line of stdin as a command
+* returns the exit status of the last command, or 255 if the server could not
+*         be reached or hung up before answering
+*/
+int serveClient(const char* path, const char* command);
+
+#endif
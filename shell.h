@@ -0,0 +1,29 @@
+#ifndef SHELL_H
+#define SHELL_H
+
+#include <stddef.h>
+
+/* shellState
+* State shared between the command loop and the builtins that change it.
+* lastStatus    the exit status of the most recent command
+* interactive   nonzero when commands are typed at a terminal
+* jobControl    nonzero when pipelines get process groups and the terminal is handed to them
+* errexit       nonzero after set -e: the shell exits as soon as a command fails
+*/
+struct shellState {
+    int lastStatus;
+    int interactive;
+    int jobControl;
+    int errexit;
+};
+
+extern struct shellState shell;
+
+/*processline
+* line      one command line; it need not be NUL terminated
+* len       the length of line
+* returns the exit status of the command
+*/
+int processline(const char* line, size_t len);
+
+#endif
@@ -0,0 +1,114 @@
+// Process launch engine built on posix_spawn
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <spawn.h>
+#include "spawncmd.h"
+#include "cmdhash.h"
+#include "stats.h"
+
+// Signal state for children, set once by spawnSetSignals
+static sigset_t childDefaults;
+static sigset_t childMask;
+static int childSignalsSet;
+
+void spawnSetSignals(const sigset_t* defaults, const sigset_t* mask)
+{
+    childDefaults = *defaults;
+    childMask = *mask;
+    childSignalsSet = 1;
+}
+
+/*
+* timedSpawn is a helper function that calls posix_spawn, recording the time
+* since start as preparation and the call itself as the exec.
+*/
+static int timedSpawn(pid_t* pid, const char* path, const posix_spawn_file_actions_t* actions,
+                      const posix_spawnattr_t* attr, char** argv, char** envp, uint64_t start)
+{
+    statsRecord(STATS_SPAWN, start);
+    uint64_t execStart = statsNow();
+    int err = posix_spawn(pid, path, actions, attr, argv, envp);
+    statsRecord(STATS_EXEC, execStart);
+    return err;
+}
+
+/* spawnCommand
+ * Commands without a '/' are resolved through the cmdhash PATH cache and
+ * executed by absolute path, so PATH is only searched the first time.
+ * posix_spawn starts the child with clone(CLONE_VM | CLONE_VFORK), so
+ * unlike fork its cost does not grow with the shell's resident memory and
+ * page tables. The descriptor setup the child needs is described up front
+ * as file actions and carried out in the child before the exec, and the
+ * process group and signal state as spawn attributes.
+ */
+pid_t spawnCommand(char** argv, const int fds[3], char** envp, pid_t pgid)
+{
+    uint64_t start = statsNow();
+    posix_spawn_file_actions_t actions;
+    int err = posix_spawn_file_actions_init(&actions);
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    posix_spawnattr_t attr;
+    err = posix_spawnattr_init(&attr);
+    if (err != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        errno = err;
+        return -1;
+    }
+
+    short flags = 0;
+    if (childSignalsSet) {
+        posix_spawnattr_setsigdefault(&attr, &childDefaults);
+        posix_spawnattr_setsigmask(&attr, &childMask);
+        flags |= POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    }
+    if (pgid != -1) {
+        posix_spawnattr_setpgroup(&attr, pgid);
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+
+    for (int fd = 0; fd < 3 && err == 0; fd++) {
+        if (fds[fd] != -1 && fds[fd] != fd) {
+            err = posix_spawn_file_actions_adddup2(&actions, fds[fd], fd);
+        }
+    }
+
+    pid_t pid = -1;
+    if (err == 0) {
+        if (strchr(argv[0], '/') != NULL) {
+            err = timedSpawn(&pid, argv[0], &actions, &attr, argv, envp, start);
+        } else {
+            // Run from the remembered PATH location; if that went stale, search once more
+            for (int attempt = 0; attempt < 2; attempt++) {
+                const char* path = cmdhashLookup(argv[0]);
+                if (path == NULL) {
+                    err = ENOENT;
+                    break;
+                }
+                err = timedSpawn(&pid, path, &actions, &attr, argv, envp, start);
+                if (err != ENOENT) {
+                    break;
+                }
+                cmdhashForget(argv[0]);
+                start = statsNow();
+            }
+        }
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return pid;
+}
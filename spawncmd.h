@@ -0,0 +1,25 @@
+#ifndef SPAWNCMD_H
+#define SPAWNCMD_H
+
+#include <signal.h>
+#include <sys/types.h>
+
+/*spawnCommand
+* argv      the command and its arguments, NULL terminated; argv[0] is
+*           looked up in PATH unless it contains a '/'
+* fds       for each of stdin, stdout and stderr, the descriptor the child
+*           should get in its place, or -1 to inherit the shell's own
+* envp      the environment for the new program
+* pgid      the process group to put the child in, 0 for a new group of its own,
+*           or -1 to leave it in the shell's
+* returns the pid of the child, or -1 with errno set if it could not be started
+*/
+pid_t spawnCommand(char** argv, const int fds[3], char** envp, pid_t pgid);
+
+/*spawnSetSignals
+* defaults  signals the shell ignores that commands should get back at their default
+* mask      the signal mask commands should start with
+*/
+void spawnSetSignals(const sigset_t* defaults, const sigset_t* mask);
+
+#endif
@@ -0,0 +1,68 @@
+// Concurrent statx lookups for the stat builtin
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "statbatch.h"
+#include "wspool.h"
+
+#define STATBATCH_WINDOW 4096   // results held before they are handed back
+#define STATBATCH_CHUNK 16      // paths looked up by one pool task
+#define STATBATCH_SERIAL 32     // below this starting a pool costs more than it saves
+
+// The outcome of one lookup
+struct statSlot {
+    struct statx stx;
+    int error;
+};
+
+// The paths of one window and where their results go
+struct statWindow {
+    char* const* paths;
+    struct statSlot* slots;
+    int dirFD;
+    unsigned int mask;
+    int flags;
+};
+
+static void statItem(int index, int worker, void* ctx)
+{
+    (void)worker;
+    struct statWindow* w = ctx;
+    struct statSlot* slot = &w->slots[index];
+    slot->error = (statx(w->dirFD, w->paths[index], w->flags, w->mask, &slot->stx) == -1) ? errno : 0;
+}
+
+void statBatch(int dirFD, char* const* paths, int count, unsigned int mask, int flags, int threads,
+               statEmitFn emit, void* ctx)
+{
+    // Without a pool the lookups still work, just one at a time
+    struct wsPool* pool = (threads >= 2 && count >= STATBATCH_SERIAL) ? wspoolCreate(threads) : NULL;
+    int window = (pool == NULL) ? 1 : (count < STATBATCH_WINDOW) ? count : STATBATCH_WINDOW;
+    struct statSlot single;
+    struct statSlot* slots = (window > 1) ? malloc(window * sizeof(struct statSlot)) : &single;
+    if (slots == NULL) {
+        slots = &single;
+        window = 1;
+    }
+
+    struct statWindow w = { NULL, slots, dirFD, mask, flags };
+    for (int base = 0; base < count; base += window) {
+        int n = (count - base < window) ? count - base : window;
+        w.paths = paths + base;
+        wspoolForEach(window > 1 ? pool : NULL, n, STATBATCH_CHUNK, statItem, &w);
+        for (int i = 0; i < n; i++) {
+            emit(paths[base + i], &slots[i].stx, slots[i].error, ctx);
+        }
+    }
+
+    if (pool != NULL) {
+        wspoolDestroy(pool);
+    }
+    if (slots != &single) {
+        free(slots);
+    }
+}
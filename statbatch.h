@@ -0,0 +1,33 @@
+#ifndef STATBATCH_H
+#define STATBATCH_H
+
+#include <sys/stat.h>
+
+/* statBatch looks up the metadata of many paths at once. The statx calls
+ * run concurrently on a thread pool, a window of paths at a time, while the
+ * results are handed back on the calling thread in argument order, so the
+ * caller can print them without any locking.
+ */
+
+/*statEmitFn
+* path      the path that was looked up
+* stx       its metadata; only the fields in stx->stx_mask are valid
+* error     0, or the errno statx failed with (stx is then undefined)
+* ctx       the context given to statBatch
+*/
+typedef void (*statEmitFn)(const char* path, const struct statx* stx, int error, void* ctx);
+
+/*statBatch
+* dirFD     the directory relative paths are looked up from, or AT_FDCWD
+* paths     the paths to look up
+* count     the number of paths
+* mask      the STATX_* fields the caller needs
+* flags     the AT_* flags passed to statx
+* threads   the number of lookups to run at once; 1 or a short list runs serially
+* emit      called once per path, in order, on the calling thread
+* ctx       passed through to emit
+*/
+void statBatch(int dirFD, char* const* paths, int count, unsigned int mask, int flags, int threads,
+               statEmitFn emit, void* ctx);
+
+#endif
@@ -0,0 +1,108 @@
+// Always-on phase timing for the command loop
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "stats.h"
+
+#define STATS_BUCKETS 64
+
+struct phaseStats {
+    uint64_t count;
+    uint64_t total;
+    uint64_t min;
+    uint64_t max;
+    uint64_t buckets[STATS_BUCKETS];  // bucket i counts times in [2^i, 2^(i+1)) ns
+};
+
+static struct phaseStats phases[STATS_PHASES];
+
+static const char* phaseNames[STATS_PHASES] = {
+    [STATS_GETINPUT] = "getinput",
+    [STATS_ARGPARSE] = "argparse",
+    [STATS_BUILTIN]  = "builtin",
+    [STATS_SPAWN]    = "spawn",
+    [STATS_EXEC]     = "exec",
+    [STATS_WAIT]     = "wait",
+};
+
+uint64_t statsNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + now.tv_nsec;
+}
+
+void statsRecord(enum statsPhase phase, uint64_t start)
+{
+    uint64_t elapsed = statsNow() - start;
+    struct phaseStats* stats = &phases[phase];
+
+    if (stats->count == 0 || elapsed < stats->min) {
+        stats->min = elapsed;
+    }
+    if (elapsed > stats->max) {
+        stats->max = elapsed;
+    }
+    stats->count++;
+    stats->total += elapsed;
+    stats->buckets[elapsed ? 63 - __builtin_clzll(elapsed) : 0]++;
+}
+
+void statsReset(void)
+{
+    memset(phases, 0, sizeof(phases));
+}
+
+/*
+* percentile is a helper function that estimates a percentile from the
+* histogram as the upper end of the bucket it falls in, capped at the maximum.
+*/
+static uint64_t percentile(const struct phaseStats* stats, double fraction)
+{
+    uint64_t rank = (uint64_t)(stats->count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < STATS_BUCKETS; i++) {
+        seen += stats->buckets[i];
+        if (seen > rank) {
+            uint64_t upper = (i < 63) ? (2ull << i) - 1 : UINT64_MAX;
+            return upper < stats->max ? upper : stats->max;
+        }
+    }
+    return stats->max;
+}
+
+void statsPrint(int json)
+{
+    if (json) {
+        printf("{");
+        for (int p = 0; p < STATS_PHASES; p++) {
+            const struct phaseStats* stats = &phases[p];
+            printf("%s\"%s\":{\"count\":%llu,\"total_ns\":%llu,\"min_ns\":%llu,\"max_ns\":%llu,"
+                   "\"p50_ns\":%llu,\"p99_ns\":%llu,\"histogram\":{",
+                   p ? "," : "", phaseNames[p], (unsigned long long)stats->count,
+                   (unsigned long long)stats->total, (unsigned long long)stats->min,
+                   (unsigned long long)stats->max, (unsigned long long)percentile(stats, 0.50),
+                   (unsigned long long)percentile(stats, 0.99));
+            // Keys are the lower bound of each bucket in nanoseconds
+            int first = 1;
+            for (int i = 0; i < STATS_BUCKETS; i++) {
+                if (stats->buckets[i] != 0) {
+                    printf("%s\"%llu\":%llu", first ? "" : ",", 1ull << i, (unsigned long long)stats->buckets[i]);
+                    first = 0;
+                }
+            }
+            printf("}}");
+        }
+        printf("}\n");
+        return;
+    }
+
+    printf("%-10s %10s %12s %12s %12s %12s %12s\n", "phase", "count", "mean(us)", "min(us)", "p50(us)", "p99(us)", "max(us)");
+    for (int p = 0; p < STATS_PHASES; p++) {
+        const struct phaseStats* stats = &phases[p];
+        printf("%-10s %10llu %12.3f %12.3f %12.3f %12.3f %12.3f\n", phaseNames[p], (unsigned long long)stats->count,
+               stats->count ? stats->total / 1e3 / stats->count : 0.0, stats->min / 1e3,
+               percentile(stats, 0.50) / 1e3, percentile(stats, 0.99) / 1e3, stats->max / 1e3);
+    }
+}
@@ -0,0 +1,48 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+
+/* The phases of running a command that are timed. Every phase keeps a count,
+* the total, smallest and largest time, and a histogram with one bucket per
+* power of two nanoseconds.
+* STATS_GETINPUT    reading input; at a terminal this includes waiting for the user
+* STATS_ARGPARSE    tokenizing a line
+* STATS_BUILTIN     dispatching to a builtin and running it
+* STATS_SPAWN       preparing a launch: fork for builtin stages, PATH lookup
+*                   and spawn attributes for external commands
+* STATS_EXEC        posix_spawn itself, which returns once the child has exec'd
+* STATS_WAIT        waiting for a foreground job
+*/
+enum statsPhase {
+    STATS_GETINPUT,
+    STATS_ARGPARSE,
+    STATS_BUILTIN,
+    STATS_SPAWN,
+    STATS_EXEC,
+    STATS_WAIT,
+    STATS_PHASES
+};
+
+/*statsNow
+* returns the monotonic clock in nanoseconds
+*/
+uint64_t statsNow(void);
+
+/*statsRecord
+* phase     the phase that ended
+* start     the statsNow value when it began
+*/
+void statsRecord(enum statsPhase phase, uint64_t start);
+
+/*statsPrint
+* json      nonzero for one JSON object, zero for a table
+*/
+void statsPrint(int json);
+
+/*statsReset
+* Forgets everything recorded so far.
+*/
+void statsReset(void);
+
+#endif
@@ -0,0 +1,253 @@
+// Shell variables
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include "vars.h"
+#include "cmdhash.h"
+
+#define VARS_INITIAL_SLOTS 128
+
+/* varSlot
+* entry       "NAME=value", or NULL for an empty slot
+* nameLen     the length of NAME
+* hash        the hash of NAME, so probes and resizes never rehash
+* exported    nonzero if the variable is in the environment of commands
+*/
+struct varSlot {
+    char* entry;
+    size_t nameLen;
+    uint32_t hash;
+    int exported;
+};
+
+// Linear probing over a power-of-two table kept at most half full
+static struct varSlot* slots;
+static size_t slotCount;
+static size_t varCount;
+
+// The environment of commands, rebuilt on the first use after a change
+static char** envp;
+static size_t envpCapacity;
+static int envpValid;
+
+static int status;
+static char statusText[16];
+static int statusValid;
+static char pidText[16];
+
+static uint32_t nameHash(const char* name, size_t len)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+* findSlot is a helper function that returns the slot holding name,
+* or the empty slot where it would go.
+*/
+static struct varSlot* findSlot(const char* name, size_t len, uint32_t hash)
+{
+    size_t mask = slotCount - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        struct varSlot* slot = &slots[i];
+        if (slot->entry == NULL ||
+            (slot->hash == hash && slot->nameLen == len && memcmp(slot->entry, name, len) == 0)) {
+            return slot;
+        }
+    }
+}
+
+static int grow(void)
+{
+    size_t oldCount = slotCount;
+    struct varSlot* old = slots;
+    size_t newCount = oldCount ? oldCount * 2 : VARS_INITIAL_SLOTS;
+    struct varSlot* grown = calloc(newCount, sizeof(struct varSlot));
+    if (grown == NULL) {
+        return -1;
+    }
+    slots = grown;
+    slotCount = newCount;
+    for (size_t i = 0; i < oldCount; i++) {
+        if (old[i].entry != NULL) {
+            *findSlot(old[i].entry, old[i].nameLen, old[i].hash) = old[i];
+        }
+    }
+    free(old);
+    return 0;
+}
+
+/*
+* store is a helper function that puts a "NAME=value" string, which the table
+* takes over, in the slot for its name.
+*/
+static int store(char* entry, size_t nameLen, int export)
+{
+    if ((varCount + 1) * 2 > slotCount && grow() == -1) {
+        free(entry);
+        return -1;
+    }
+    uint32_t hash = nameHash(entry, nameLen);
+    struct varSlot* slot = findSlot(entry, nameLen, hash);
+    if (slot->entry == NULL) {
+        varCount++;
+        slot->exported = export;
+    } else {
+        free(slot->entry);
+        slot->exported |= export;
+    }
+    slot->entry = entry;
+    slot->nameLen = nameLen;
+    slot->hash = hash;
+    envpValid = 0;
+
+    // Remembered command locations may no longer match the new search path
+    if (nameLen == 4 && memcmp(entry, "PATH", 4) == 0) {
+        cmdhashClear();
+    }
+    return 0;
+}
+
+void varsInit(char** environment)
+{
+    snprintf(pidText, sizeof(pidText), "%d", (int)getpid());
+    for (char** env = environment; *env != NULL; env++) {
+        const char* equals = strchr(*env, '=');
+        char* entry = strdup(*env);
+        if (equals == NULL || entry == NULL) {
+            free(entry);
+            continue;
+        }
+        store(entry, equals - *env, 1);
+    }
+}
+
+size_t varsNameLength(const char* s, size_t len)
+{
+    size_t i = 0;
+    if (len == 0 || !((s[0] >= 'A' && s[0] <= 'Z') || (s[0] >= 'a' && s[0] <= 'z') || s[0] == '_')) {
+        return 0;
+    }
+    while (i < len && ((s[i] >= 'A' && s[i] <= 'Z') || (s[i] >= 'a' && s[i] <= 'z') ||
+                       (s[i] >= '0' && s[i] <= '9') || s[i] == '_')) {
+        i++;
+    }
+    return i;
+}
+
+const char* varsGet(const char* name, size_t len)
+{
+    if (len == 1 && name[0] == '?') {
+        if (!statusValid) {
+            snprintf(statusText, sizeof(statusText), "%d", status);
+            statusValid = 1;
+        }
+        return statusText;
+    }
+    if (len == 1 && name[0] == '$') {
+        return pidText;
+    }
+    if (slotCount == 0) {
+        return NULL;
+    }
+    struct varSlot* slot = findSlot(name, len, nameHash(name, len));
+    return slot->entry ? slot->entry + len + 1 : NULL;
+}
+
+int varsSet(const char* name, const char* value, int export)
+{
+    size_t nameLen = strlen(name);
+    if (nameLen == 0 || varsNameLength(name, nameLen) != nameLen) {
+        return -1;
+    }
+    size_t valueLen = strlen(value);
+    char* entry = malloc(nameLen + valueLen + 2);
+    if (entry == NULL) {
+        return -1;
+    }
+    memcpy(entry, name, nameLen);
+    entry[nameLen] = '=';
+    memcpy(entry + nameLen + 1, value, valueLen + 1);
+    return store(entry, nameLen, export);
+}
+
+int varsExport(const char* name)
+{
+    const char* value = varsGet(name, strlen(name));
+    return varsSet(name, value ? value : "", 1);
+}
+
+void varsUnset(const char* name)
+{
+    size_t len = strlen(name);
+    if (slotCount == 0) {
+        return;
+    }
+    struct varSlot* slot = findSlot(name, len, nameHash(name, len));
+    if (slot->entry == NULL) {
+        return;
+    }
+    free(slot->entry);
+    varCount--;
+    envpValid = 0;
+    if (len == 4 && memcmp(name, "PATH", 4) == 0) {
+        cmdhashClear();
+    }
+
+    // Shift later members of the probe run back so lookups never need tombstones
+    size_t mask = slotCount - 1;
+    size_t hole = slot - slots;
+    for (size_t i = (hole + 1) & mask; slots[i].entry != NULL; i = (i + 1) & mask) {
+        size_t home = slots[i].hash & mask;
+        int stays = (hole <= i) ? (hole < home && home <= i) : (hole < home || home <= i);
+        if (!stays) {
+            slots[hole] = slots[i];
+            hole = i;
+        }
+    }
+    slots[hole].entry = NULL;
+}
+
+void varsSetStatus(int value)
+{
+    if (value != status) {
+        status = value;
+        statusValid = 0;
+    }
+}
+
+char** varsEnviron(void)
+{
+    if (envpValid) {
+        return envp;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < slotCount; i++) {
+        count += (slots[i].entry != NULL && slots[i].exported);
+    }
+    if (count + 1 > envpCapacity) {
+        char** grown = realloc(envp, (count + 1) * sizeof(char*));
+        if (grown == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        envp = grown;
+        envpCapacity = count + 1;
+    }
+    count = 0;
+    for (size_t i = 0; i < slotCount; i++) {
+        if (slots[i].entry != NULL && slots[i].exported) {
+            envp[count++] = slots[i].entry;
+        }
+    }
+    envp[count] = NULL;
+    envpValid = 1;
+    return envp;
+}
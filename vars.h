@@ -0,0 +1,64 @@
+#ifndef VARS_H
+#define VARS_H
+
+#include <stddef.h>
+
+/* Shell variables are kept in an open-addressing hash table, each one as a
+ * single "NAME=value" string. The exported ones make up the environment of
+ * the commands the shell starts; that envp array is only rebuilt when a
+ * command is started after a variable changed.
+ * The special parameters $? and $$ are read with varsGet like any other name.
+ */
+
+/*varsInit
+* envp      the environment the shell was started with; each entry becomes an
+*           exported variable
+*/
+void varsInit(char** envp);
+
+/*varsNameLength
+* s         text that may start with a variable name
+* len       the length of s
+* returns the length of the longest valid name at the start of s, 0 if none
+*/
+size_t varsNameLength(const char* s, size_t len);
+
+/*varsGet
+* name      a variable name, or "?" or "$"; need not be NUL terminated
+* len       the length of name
+* returns the value, or NULL if the variable is not set
+*/
+const char* varsGet(const char* name, size_t len);
+
+/*varsSet
+* name      a variable name, NUL terminated
+* value     the new value
+* export    nonzero to export the variable; otherwise a variable that was
+*           exported stays exported and a new one is not
+* returns 0, or -1 if name is not a valid name or memory ran out
+*/
+int varsSet(const char* name, const char* value, int export);
+
+/*varsExport
+* name      a variable name; an unset variable is exported with an empty value
+* returns 0, or -1 if name is not a valid name or memory ran out
+*/
+int varsExport(const char* name);
+
+/*varsUnset
+* name      the variable to remove; unsetting a variable that is not set is not an error
+*/
+void varsUnset(const char* name);
+
+/*varsSetStatus
+* status    the value $? expands to from now on
+*/
+void varsSetStatus(int status);
+
+/*varsEnviron
+* returns the NULL terminated "NAME=value" strings of the exported variables,
+*         valid until a variable changes
+*/
+char** varsEnviron(void);
+
+#endif
@@ -0,0 +1,426 @@
+// Parallel directory tree walker used by the find and du builtins
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include "walk.h"
+#include "wspool.h"
+#include "dirscan.h"
+
+#define WALK_SEEN_STRIPES 64        // separately locked parts of the hard link set
+#define WALK_SEEN_INITIAL_SLOTS 64
+
+// A directory being walked; lives until everything below it is done
+struct walkDir {
+    struct walkJob* job;
+    struct walkDir* parent;     // NULL for a root
+    int fd;                     // closed as soon as every subdirectory has been opened
+    atomic_int fdRefs;          // the reading task plus one per subdirectory not yet opened
+    atomic_int refs;            // the reading task plus one per subdirectory not yet done
+    atomic_ullong total;
+    int depth;
+    size_t pathLen;
+    char path[];
+};
+
+// A subdirectory waiting to be read by a worker
+struct walkPending {
+    struct walkDir* parent;
+    unsigned long long value;   // what visit returned for it
+    char name[];
+};
+
+// A file with several links that has been visited
+struct walkInode {
+    unsigned long long dev;
+    unsigned long long ino;
+    int used;
+};
+
+// One stripe of the hard link set: open addressing, kept at most half full
+struct walkSeen {
+    pthread_mutex_t lock;
+    struct walkInode* slots;
+    size_t capacity;
+    size_t count;
+};
+
+// What each worker keeps between directories
+struct walkWorker {
+    struct dirScan scan;
+    int scanOpen;
+    char* path;                 // the path of the entry being visited
+    size_t capacity;
+};
+
+// State shared by all tasks of one walkTree call
+struct walkJob {
+    const struct walkOptions* opts;
+    struct wsPool* pool;
+    struct walkWorker* workers;
+    int dirFD;
+    atomic_int failed;
+    struct walkSeen seen[WALK_SEEN_STRIPES];
+};
+
+// A root waiting to be walked
+struct walkRoot {
+    struct walkJob* job;
+    const char* path;
+};
+
+static void walkError(struct walkJob* job, const char* path, int err)
+{
+    fprintf(stderr, "%s: '%s': %s\n", job->opts->name, path, strerror(err));
+    atomic_store(&job->failed, 1);
+}
+
+/*
+* walkFirstLink is a helper function that records a file with several links.
+* returns 1 the first time the file is seen, 0 after that
+*/
+static int walkFirstLink(struct walkJob* job, unsigned long long dev, unsigned long long ino)
+{
+    unsigned long long hash = ((dev * 0x9E3779B97F4A7C15ull) ^ ino) * 0x9E3779B97F4A7C15ull;
+    struct walkSeen* seen = &job->seen[(hash >> 58) % WALK_SEEN_STRIPES];
+    int first = 1;
+    pthread_mutex_lock(&seen->lock);
+    if ((seen->count + 1) * 2 > seen->capacity) {
+        size_t capacity = seen->capacity ? seen->capacity * 2 : WALK_SEEN_INITIAL_SLOTS;
+        struct walkInode* slots = calloc(capacity, sizeof(struct walkInode));
+        if (slots == NULL) {
+            // Counting a file twice is better than failing the walk
+            pthread_mutex_unlock(&seen->lock);
+            return 1;
+        }
+        for (size_t i = 0; i < seen->capacity; i++) {
+            if (!seen->slots[i].used) {
+                continue;
+            }
+            unsigned long long h = ((seen->slots[i].dev * 0x9E3779B97F4A7C15ull) ^ seen->slots[i].ino) *
+                                   0x9E3779B97F4A7C15ull;
+            size_t j = (size_t)h & (capacity - 1);
+            while (slots[j].used) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = seen->slots[i];
+        }
+        free(seen->slots);
+        seen->slots = slots;
+        seen->capacity = capacity;
+    }
+    size_t mask = seen->capacity - 1;
+    for (size_t i = (size_t)hash & mask; ; i = (i + 1) & mask) {
+        struct walkInode* slot = &seen->slots[i];
+        if (!slot->used) {
+            *slot = (struct walkInode){ dev, ino, 1 };
+            seen->count++;
+            break;
+        }
+        if (slot->dev == dev && slot->ino == ino) {
+            first = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&seen->lock);
+    return first;
+}
+
+/*
+* walkJoin is a helper function that builds the path of an entry of dir in
+* the worker's path buffer.
+* returns the length of the path
+*/
+static size_t walkJoin(struct walkWorker* self, const struct walkDir* dir, const char* name)
+{
+    size_t nameLen = strlen(name);
+    int slash = (dir->pathLen > 0 && dir->path[dir->pathLen - 1] != '/');
+    size_t len = dir->pathLen + slash + nameLen;
+    if (len + 1 > self->capacity) {
+        size_t capacity = self->capacity ? self->capacity : 256;
+        while (capacity < len + 1) {
+            capacity *= 2;
+        }
+        char* path = realloc(self->path, capacity);
+        if (path == NULL) {
+            fprintf(stderr, "Memory allocation failed\n");
+            exit(EXIT_FAILURE);
+        }
+        self->path = path;
+        self->capacity = capacity;
+    }
+    memcpy(self->path, dir->path, dir->pathLen);
+    self->path[dir->pathLen] = '/';
+    memcpy(self->path + dir->pathLen + slash, name, nameLen + 1);
+    return len;
+}
+
+static struct walkDir* walkNewDir(struct walkJob* job, struct walkDir* parent, int fd,
+                                  const char* path, size_t pathLen, int depth, unsigned long long total)
+{
+    struct walkDir* dir = malloc(sizeof(struct walkDir) + pathLen + 1);
+    if (dir == NULL) {
+        return NULL;
+    }
+    dir->job = job;
+    dir->parent = parent;
+    dir->fd = fd;
+    atomic_init(&dir->fdRefs, 1);
+    atomic_init(&dir->refs, 1);
+    atomic_init(&dir->total, total);
+    dir->depth = depth;
+    dir->pathLen = pathLen;
+    memcpy(dir->path, path, pathLen + 1);
+    return dir;
+}
+
+static void walkReleaseFD(struct walkDir* dir)
+{
+    if (atomic_fetch_sub(&dir->fdRefs, 1) == 1) {
+        close(dir->fd);
+    }
+}
+
+/*
+* walkRelease is a helper function that drops a reference to dir. The last
+* one hands its total to leave and to its parent, and drops the reference
+* it held on the parent in turn.
+*/
+static void walkRelease(struct walkDir* dir, int worker)
+{
+    while (dir != NULL && atomic_fetch_sub(&dir->refs, 1) == 1) {
+        const struct walkOptions* opts = dir->job->opts;
+        struct walkDir* parent = dir->parent;
+        unsigned long long total = atomic_load(&dir->total);
+        if (opts->leave != NULL) {
+            opts->leave(dir->path, total, dir->depth, worker, opts->ctx);
+        }
+        if (parent != NULL) {
+            atomic_fetch_add(&parent->total, total);
+        }
+        free(dir);
+        dir = parent;
+    }
+}
+
+static void walkDirTask(void* arg, int worker);
+
+/* Reads one directory, visits each entry and queues a task for each
+ * subdirectory to descend into. Consumes the caller's reference to dir.
+ */
+static void walkRead(struct walkDir* dir, int worker)
+{
+    struct walkJob* job = dir->job;
+    const struct walkOptions* opts = job->opts;
+    struct walkWorker* self = &job->workers[worker];
+    if (self->scanOpen) {
+        dirscanReset(&self->scan, dir->fd);
+    } else if (dirscanOpen(&self->scan, dir->fd) == 0) {
+        self->scanOpen = 1;
+    } else {
+        walkError(job, dir->path, errno);
+        walkReleaseFD(dir);
+        walkRelease(dir, worker);
+        return;
+    }
+
+    int descend = (opts->maxDepth < 0 || dir->depth + 1 < opts->maxDepth);
+    unsigned long long total = 0;
+    const char* name;
+    unsigned char type;
+    int result;
+    while ((result = dirscanNext(&self->scan, &name, &type)) == 1) {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+
+        struct statx stx;
+        unsigned int mask = opts->mask | (type == DT_UNKNOWN ? STATX_TYPE : 0);
+        if (mask != 0) {
+            if (statx(dir->fd, name, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC, mask, &stx) == -1) {
+                walkJoin(self, dir, name);
+                walkError(job, self->path, errno);
+                continue;
+            }
+            if (type == DT_UNKNOWN) {
+                type = IFTODT(stx.stx_mode);
+            }
+        }
+        if (opts->unique && type != DT_DIR && stx.stx_nlink > 1 &&
+            !walkFirstLink(job, makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino)) {
+            continue;
+        }
+
+        size_t pathLen = walkJoin(self, dir, name);
+        struct walkEntry entry = { self->path, pathLen, self->path + pathLen - strlen(name), type,
+                                   dir->depth + 1, opts->mask ? &stx : NULL };
+        unsigned long long value = opts->visit(&entry, worker, opts->ctx);
+        if (type != DT_DIR || !descend) {
+            total += value;
+            continue;
+        }
+
+        size_t nameLen = strlen(name) + 1;
+        struct walkPending* pending = malloc(sizeof(struct walkPending) + nameLen);
+        if (pending == NULL) {
+            walkError(job, self->path, ENOMEM);
+            continue;
+        }
+        pending->parent = dir;
+        pending->value = value;
+        memcpy(pending->name, name, nameLen);
+        atomic_fetch_add(&dir->refs, 1);
+        atomic_fetch_add(&dir->fdRefs, 1);
+        wspoolSubmit(job->pool, walkDirTask, pending);
+    }
+    if (result == -1) {
+        walkError(job, dir->path, errno);
+    }
+    atomic_fetch_add(&dir->total, total);
+    walkReleaseFD(dir);
+    walkRelease(dir, worker);
+}
+
+static void walkDirTask(void* arg, int worker)
+{
+    struct walkPending* pending = arg;
+    struct walkDir* parent = pending->parent;
+    struct walkJob* job = parent->job;
+    struct walkWorker* self = &job->workers[worker];
+
+    int fd = openat(parent->fd, pending->name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    int error = errno;
+    walkReleaseFD(parent);
+    size_t pathLen = walkJoin(self, parent, pending->name);
+    struct walkDir* dir = (fd == -1) ? NULL : walkNewDir(job, parent, fd, self->path, pathLen, parent->depth + 1,
+                                                         pending->value);
+    if (dir == NULL) {
+        walkError(job, self->path, (fd == -1) ? error : ENOMEM);
+        if (fd != -1) {
+            close(fd);
+        }
+        atomic_fetch_add(&parent->total, pending->value);
+        free(pending);
+        walkRelease(parent, worker);
+        return;
+    }
+    free(pending);
+    walkRead(dir, worker);
+}
+
+static void walkRootTask(void* arg, int worker)
+{
+    struct walkRoot* root = arg;
+    struct walkJob* job = root->job;
+    const struct walkOptions* opts = job->opts;
+
+    struct statx stx;
+    if (statx(job->dirFD, root->path, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC,
+              opts->mask | STATX_TYPE, &stx) == -1) {
+        walkError(job, root->path, errno);
+        return;
+    }
+    unsigned char type = IFTODT(stx.stx_mode);
+    if (opts->unique && type != DT_DIR && stx.stx_nlink > 1 &&
+        !walkFirstLink(job, makedev(stx.stx_dev_major, stx.stx_dev_minor), stx.stx_ino)) {
+        return;
+    }
+
+    // A root is named after its last component, as find -name sees it
+    size_t pathLen = strlen(root->path);
+    const char* name = root->path + pathLen;
+    while (name > root->path && name[-1] == '/') {
+        name--;
+    }
+    while (name > root->path && name[-1] != '/') {
+        name--;
+    }
+    struct walkEntry entry = { root->path, pathLen, name, type, 0, opts->mask ? &stx : NULL };
+    unsigned long long value = opts->visit(&entry, worker, opts->ctx);
+    if (type != DT_DIR || opts->maxDepth == 0) {
+        return;
+    }
+
+    int fd = openat(job->dirFD, root->path, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct walkDir* dir = (fd == -1) ? NULL : walkNewDir(job, NULL, fd, root->path, pathLen, 0, value);
+    if (dir == NULL) {
+        walkError(job, root->path, (fd == -1) ? errno : ENOMEM);
+        if (fd != -1) {
+            close(fd);
+        }
+        return;
+    }
+    walkRead(dir, worker);
+}
+
+/* walkTree
+ * Each root is a task of its own, so several roots are walked at once.
+ * A directory's descriptor stays open until all of its subdirectories have
+ * been opened from it, so the soft descriptor limit is raised to the hard
+ * one for the duration of the walk.
+ */
+int walkTree(int dirFD, char* const* roots, int count, const struct walkOptions* opts)
+{
+    int threads = (opts->threads < 1) ? 1 : opts->threads;
+    struct walkJob job;
+    memset(&job, 0, sizeof(job));
+    job.opts = opts;
+    job.dirFD = dirFD;
+    atomic_init(&job.failed, 0);
+    for (int i = 0; i < WALK_SEEN_STRIPES; i++) {
+        pthread_mutex_init(&job.seen[i].lock, NULL);
+    }
+
+    job.workers = calloc(threads, sizeof(struct walkWorker));
+    struct walkRoot* rootTasks = malloc(count * sizeof(struct walkRoot));
+    job.pool = (job.workers && rootTasks) ? wspoolCreate(threads) : NULL;
+    int status = 0;
+    if (job.pool == NULL) {
+        perror(opts->name);
+        status = -1;
+    } else {
+        struct rlimit limit;
+        int raised = (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max);
+        if (raised) {
+            struct rlimit most = { limit.rlim_max, limit.rlim_max };
+            raised = (setrlimit(RLIMIT_NOFILE, &most) == 0);
+        }
+
+        for (int i = 0; i < count; i++) {
+            rootTasks[i] = (struct walkRoot){ &job, roots[i] };
+            wspoolSubmit(job.pool, walkRootTask, &rootTasks[i]);
+        }
+        wspoolWait(job.pool);
+        wspoolDestroy(job.pool);
+
+        if (raised) {
+            setrlimit(RLIMIT_NOFILE, &limit);
+        }
+        status = atomic_load(&job.failed) ? -1 : 0;
+    }
+
+    for (int i = 0; job.workers != NULL && i < threads; i++) {
+        if (job.workers[i].scanOpen) {
+            dirscanClose(&job.workers[i].scan);
+        }
+        free(job.workers[i].path);
+    }
+    for (int i = 0; i < WALK_SEEN_STRIPES; i++) {
+        free(job.seen[i].slots);
+        pthread_mutex_destroy(&job.seen[i].lock);
+    }
+    free(job.workers);
+    free(rootTasks);
+    return status;
+}
@@ -0,0 +1,82 @@
+#ifndef WALK_H
+#define WALK_H
+
+#include <stddef.h>
+#include <sys/stat.h>
+
+/* A parallel directory tree walker for find and du. Every directory is a
+ * task on the work-stealing pool: it is opened relative to its parent's
+ * descriptor, read with getdents64, and each entry is looked up with statx
+ * only for the fields the caller asked for. Symbolic links are never
+ * followed. Entries are visited on whichever worker reads their directory,
+ * so the order between directories is not fixed.
+ */
+
+/* walkEntry
+* path        the root as given, or the path of its directory, a / and name
+* pathLen     the length of path
+* name        the last component of path
+* type        the DT_* type of the entry; never DT_UNKNOWN
+* depth       0 for a root, 1 for the entries in it, and so on
+* stx         the fields asked for in walkOptions.mask, or NULL if it is 0
+*/
+struct walkEntry {
+    const char* path;
+    size_t pathLen;
+    const char* name;
+    unsigned char type;
+    int depth;
+    const struct statx* stx;
+};
+
+/*walkVisitFn
+* entry     the entry found; valid only during the call
+* worker    the index of the worker calling, 0 <= worker < threads
+* ctx       walkOptions.ctx
+* returns a number that is added to the total of the directory the entry is
+*         in, or for a directory that is descended into, to its own total
+*/
+typedef unsigned long long (*walkVisitFn)(const struct walkEntry* entry, int worker, void* ctx);
+
+/*walkLeaveFn
+* path      a directory whose whole subtree has been visited
+* total     what visit returned for it and for everything below it
+* depth     its depth
+* worker    the index of the worker calling
+* ctx       walkOptions.ctx
+*/
+typedef void (*walkLeaveFn)(const char* path, unsigned long long total, int depth, int worker, void* ctx);
+
+/* walkOptions
+* name        the command name errors are reported with
+* mask        the STATX_* fields visit needs, or 0 to look up nothing but
+*             the types getdents64 does not give
+* maxDepth    the deepest level visited, or -1 for no limit
+* unique      nonzero to visit a file with several hard links only once;
+*             mask must include STATX_NLINK and STATX_INO
+* threads     the number of worker threads
+* visit       called for every entry, roots included
+* leave       called for every directory once everything below it is done, or NULL
+* ctx         passed through to visit and leave
+*/
+struct walkOptions {
+    const char* name;
+    unsigned int mask;
+    int maxDepth;
+    int unique;
+    int threads;
+    walkVisitFn visit;
+    walkLeaveFn leave;
+    void* ctx;
+};
+
+/*walkTree
+* dirFD     the directory relative roots are looked up from, or AT_FDCWD
+* roots     the paths to walk
+* count     the number of roots
+* opts      what to look up and what to call
+* returns 0, or -1 if anything could not be read (already reported)
+*/
+int walkTree(int dirFD, char* const* roots, int count, const struct walkOptions* opts);
+
+#endif
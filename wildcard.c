@@ -0,0 +1,527 @@
+// Pathname expansion for unquoted *, ? and [...]
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "wildcard.h"
+#include "dirscan.h"
+#include "cwd.h"
+
+#define WILDCARD_SMALL_SORT 16  // lists this short are insertion sorted
+
+// One element of a compiled pattern component
+enum atomKind { ATOM_CHAR, ATOM_ANY, ATOM_SET };
+
+struct atom {
+    unsigned char kind;
+    unsigned char c;        // ATOM_CHAR: the character
+    unsigned short set;     // ATOM_SET: index into the matcher's sets
+};
+
+/* matcher
+* A pattern component compiled into the runs of atoms between its stars.
+* "a*b?*c" becomes the segments "a", "b?" and "c": the first has to match at
+* the start of a name and the last at its end, and each one in between is
+* taken at the leftmost place it fits, which never rules out a match. A name
+* is therefore matched in one pass, without backtracking over any star.
+* atoms       all segments back to back
+* bounds      segment i is atoms[bounds[i]] up to atoms[bounds[i + 1]]
+* segments    the number of segments, one more than the number of stars
+* sets        the character sets of the [...] atoms, one bit per byte value
+* dot         nonzero if the component starts with a literal '.', which
+*             names starting with '.' need
+*/
+struct matcher {
+    struct atom* atoms;
+    int* bounds;
+    int segments;
+    unsigned char (*sets)[32];
+    int dot;
+};
+
+// One name in a directory listing
+struct dirEntry {
+    size_t offset;          // into the listing's name pool
+    size_t len;
+    unsigned char type;     // DT_* type, may be DT_UNKNOWN
+};
+
+/* dirList
+* A directory read for the patterns of one line, kept until the line is
+* expanded so every pattern that looks into it shares the one read.
+*/
+struct dirList {
+    char* path;             // "" for the current directory
+    char* names;
+    struct dirEntry* entries;
+    size_t count;
+    struct dirList* next;
+};
+
+// A growing list of paths; the strings live in the arena
+struct pathList {
+    char** paths;
+    size_t count;
+    size_t capacity;
+};
+
+static void* growArray(void* array, size_t* capacity, size_t size)
+{
+    size_t newCapacity = *capacity ? *capacity * 2 : 64;
+    void* grown = realloc(array, newCapacity * size);
+    if (grown == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    *capacity = newCapacity;
+    return grown;
+}
+
+static void pushPath(struct pathList* list, char* path)
+{
+    if (list->count == list->capacity) {
+        list->paths = growArray(list->paths, &list->capacity, sizeof(char*));
+    }
+    list->paths[list->count++] = path;
+}
+
+/*
+* joinPath is a helper function that returns dir/name in the arena,
+* or just name when dir is the current directory "".
+*/
+static char* joinPath(const char* dir, const char* name, size_t nameLen, struct arena* arena)
+{
+    size_t dirLen = strlen(dir);
+    int slash = (dirLen > 0 && dir[dirLen - 1] != '/');
+    char* path = arenaAlloc(arena, dirLen + slash + nameLen + 1);
+    memcpy(path, dir, dirLen);
+    if (slash) {
+        path[dirLen] = '/';
+    }
+    memcpy(path + dirLen + slash, name, nameLen);
+    path[dirLen + slash + nameLen] = '\0';
+    return path;
+}
+
+// Named classes allowed inside [...]
+static const struct {
+    const char* name;
+    int (*test)(int);
+} namedSets[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank }, { "cntrl", iscntrl },
+    { "digit", isdigit }, { "graph", isgraph }, { "lower", islower }, { "print", isprint },
+    { "punct", ispunct }, { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+};
+
+/*
+* parseSet is a helper function that reads a [...] set whose '[' is just
+* before p into set.
+* returns the position after the closing ']', or NULL if there is none,
+* in which case the '[' is an ordinary character
+*/
+static const char* parseSet(const char* p, const char* end, unsigned char set[32])
+{
+    int negate = (p < end && (*p == '!' || *p == '^'));
+    p += negate;
+    memset(set, 0, 32);
+
+    // A ']' right at the start is a member, not the end
+    for (const char* first = p; p < end && (*p != ']' || p == first); ) {
+        if (*p == '[' && p + 1 < end && p[1] == ':') {
+            const char* close = memmem(p + 2, end - p - 2, ":]", 2);
+            size_t i = 0;
+            while (close != NULL && i < sizeof(namedSets) / sizeof(namedSets[0]) &&
+                   (strlen(namedSets[i].name) != (size_t)(close - p - 2) ||
+                    memcmp(namedSets[i].name, p + 2, close - p - 2) != 0)) {
+                i++;
+            }
+            if (close != NULL && i < sizeof(namedSets) / sizeof(namedSets[0])) {
+                for (int c = 0; c < 256; c++) {
+                    if (namedSets[i].test(c)) {
+                        set[c >> 3] |= 1 << (c & 7);
+                    }
+                }
+                p = close + 2;
+                continue;
+            }
+        }
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        }
+        unsigned lo = (unsigned char)*p++;
+        unsigned hi = lo;
+        if (p + 1 < end && *p == '-' && p[1] != ']') {
+            p++;
+            if (*p == '\\' && p + 1 < end) {
+                p++;
+            }
+            hi = (unsigned char)*p++;
+        }
+        for (unsigned c = lo; c <= hi; c++) {
+            set[c >> 3] |= 1 << (c & 7);
+        }
+    }
+    if (p >= end) {
+        return NULL;
+    }
+    if (negate) {
+        for (int i = 0; i < 32; i++) {
+            set[i] = ~set[i];
+        }
+    }
+    return p + 1;
+}
+
+/*
+* isWild is a helper function that tells whether a pattern component has a
+* wildcard, and so needs its directory read.
+*/
+static int isWild(const char* p, const char* end)
+{
+    unsigned char set[32];
+    for (; p < end; p++) {
+        if (*p == '\\') {
+            p++;
+        } else if (*p == '*' || *p == '?' || (*p == '[' && parseSet(p + 1, end, set) != NULL)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+* unescape is a helper function that returns a component without wildcards
+* as the plain name it stands for.
+*/
+static char* unescape(const char* p, const char* end, size_t* len, struct arena* arena)
+{
+    char* text = arenaAlloc(arena, end - p + 1);
+    char* out = text;
+    for (; p < end; p++) {
+        if (*p == '\\' && p + 1 < end) {
+            p++;
+        }
+        *out++ = *p;
+    }
+    *out = '\0';
+    *len = out - text;
+    return text;
+}
+
+static void compile(const char* p, const char* end, struct matcher* m, struct arena* arena)
+{
+    size_t n = end - p;
+    m->atoms = arenaAlloc(arena, n * sizeof(struct atom) + 1);
+    m->bounds = arenaAlloc(arena, (n + 2) * sizeof(int));
+    m->sets = arenaAlloc(arena, n * 32 + 1);
+    m->dot = (*p == '.' || (*p == '\\' && p + 1 < end && p[1] == '.'));
+    m->segments = 0;
+    m->bounds[0] = 0;
+
+    int count = 0;
+    int sets = 0;
+    while (p < end) {
+        if (*p == '*') {
+            // A run of stars is one star
+            while (p < end && *p == '*') {
+                p++;
+            }
+            m->bounds[++m->segments] = count;
+            continue;
+        }
+        struct atom a = { ATOM_CHAR, 0, 0 };
+        const char* next;
+        if (*p == '?') {
+            a.kind = ATOM_ANY;
+            p++;
+        } else if (*p == '[' && (next = parseSet(p + 1, end, m->sets[sets])) != NULL) {
+            a.kind = ATOM_SET;
+            a.set = sets++;
+            p = next;
+        } else {
+            if (*p == '\\' && p + 1 < end) {
+                p++;
+            }
+            a.c = *p++;
+        }
+        m->atoms[count++] = a;
+    }
+    m->bounds[++m->segments] = count;
+}
+
+// Matches segment seg of m against the bytes at s, which are known to be long enough
+static int segmentAt(const struct matcher* m, int seg, const char* s)
+{
+    for (int i = m->bounds[seg]; i < m->bounds[seg + 1]; i++) {
+        const struct atom* a = &m->atoms[i];
+        unsigned char c = *s++;
+        if (a->kind == ATOM_CHAR ? c != a->c :
+            a->kind == ATOM_SET && !(m->sets[a->set][c >> 3] & (1 << (c & 7)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int matches(const struct matcher* m, const char* name, size_t len)
+{
+    if (name[0] == '.' && !m->dot) {
+        return 0;
+    }
+    size_t first = m->bounds[1] - m->bounds[0];
+    if (m->segments == 1) {
+        return len == first && segmentAt(m, 0, name);
+    }
+
+    int lastSeg = m->segments - 1;
+    size_t last = m->bounds[lastSeg + 1] - m->bounds[lastSeg];
+    if (len < first + last || !segmentAt(m, 0, name) || !segmentAt(m, lastSeg, name + len - last)) {
+        return 0;
+    }
+    size_t pos = first;
+    size_t limit = len - last;
+    for (int seg = 1; seg < lastSeg; seg++) {
+        size_t n = m->bounds[seg + 1] - m->bounds[seg];
+        while (pos + n <= limit && !segmentAt(m, seg, name + pos)) {
+            pos++;
+        }
+        if (pos + n > limit) {
+            return 0;
+        }
+        pos += n;
+    }
+    return 1;
+}
+
+/*
+* readDir is a helper function that returns the listing of path, reading
+* it with getdents64 the first time any pattern of the line asks for it.
+* A directory that cannot be read lists as empty.
+*/
+static struct dirList* readDir(struct dirList** cache, const char* path)
+{
+    for (struct dirList* list = *cache; list != NULL; list = list->next) {
+        if (strcmp(list->path, path) == 0) {
+            return list;
+        }
+    }
+
+    struct dirList* list = calloc(1, sizeof(struct dirList));
+    char* copy = strdup(path);
+    if (list == NULL || copy == NULL) {
+        fprintf(stderr, "Memory allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    list->path = copy;
+    list->next = *cache;
+    *cache = list;
+
+    int fd = openat(cwdFD(), *path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct dirScan scan;
+    if (fd == -1 || dirscanOpen(&scan, fd) == -1) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return list;
+    }
+
+    size_t capacity = 0, poolUsed = 0, poolSize = 0;
+    const char* name;
+    unsigned char type;
+    while (dirscanNext(&scan, &name, &type) == 1) {
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+            continue;
+        }
+        size_t len = strlen(name);
+        if (list->count == capacity) {
+            list->entries = growArray(list->entries, &capacity, sizeof(struct dirEntry));
+        }
+        while (poolUsed + len + 1 > poolSize) {
+            list->names = growArray(list->names, &poolSize, 1);
+        }
+        memcpy(list->names + poolUsed, name, len + 1);
+        list->entries[list->count++] = (struct dirEntry){ poolUsed, len, type };
+        poolUsed += len + 1;
+    }
+    dirscanClose(&scan);
+    close(fd);
+    return list;
+}
+
+static int isDirectory(const char* path, unsigned char type)
+{
+    struct stat st;
+    if (type == DT_DIR) {
+        return 1;
+    }
+    return (type == DT_UNKNOWN || type == DT_LNK) && fstatat(cwdFD(), path, &st, 0) == 0 && S_ISDIR(st.st_mode);
+}
+
+/*
+* expandPattern is a helper function that appends the paths matching one
+* pattern to out. The pattern is taken a component at a time: a component
+* without wildcards is appended to every path found so far, and one with
+* wildcards replaces each of them by its matching directory entries.
+*/
+static void expandPattern(const char* pattern, struct dirList** cache, struct pathList* out, struct arena* arena)
+{
+    struct pathList current = { 0 }, next = { 0 };
+    const char* p = pattern;
+    pushPath(&current, (*p == '/') ? (char*)"/" : (char*)"");
+    int lastLiteral = 0;
+    int dirOnly = 0;
+
+    while (current.count > 0) {
+        while (*p == '/') {
+            p++;
+        }
+        const char* end = strchrnul(p, '/');
+        const char* rest = end;
+        while (*rest == '/') {
+            rest++;
+        }
+        int last = (*rest == '\0');
+        dirOnly = last && *end == '/';
+
+        next.count = 0;
+        if (!isWild(p, end)) {
+            size_t len;
+            char* name = unescape(p, end, &len, arena);
+            for (size_t i = 0; i < current.count; i++) {
+                pushPath(&next, joinPath(current.paths[i], name, len, arena));
+            }
+            lastLiteral = 1;
+        } else {
+            struct matcher m;
+            compile(p, end, &m, arena);
+            for (size_t i = 0; i < current.count; i++) {
+                const struct dirList* list = readDir(cache, current.paths[i]);
+                for (size_t j = 0; j < list->count; j++) {
+                    const struct dirEntry* entry = &list->entries[j];
+                    const char* name = list->names + entry->offset;
+                    if (!matches(&m, name, entry->len)) {
+                        continue;
+                    }
+                    char* path = joinPath(current.paths[i], name, entry->len, arena);
+                    if ((!last || dirOnly) && !isDirectory(path, entry->type)) {
+                        continue;
+                    }
+                    pushPath(&next, path);
+                }
+            }
+            lastLiteral = 0;
+        }
+
+        struct pathList swap = current;
+        current = next;
+        next = swap;
+        p = rest;
+        if (last) {
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < current.count; i++) {
+        char* path = current.paths[i];
+        struct stat st;
+        // Literal components were never looked up, so the result may not exist
+        if (lastLiteral && (dirOnly ? fstatat(cwdFD(), path, &st, 0) != 0 || !S_ISDIR(st.st_mode) :
+                                     fstatat(cwdFD(), path, &st, AT_SYMLINK_NOFOLLOW) != 0)) {
+            continue;
+        }
+        pushPath(out, dirOnly ? joinPath(path, "", 0, arena) : path);
+    }
+    free(current.paths);
+    free(next.paths);
+}
+
+/*
+* sortPaths is a helper function that puts paths in byte order with a
+* multikey quicksort: each pass partitions on the byte at depth only, so a
+* byte is looked at about once per path instead of once per comparison.
+*/
+static void sortPaths(char** a, size_t n, size_t depth)
+{
+    while (n > WILDCARD_SMALL_SORT) {
+        char* pivot = a[n / 2];
+        a[n / 2] = a[0];
+        a[0] = pivot;
+        unsigned char v = pivot[depth];
+
+        size_t lt = 0, i = 0, gt = n;
+        while (i < gt) {
+            unsigned char c = a[i][depth];
+            char* t = a[i];
+            if (c < v) {
+                a[i++] = a[lt];
+                a[lt++] = t;
+            } else if (c > v) {
+                a[i] = a[--gt];
+                a[gt] = t;
+            } else {
+                i++;
+            }
+        }
+        sortPaths(a, lt, depth);
+        sortPaths(a + gt, n - gt, depth);
+        if (v == '\0') {
+            return;
+        }
+        a += lt;
+        n = gt - lt;
+        depth++;
+    }
+
+    for (size_t i = 1; i < n; i++) {
+        char* t = a[i];
+        size_t j = i;
+        while (j > 0 && strcmp(a[j - 1] + depth, t + depth) > 0) {
+            a[j] = a[j - 1];
+            j--;
+        }
+        a[j] = t;
+    }
+}
+
+char** wildcardExpand(char** args, int* countp, char** patterns, struct arena* arena)
+{
+    struct dirList* cache = NULL;
+    struct pathList words = { 0 };
+
+    for (int i = 0; i < *countp; i++) {
+        if (patterns[i] == NULL) {
+            pushPath(&words, args[i]);
+            continue;
+        }
+        size_t before = words.count;
+        expandPattern(patterns[i], &cache, &words, arena);
+        if (words.count == before) {
+            pushPath(&words, args[i]);
+        } else {
+            sortPaths(words.paths + before, words.count - before, 0);
+        }
+    }
+
+    while (cache != NULL) {
+        struct dirList* next = cache->next;
+        free(cache->path);
+        free(cache->names);
+        free(cache->entries);
+        free(cache);
+        cache = next;
+    }
+
+    char** result = arenaAlloc(arena, (words.count + 1) * sizeof(char*));
+    memcpy(result, words.paths, words.count * sizeof(char*));
+    result[words.count] = NULL;
+    *countp = (int)words.count;
+    free(words.paths);
+    return result;
+}
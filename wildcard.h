@@ -0,0 +1,22 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+
+#include "arena.h"
+
+/* Pathname expansion. A pattern is a word as argparse saw it, with every
+ * character that was quoted or escaped written as \c, so only the unquoted
+ * *, ? and [...] are wildcards. Each directory a line's patterns look into
+ * is read once with getdents64, however many patterns need it.
+ */
+
+/*wildcardExpand
+* args      the words of a line, NULL terminated
+* countp    the number of words; updated to the number after expansion
+* patterns  for each word, its pattern if it has an unquoted wildcard, else NULL
+* arena     the arena the result is allocated from
+* returns the words with every pattern replaced by the paths it matches, in
+*         byte order; a pattern that matches nothing is left as its word
+*/
+char** wildcardExpand(char** args, int* countp, char** patterns, struct arena* arena);
+
+#endif
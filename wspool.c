@@ -0,0 +1,289 @@
+// Work-stealing thread pool
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "wspool.h"
+
+#define DEQUE_INITIAL_SIZE 256
+
+struct wsTask {
+    wsTaskFn fn;
+    void* arg;
+};
+
+// A worker's deque: a growable ring buffer, owner works the bottom, thieves the top
+struct wsDeque {
+    pthread_mutex_t lock;
+    struct wsTask* tasks;
+    size_t capacity;       // always a power of two
+    size_t top;            // next task to steal
+    size_t bottom;         // next free slot
+};
+
+struct wsWorker {
+    struct wsPool* pool;
+    int index;
+    pthread_t thread;
+    struct wsDeque deque;
+};
+
+struct wsPool {
+    struct wsWorker* workers;
+    int threads;
+    atomic_long pending;     // submitted tasks that have not finished yet
+    atomic_long queued;      // tasks sitting in some deque
+    atomic_int sleeping;     // workers blocked waiting for work
+    atomic_uint nextVictim;  // round robin for submissions from outside the pool
+    int stop;
+    pthread_mutex_t lock;
+    pthread_cond_t workReady;
+    pthread_cond_t allDone;
+};
+
+static __thread struct wsWorker* currentWorker;
+
+int wspoolDefaultThreads(void)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+static int dequePush(struct wsDeque* deque, struct wsTask task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        size_t capacity = deque->capacity * 2;
+        struct wsTask* tasks = malloc(capacity * sizeof(struct wsTask));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return -1;
+        }
+        for (size_t i = deque->top; i != deque->bottom; i++) {
+            tasks[i & (capacity - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+    }
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    deque->bottom++;
+    pthread_mutex_unlock(&deque->lock);
+    return 0;
+}
+
+// Owner side: newest task first, which keeps a depth-first walk cache friendly
+static int dequePop(struct wsDeque* deque, struct wsTask* task)
+{
+    int found = 0;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom != deque->top) {
+        deque->bottom--;
+        *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+// Thief side: oldest task first, which tends to be the largest piece of work
+static int dequeSteal(struct wsDeque* deque, struct wsTask* task)
+{
+    int found = 0;
+    if (pthread_mutex_trylock(&deque->lock) != 0) {
+        return 0;
+    }
+    if (deque->bottom != deque->top) {
+        *task = deque->tasks[deque->top & (deque->capacity - 1)];
+        deque->top++;
+        found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+static int findTask(struct wsWorker* self, struct wsTask* task)
+{
+    struct wsPool* pool = self->pool;
+    if (dequePop(&self->deque, task)) {
+        return 1;
+    }
+    for (int i = 1; i < pool->threads; i++) {
+        struct wsWorker* victim = &pool->workers[(self->index + i) % pool->threads];
+        if (dequeSteal(&victim->deque, task)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void* workerMain(void* arg)
+{
+    struct wsWorker* self = arg;
+    struct wsPool* pool = self->pool;
+    currentWorker = self;
+
+    while (1) {
+        struct wsTask task;
+        if (atomic_load(&pool->queued) > 0 && findTask(self, &task)) {
+            atomic_fetch_sub(&pool->queued, 1);
+            task.fn(task.arg, self->index);
+            if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+                pthread_mutex_lock(&pool->lock);
+                pthread_cond_broadcast(&pool->allDone);
+                pthread_mutex_unlock(&pool->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        atomic_fetch_add(&pool->sleeping, 1);
+        while (!pool->stop && atomic_load(&pool->queued) == 0) {
+            pthread_cond_wait(&pool->workReady, &pool->lock);
+        }
+        atomic_fetch_sub(&pool->sleeping, 1);
+        int stop = pool->stop;
+        pthread_mutex_unlock(&pool->lock);
+        if (stop) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+struct wsPool* wspoolCreate(int threads)
+{
+    if (threads < 1) {
+        threads = 1;
+    }
+    struct wsPool* pool = calloc(1, sizeof(struct wsPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->workers = calloc(threads, sizeof(struct wsWorker));
+    if (pool->workers == NULL) {
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->workReady, NULL);
+    pthread_cond_init(&pool->allDone, NULL);
+
+    for (int i = 0; i < threads; i++) {
+        struct wsWorker* worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->index = i;
+        pthread_mutex_init(&worker->deque.lock, NULL);
+        worker->deque.capacity = DEQUE_INITIAL_SIZE;
+        worker->deque.tasks = malloc(DEQUE_INITIAL_SIZE * sizeof(struct wsTask));
+    }
+    pool->threads = threads;
+
+    for (int i = 0; i < threads; i++) {
+        int err = pool->workers[i].deque.tasks == NULL ? ENOMEM :
+                  pthread_create(&pool->workers[i].thread, NULL, workerMain, &pool->workers[i]);
+        if (err != 0) {
+            // Shrink to the workers that did start
+            for (int j = i; j < threads; j++) {
+                free(pool->workers[j].deque.tasks);
+                pthread_mutex_destroy(&pool->workers[j].deque.lock);
+            }
+            pool->threads = i;
+            wspoolDestroy(pool);
+            errno = err;
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+void wspoolSubmit(struct wsPool* pool, wsTaskFn fn, void* arg)
+{
+    struct wsTask task = { fn, arg };
+    struct wsWorker* target = currentWorker;
+    if (target == NULL || target->pool != pool) {
+        target = &pool->workers[atomic_fetch_add(&pool->nextVictim, 1) % pool->threads];
+    }
+
+    atomic_fetch_add(&pool->pending, 1);
+    if (dequePush(&target->deque, task) == -1) {
+        // Out of memory: run the task right here instead of losing it
+        fn(arg, target->index);
+        atomic_fetch_sub(&pool->pending, 1);
+        return;
+    }
+    atomic_fetch_add(&pool->queued, 1);
+
+    if (atomic_load(&pool->sleeping) > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_signal(&pool->workReady);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+void wspoolWait(struct wsPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while (atomic_load(&pool->pending) > 0) {
+        pthread_cond_wait(&pool->allDone, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// One task of wspoolForEach: the items [first, first + count)
+struct wsRange {
+    int first;
+    int count;
+    wsItemFn fn;
+    void* ctx;
+};
+
+static void rangeTask(void* arg, int worker)
+{
+    struct wsRange* range = arg;
+    for (int i = range->first; i < range->first + range->count; i++) {
+        range->fn(i, worker, range->ctx);
+    }
+}
+
+void wspoolForEach(struct wsPool* pool, int count, int chunk, wsItemFn fn, void* ctx)
+{
+    int rangeCount = (count + chunk - 1) / chunk;
+    struct wsRange* ranges = (pool != NULL && count > 0) ? malloc(rangeCount * sizeof(struct wsRange)) : NULL;
+    if (ranges == NULL) {
+        for (int i = 0; i < count; i++) {
+            fn(i, 0, ctx);
+        }
+        return;
+    }
+    for (int r = 0; r < rangeCount; r++) {
+        int first = r * chunk;
+        ranges[r] = (struct wsRange){ first, (count - first < chunk) ? count - first : chunk, fn, ctx };
+        wspoolSubmit(pool, rangeTask, &ranges[r]);
+    }
+    wspoolWait(pool);
+    free(ranges);
+}
+
+void wspoolDestroy(struct wsPool* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->workReady);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->threads; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+    for (int i = 0; i < pool->threads; i++) {
+        free(pool->workers[i].deque.tasks);
+        pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->workReady);
+    pthread_cond_destroy(&pool->allDone);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,65 @@
+#ifndef WSPOOL_H
+#define WSPOOL_H
+
+/* A fixed pool of worker threads with one work-stealing deque per worker.
+ * Tasks submitted from a worker go to the bottom of that worker's own deque
+ * and are popped LIFO; idle workers steal FIFO from the top of the others.
+ */
+struct wsPool;
+
+/*wsTaskFn
+* arg       the argument given to wspoolSubmit
+* worker    index of the worker running the task, 0 <= worker < thread count
+*/
+typedef void (*wsTaskFn)(void* arg, int worker);
+
+/*wsItemFn
+* index     the item to process, 0 <= index < count
+* worker    index of the worker running it, or 0 on the calling thread
+* ctx       the context given to wspoolForEach
+*/
+typedef void (*wsItemFn)(int index, int worker, void* ctx);
+
+/*wspoolDefaultThreads
+* returns the number of online CPUs, at least 1
+*/
+int wspoolDefaultThreads(void);
+
+/*wspoolCreate
+* threads   number of worker threads to start
+* returns a new pool, or NULL with errno set
+*/
+struct wsPool* wspoolCreate(int threads);
+
+/*wspoolSubmit
+* pool      the pool to run the task on
+* fn        the task function
+* arg       the argument passed to fn
+* Safe to call from any thread, including from inside a running task.
+*/
+void wspoolSubmit(struct wsPool* pool, wsTaskFn fn, void* arg);
+
+/*wspoolWait
+* pool      the pool to wait on
+* Blocks until every submitted task, and every task those submitted, has run.
+*/
+void wspoolWait(struct wsPool* pool);
+
+/*wspoolForEach
+* pool      the pool to run on, or NULL to run every item on the calling thread
+* count     the number of items
+* chunk     how many consecutive items one task runs, so that cheap items
+*           are not each paid for with a task of their own
+* fn        called once for every item
+* ctx       passed through to fn
+* Returns once fn has run for every item, which also waits for any other
+* task on the pool.
+*/
+void wspoolForEach(struct wsPool* pool, int count, int chunk, wsItemFn fn, void* ctx);
+
+/*wspoolDestroy
+* pool      the pool to stop; it must be idle (see wspoolWait)
+*/
+void wspoolDestroy(struct wsPool* pool);
+
+#endif